@@ -1,7 +1,9 @@
 #!/bin/bash
+COMMON_SOURCES="treasure_store.c treasure_index.c treasure_agg.c treasure_geo.c treasure_columns.c treasure_fts.c treasure_catalog.c treasure_format.c treasure_lz.c treasure_segment.c"
+
 echo "Compiling treasure_manager.c..."
 
-gcc treasure_manager.c -o treasure_manager -lm
+gcc treasure_manager.c treasure_log.c $COMMON_SOURCES -o treasure_manager -lm
 
 if [ $? -eq 0 ]; then
     echo "Compilation of treasure_manager successful!"
@@ -12,7 +14,7 @@ else
 fi
 
 echo "Compiling treasure_hub.c..."
-gcc treasure_hub.c -o treasure_hub -lm
+gcc treasure_hub.c treasure_protocol.c score_engine.c $COMMON_SOURCES -o treasure_hub -lm -lpthread
 
 if [ $? -eq 0 ]; then
     echo "Compilation of treasure_hub successful!"
@@ -23,7 +25,7 @@ else
 fi
 
 echo "Compiling treasure_monitor.c..."
-gcc treasure_monitor.c -o treasure_monitor -lm
+gcc treasure_monitor.c treasure_protocol.c treasure_metrics.c $COMMON_SOURCES -o treasure_monitor -lm -lpthread
 
 if [ $? -eq 0 ]; then
     echo "Compilation of treasure_monitor successful!"
@@ -34,7 +36,7 @@ else
 fi
 
 echo "Compiling score_calculator.c..."
-gcc score_calculator.c -o score_calculator
+gcc score_calculator.c score_engine.c $COMMON_SOURCES -o score_calculator -lm -lpthread
 
 if [ $? -eq 0 ]; then
     echo "Compilation of score_calculator successful!"
@@ -44,4 +46,26 @@ else
     exit 1
 fi
 
+echo "Compiling treasure_generate.c..."
+gcc treasure_generate.c $COMMON_SOURCES -o treasure_generate -lm
+
+if [ $? -eq 0 ]; then
+    echo "Compilation of treasure_generate successful!"
+    chmod +x treasure_generate
+else
+    echo "Compilation of treasure_generate failed. Please check for errors."
+    exit 1
+fi
+
+echo "Compiling treasure_bench.c..."
+gcc treasure_bench.c treasure_protocol.c -o treasure_bench
+
+if [ $? -eq 0 ]; then
+    echo "Compilation of treasure_bench successful!"
+    chmod +x treasure_bench
+else
+    echo "Compilation of treasure_bench failed. Please check for errors."
+    exit 1
+fi
+
 echo "All compilations successful! Use ./treasure_manager for direct management or ./treasure_hub for the interactive interface."
@@ -1,109 +1,132 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <errno.h>
+#include "score_engine.h"
 
-#define MAX_PATH_LENGTH 512
-#define TREASURE_FILE "treasures.dat"
+#define DEFAULT_TOP 10
 
-#define MAX_CLUE_LENGTH 256
-#define MAX_USERNAME_LENGTH 64
-#define MAX_ID_LENGTH 32
+/* With --format the objects go to the real stdout and the human-readable errors to stderr. */
+static OutputFormat output_format = OUTPUT_TEXT;
+static FormatWriter output_writer;
 
-typedef struct
+/* --all [--top K]: merges every hunt in the current directory and prints the best K users. */
+int score_all(int argc, char *argv[])
 {
-    char id[MAX_ID_LENGTH];
-    char username[MAX_USERNAME_LENGTH];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE_LENGTH];
-    int value;
-} Treasure;
-
-typedef struct
-{
-    char username[MAX_USERNAME_LENGTH];
-    int score;
-} UserScore;
-
-#define MAX_UNIQUE_USERS 100
-
-int main(int argc, char *argv[])
-{
-    if (argc != 2)
+    long k = DEFAULT_TOP;
+    if (argc == 4 && strcmp(argv[2], "--top") == 0)
     {
-        printf("Error: Usage: %s <hunt_id>\n", argv[0]);
-        return EXIT_FAILURE;
+        char *end;
+        k = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || k <= 0)
+        {
+            printf("Error: Invalid value for --top: %s\n", argv[3]);
+            return EXIT_FAILURE;
+        }
     }
-
-    const char *hunt_id = argv[1];
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
-
-    int fd = open(treasure_path, O_RDONLY);
-    if (fd == -1)
+    else if (argc != 2)
     {
-        printf("Error: Could not open treasure file '%s' for hunt '%s'. (%s)\n", treasure_path, hunt_id, strerror(errno));
+        printf("Error: Usage: %s --all [--top K]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    Treasure treasure;
-    UserScore scores[MAX_UNIQUE_USERS];
-    int num_users = 0;
+    ScoreTable table;
+    UserScore *top = NULL;
+    int hunts = 0;
+    score_table_init(&table);
 
-    for (int i = 0; i < MAX_UNIQUE_USERS; i++)
+    ScoreStatus status = score_all_hunts(&table, 0, &hunts);
+    if (status == SCORE_OPEN_FAILED)
     {
-        scores[i].username[0] = '\0';
-        scores[i].score = 0;
+        perror("Failed to open current directory to list hunts");
     }
-
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    else
     {
-        int user_idx = -1;
-        for (int i = 0; i < num_users; i++)
+        if (status == SCORE_NO_MEMORY)
         {
-            if (strcmp(scores[i].username, treasure.username) == 0)
-            {
-                user_idx = i;
-                break;
-            }
+            printf("Error: Out of memory, the leaderboard is incomplete.\n");
         }
-
-        if (user_idx != -1)
+        if ((size_t)k > table.count)
+            k = (long)table.count;
+        top = malloc(((size_t)k + 1) * sizeof(UserScore));
+        if (top == NULL)
         {
-            scores[user_idx].score += treasure.value;
+            printf("Error: Out of memory.\n");
+            status = SCORE_NO_MEMORY;
         }
         else
         {
-            if (num_users < MAX_UNIQUE_USERS)
-            {
-                strncpy(scores[num_users].username, treasure.username, MAX_USERNAME_LENGTH - 1);
-                scores[num_users].username[MAX_USERNAME_LENGTH - 1] = '\0';
-                scores[num_users].score = treasure.value;
-                num_users++;
-            }
+            size_t count = score_table_top(&table, (size_t)k, top);
+            if (output_format != OUTPUT_TEXT)
+                score_format_top(&output_writer, top, count, &table, hunts);
             else
-            {
-                printf("Warning: Maximum unique users (%d) reached for scoring in hunt '%s'. Some user scores might be omitted.\n", MAX_UNIQUE_USERS, hunt_id);
-            }
+                score_print_top(stdout, top, count, &table, hunts);
         }
     }
-    close(fd);
 
-    if (num_users == 0)
+    score_table_free(&table);
+    free(top);
+    return status == SCORE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [--sort] <hunt_id>: prints every user's score in one hunt. */
+int score_one(int argc, char *argv[])
+{
+    int sort_by_score = argc == 3 && strcmp(argv[1], "--sort") == 0;
+    if (argc != 2 && !sort_by_score)
+    {
+        printf("Error: Usage: %s [--format=text|json|ndjson|binary] [--sort] <hunt_id> | --all [--top K]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *hunt_id = argv[argc - 1];
+    ScoreTable table;
+    int error = 0;
+    score_table_init(&table);
+
+    ScoreStatus status = score_hunt(hunt_id, &table, &error);
+    if (sort_by_score)
     {
-        printf("No treasures found or no users with treasures in hunt '%s'.\n", hunt_id);
+        score_table_sort(&table);
     }
+    if (output_format != OUTPUT_TEXT)
+        score_format(&output_writer, hunt_id, status, error, &table);
     else
+        score_print(stdout, hunt_id, status, error, &table);
+    score_table_free(&table);
+
+    return status == SCORE_OPEN_FAILED ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!format_take_option(&argc, argv, &output_format))
     {
-        for (int i = 0; i < num_users; i++)
+        printf("Error: --format must be text, json, ndjson or binary\n");
+        return EXIT_FAILURE;
+    }
+    if (output_format != OUTPUT_TEXT)
+    {
+        int out = dup(STDOUT_FILENO);
+        if (out == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
         {
-            printf("User: %s, Score: %d\n", scores[i].username, scores[i].score);
+            perror("Failed to redirect output");
+            return EXIT_FAILURE;
         }
+        format_begin_fd(&output_writer, output_format, out);
+    }
+
+    int status;
+    if (argc >= 2 && strcmp(argv[1], "--all") == 0)
+    {
+        status = score_all(argc, argv);
+    }
+    else
+    {
+        status = score_one(argc, argv);
     }
 
-    return EXIT_SUCCESS;
+    if (output_format != OUTPUT_TEXT)
+        format_finish(&output_writer);
+    return status;
 }
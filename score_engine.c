@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include "score_engine.h"
+#include "treasure_store.h"
+#include "treasure_agg.h"
+#include "treasure_catalog.h"
+
+#define SCORE_TABLE_MIN_BUCKETS 64
+
+static uint64_t hash_username(const char *name)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < MAX_USERNAME_LENGTH && name[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void place_score(ScoreTable *table, uint64_t hash, uint32_t index)
+{
+    size_t mask = table->bucket_count - 1;
+    size_t i = (size_t)hash & mask;
+    while (table->buckets[i] != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    table->buckets[i] = index + 1;
+}
+
+static int grow_buckets(ScoreTable *table)
+{
+    size_t bucket_count = table->bucket_count ? table->bucket_count * 2 : SCORE_TABLE_MIN_BUCKETS;
+    uint32_t *buckets = calloc(bucket_count, sizeof(uint32_t));
+    if (buckets == NULL)
+    {
+        return 0;
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = bucket_count;
+    for (size_t i = 0; i < table->count; i++)
+    {
+        place_score(table, table->scores[i].hash, (uint32_t)i);
+    }
+    return 1;
+}
+
+/* Returns the index of username's entry, adding it with a zero score if needed. */
+uint32_t score_table_find_or_add(ScoreTable *table, const char *username)
+{
+    uint64_t hash = hash_username(username);
+    if (table->bucket_count > 0)
+    {
+        size_t mask = table->bucket_count - 1;
+        for (size_t i = (size_t)hash & mask; table->buckets[i] != 0; i = (i + 1) & mask)
+        {
+            UserScore *entry = &table->scores[table->buckets[i] - 1];
+            if (entry->hash == hash && strncmp(entry->username, username, MAX_USERNAME_LENGTH) == 0)
+            {
+                return table->buckets[i] - 1;
+            }
+        }
+    }
+
+    if ((table->count + 1) * 2 > table->bucket_count && !grow_buckets(table))
+    {
+        return SCORE_NO_USER;
+    }
+    if (table->count == table->capacity)
+    {
+        size_t capacity = table->capacity ? table->capacity * 2 : SCORE_TABLE_MIN_BUCKETS;
+        UserScore *scores = realloc(table->scores, capacity * sizeof(UserScore));
+        if (scores == NULL)
+        {
+            return SCORE_NO_USER;
+        }
+        table->scores = scores;
+        table->capacity = capacity;
+    }
+
+    uint32_t index = (uint32_t)table->count++;
+    UserScore *entry = &table->scores[index];
+    snprintf(entry->username, MAX_USERNAME_LENGTH, "%s", username);
+    entry->hash = hash;
+    entry->score = 0;
+    place_score(table, hash, index);
+    return index;
+}
+
+static int compare_scores(const void *a, const void *b)
+{
+    const UserScore *x = a;
+    const UserScore *y = b;
+    if (x->score != y->score)
+    {
+        return x->score < y->score ? 1 : -1;
+    }
+    return strcmp(x->username, y->username);
+}
+
+void score_table_init(ScoreTable *table)
+{
+    memset(table, 0, sizeof(*table));
+}
+
+void score_table_free(ScoreTable *table)
+{
+    free(table->scores);
+    free(table->buckets);
+    score_table_init(table);
+}
+
+/* Orders by descending score, ties by name; the buckets are rebuilt so lookups keep working. */
+void score_table_sort(ScoreTable *table)
+{
+    qsort(table->scores, table->count, sizeof(UserScore), compare_scores);
+    if (table->bucket_count > 0)
+    {
+        memset(table->buckets, 0, table->bucket_count * sizeof(uint32_t));
+        for (size_t i = 0; i < table->count; i++)
+        {
+            place_score(table, table->scores[i].hash, (uint32_t)i);
+        }
+    }
+}
+
+/* Adds every score in from to the matching user in into; 0 when into cannot grow. */
+int score_table_merge(ScoreTable *into, const ScoreTable *from)
+{
+    for (size_t i = 0; i < from->count; i++)
+    {
+        uint32_t index = score_table_find_or_add(into, from->scores[i].username);
+        if (index == SCORE_NO_USER)
+        {
+            return 0;
+        }
+        into->scores[index].score += from->scores[i].score;
+    }
+    return 1;
+}
+
+static void sift_down(UserScore *heap, size_t count, size_t i)
+{
+    for (;;)
+    {
+        size_t worst = i, left = 2 * i + 1, right = left + 1;
+        /* compare_scores() > 0 means the first entry ranks below the second. */
+        if (left < count && compare_scores(&heap[left], &heap[worst]) > 0)
+            worst = left;
+        if (right < count && compare_scores(&heap[right], &heap[worst]) > 0)
+            worst = right;
+        if (worst == i)
+            return;
+        UserScore swap = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = swap;
+        i = worst;
+    }
+}
+
+/*
+ * Copies the k best entries of table into out, best first, and returns how
+ * many there were. out doubles as a heap whose root is the lowest-ranked
+ * entry kept so far, so the table itself is left untouched.
+ */
+size_t score_table_top(const ScoreTable *table, size_t k, UserScore *out)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < table->count && k > 0; i++)
+    {
+        const UserScore *entry = &table->scores[i];
+        if (count < k)
+        {
+            out[count++] = *entry;
+            if (count == k)
+            {
+                for (size_t j = k / 2; j-- > 0;)
+                    sift_down(out, count, j);
+            }
+        }
+        else if (compare_scores(entry, &out[0]) < 0)
+        {
+            out[0] = *entry;
+            sift_down(out, count, 0);
+        }
+    }
+    qsort(out, count, sizeof(UserScore), compare_scores);
+    return count;
+}
+
+/* Reads the per-user totals treasure_manager keeps in treasures.agg; -1 when they cannot be opened. */
+static int score_from_aggregates(ScoreTable *table, TreasureStore *store)
+{
+    TreasureAgg agg;
+    if (!treasure_agg_open(&agg, store, 0))
+    {
+        return -1;
+    }
+
+    int ok = 1;
+    for (uint32_t user = 0; user < agg.header->user_count; user++)
+    {
+        if (agg.entries[user].count == 0)
+        {
+            continue;
+        }
+        uint32_t index = score_table_find_or_add(table, store_username(store, user));
+        if (index == SCORE_NO_USER)
+        {
+            ok = 0;
+            break;
+        }
+        table->scores[index].score += (long)agg.entries[user].total;
+    }
+    treasure_agg_close(&agg);
+    return ok;
+}
+
+/* Full pass over the records, used when the aggregates cannot be opened or rebuilt. */
+static int score_from_records(ScoreTable *table, TreasureStore *store)
+{
+    /* User numbers are dense, so each one is hashed only the first time it shows up. */
+    uint32_t *user_entries = malloc((store->user_count + 1) * sizeof(uint32_t));
+    if (user_entries == NULL)
+    {
+        return 0;
+    }
+    memset(user_entries, 0xff, (store->user_count + 1) * sizeof(uint32_t));
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    int ok = 1;
+
+    store_cursor_open(&cursor, store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
+    {
+        uint32_t user = record->user < store->user_count ? record->user : store->user_count;
+        if (user_entries[user] == SCORE_NO_USER)
+        {
+            user_entries[user] = score_table_find_or_add(table, store_username(store, record->user));
+            if (user_entries[user] == SCORE_NO_USER)
+            {
+                ok = 0;
+                break;
+            }
+        }
+        table->scores[user_entries[user]].score += record->value;
+    }
+    free(user_entries);
+    return ok;
+}
+
+/* Adds a hunt's per-user totals to table; error receives errno when the hunt cannot be opened. */
+ScoreStatus score_hunt(const char *hunt_id, ScoreTable *table, int *error)
+{
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 0) || !store_load_users(&store))
+    {
+        if (error != NULL)
+            *error = errno;
+        return SCORE_OPEN_FAILED;
+    }
+
+    int ok = score_from_aggregates(table, &store);
+    if (ok == -1)
+    {
+        ok = score_from_records(table, &store);
+    }
+    store_close(&store);
+    return ok ? SCORE_OK : SCORE_NO_MEMORY;
+}
+
+typedef struct
+{
+    char (*hunts)[MAX_PATH_LENGTH];
+    int count;
+    int next;
+    int scored;
+    ScoreStatus status;
+    ScoreTable *total;
+    pthread_mutex_t lock;
+} HuntPool;
+
+/* Scores hunts into a private table until none are left, then merges it into the shared total once. */
+static void *score_hunts_worker(void *arg)
+{
+    HuntPool *pool = arg;
+    ScoreTable partial;
+    ScoreStatus status = SCORE_OK;
+    int scored = 0;
+    score_table_init(&partial);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        int i = pool->next < pool->count ? pool->next++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (i == -1)
+        {
+            break;
+        }
+
+        /* A hunt removed since it was listed is skipped rather than failing the whole board. */
+        ScoreStatus hunt_status = score_hunt(pool->hunts[i], &partial, NULL);
+        if (hunt_status == SCORE_NO_MEMORY)
+            status = SCORE_NO_MEMORY;
+        if (hunt_status != SCORE_OPEN_FAILED)
+            scored++;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (!score_table_merge(pool->total, &partial))
+        status = SCORE_NO_MEMORY;
+    if (status != SCORE_OK)
+        pool->status = status;
+    pool->scored += scored;
+    pthread_mutex_unlock(&pool->lock);
+
+    score_table_free(&partial);
+    return NULL;
+}
+
+/*
+ * Adds the per-user totals of every hunt in the current directory to table,
+ * scoring up to jobs hunts at a time (the CPU count when jobs is 0).
+ * hunts_scored receives the number of hunts that could be opened.
+ */
+ScoreStatus score_all_hunts(ScoreTable *table, int jobs, int *hunts_scored)
+{
+    HuntPool pool;
+    pool.count = catalog_list_hunts(&pool.hunts);
+    if (pool.count < 0)
+    {
+        return SCORE_OPEN_FAILED;
+    }
+    pool.next = 0;
+    pool.scored = 0;
+    pool.status = SCORE_OK;
+    pool.total = table;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    if (jobs <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+    if (jobs > pool.count)
+        jobs = pool.count;
+
+    pthread_t *threads = malloc((jobs > 0 ? jobs : 1) * sizeof(pthread_t));
+    int started = 0;
+
+    /* Workers leave signal handling to the calling thread. */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    while (threads != NULL && started < jobs &&
+           pthread_create(&threads[started], NULL, score_hunts_worker, &pool) == 0)
+    {
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (started == 0)
+    {
+        score_hunts_worker(&pool);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(pool.hunts);
+    pthread_mutex_destroy(&pool.lock);
+
+    if (hunts_scored != NULL)
+        *hunts_scored = pool.scored;
+    return pool.status;
+}
+
+/* Prints the report score_calculator has always produced for one hunt. */
+void score_print(FILE *out, const char *hunt_id, ScoreStatus status, int error, const ScoreTable *table)
+{
+    if (status == SCORE_OPEN_FAILED)
+    {
+        fprintf(out, "Error: Could not open treasure file '%s/%s' for hunt '%s'. (%s)\n",
+                hunt_id, TREASURE_HOT_FILE, hunt_id, strerror(error));
+        return;
+    }
+    if (status == SCORE_NO_MEMORY)
+    {
+        fprintf(out, "Error: Out of memory scoring hunt '%s'.\n", hunt_id);
+    }
+
+    if (table->count == 0)
+    {
+        fprintf(out, "No treasures found or no users with treasures in hunt '%s'.\n", hunt_id);
+        return;
+    }
+    for (size_t i = 0; i < table->count; i++)
+    {
+        fprintf(out, "User: %s, Score: %ld\n", table->scores[i].username, table->scores[i].score);
+    }
+}
+
+/* Prints a leaderboard of count entries taken from table with score_table_top(). */
+void score_print_top(FILE *out, const UserScore *top, size_t count, const ScoreTable *table, int hunts)
+{
+    fprintf(out, "--- Leaderboard: top %zu of %zu users across %d hunts ---\n", count, table->count, hunts);
+    for (size_t i = 0; i < count; i++)
+    {
+        fprintf(out, "%zu. User: %s, Score: %ld\n", i + 1, top[i].username, top[i].score);
+    }
+    fprintf(out, "--- End of Leaderboard ---\n");
+}
+
+/* The same reports as score objects, with errors as error objects. */
+void score_format(FormatWriter *writer, const char *hunt_id, ScoreStatus status, int error, const ScoreTable *table)
+{
+    char message[512];
+    if (status == SCORE_OPEN_FAILED)
+    {
+        snprintf(message, sizeof(message), "Could not open treasure file '%s/%s' for hunt '%s'. (%s)", hunt_id,
+                 TREASURE_HOT_FILE, hunt_id, strerror(error));
+        format_error(writer, message);
+        return;
+    }
+    if (status == SCORE_NO_MEMORY)
+    {
+        snprintf(message, sizeof(message), "Out of memory scoring hunt '%s'.", hunt_id);
+        format_error(writer, message);
+    }
+
+    for (size_t i = 0; i < table->count; i++)
+    {
+        format_object(writer, "score");
+        format_string(writer, "hunt", hunt_id, MAX_PATH_LENGTH);
+        format_string(writer, "user", table->scores[i].username, MAX_USERNAME_LENGTH);
+        format_int(writer, "score", table->scores[i].score);
+        format_end_object(writer);
+    }
+}
+
+void score_format_top(FormatWriter *writer, const UserScore *top, size_t count, const ScoreTable *table, int hunts)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        format_object(writer, "score");
+        format_int(writer, "rank", (long long)(i + 1));
+        format_string(writer, "user", top[i].username, MAX_USERNAME_LENGTH);
+        format_int(writer, "score", top[i].score);
+        format_end_object(writer);
+    }
+    format_object(writer, "summary");
+    format_int(writer, "users", (long long)table->count);
+    format_int(writer, "hunts", hunts);
+    format_end_object(writer);
+}
@@ -0,0 +1,59 @@
+#ifndef SCORE_ENGINE_H
+#define SCORE_ENGINE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "treasure.h"
+#include "treasure_format.h"
+
+/*
+ * Per-user score totals shared by score_calculator and the hub. Scores live
+ * in one dense array in first-seen order; buckets is an open-addressing
+ * table of indexes into it (index + 1, 0 for empty) that doubles whenever it
+ * gets half full. score_all_hunts() gives each worker thread its own table
+ * and merges them at the end, so memory follows the number of distinct
+ * users rather than the number of treasures.
+ */
+
+#define SCORE_NO_USER UINT32_MAX
+
+typedef struct
+{
+    char username[MAX_USERNAME_LENGTH];
+    uint64_t hash;
+    long score;
+} UserScore;
+
+typedef struct
+{
+    UserScore *scores;
+    size_t count;
+    size_t capacity;
+    uint32_t *buckets;
+    size_t bucket_count;
+} ScoreTable;
+
+typedef enum
+{
+    SCORE_OK = 0,
+    SCORE_OPEN_FAILED,
+    SCORE_NO_MEMORY
+} ScoreStatus;
+
+void score_table_init(ScoreTable *table);
+void score_table_free(ScoreTable *table);
+uint32_t score_table_find_or_add(ScoreTable *table, const char *username);
+void score_table_sort(ScoreTable *table);
+
+int score_table_merge(ScoreTable *into, const ScoreTable *from);
+size_t score_table_top(const ScoreTable *table, size_t k, UserScore *out);
+
+ScoreStatus score_hunt(const char *hunt_id, ScoreTable *table, int *error);
+ScoreStatus score_all_hunts(ScoreTable *table, int jobs, int *hunts_scored);
+void score_print(FILE *out, const char *hunt_id, ScoreStatus status, int error, const ScoreTable *table);
+void score_print_top(FILE *out, const UserScore *top, size_t count, const ScoreTable *table, int hunts);
+void score_format(FormatWriter *writer, const char *hunt_id, ScoreStatus status, int error, const ScoreTable *table);
+void score_format_top(FormatWriter *writer, const UserScore *top, size_t count, const ScoreTable *table, int hunts);
+
+#endif
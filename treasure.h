@@ -0,0 +1,58 @@
+#ifndef TREASURE_H
+#define TREASURE_H
+
+#include <stdint.h>
+
+#define MAX_CLUE_LENGTH 256
+#define MAX_USERNAME_LENGTH 64
+#define MAX_ID_LENGTH 32
+#define MAX_PATH_LENGTH 512
+#define TREASURE_FILE "treasures.dat"
+#define TREASURE_BACKUP_FILE "treasures.dat.bak"
+#define TREASURE_HOT_FILE "treasures.hot"
+#define TREASURE_CLUE_FILE "treasures.clues"
+#define TREASURE_USER_FILE "treasures.users"
+#define TREASURE_INDEX_FILE "treasures.idx"
+#define TREASURE_AGG_FILE "treasures.agg"
+#define TREASURE_GEO_FILE "treasures.geo"
+#define TREASURE_FTS_FILE "treasures.fts"
+#define TREASURE_SEGMENT_FILE "treasures.seg"
+#define TREASURE_LOCK_FILE "treasures.lock"
+#define TREASURE_CATALOG_FILE "hunts.catalog"
+#define TREASURE_CATALOG_LOCK_FILE "hunts.catalog.lock"
+
+/* Full treasure as entered by the user, and the legacy treasures.dat record layout. */
+typedef struct
+{
+    char id[MAX_ID_LENGTH];
+    char username[MAX_USERNAME_LENGTH];
+    double latitude;
+    double longitude;
+    char clue[MAX_CLUE_LENGTH];
+    int value;
+} Treasure;
+
+/* Removed treasures keep their slot with an empty ID until the hunt is compacted. */
+#define TREASURE_IS_DEAD(t) ((t)->id[0] == '\0')
+
+/*
+ * Fixed-width record in treasures.hot. Usernames are interned in
+ * treasures.users and clues live in treasures.clues, so scans and scoring
+ * only read the 72 bytes they need per treasure.
+ */
+typedef struct
+{
+    char id[MAX_ID_LENGTH];
+    double latitude;
+    double longitude;
+    uint64_t clue_offset;
+    uint32_t clue_length;
+    uint32_t user;
+    int32_t value;
+    uint32_t deleted;
+} TreasureRecord;
+
+/* deleted holds the store generation that removed the record, 0 while it is live. */
+#define RECORD_IS_DEAD(r) ((r)->deleted != 0)
+
+#endif
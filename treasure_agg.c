@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "treasure_agg.h"
+
+#define AGG_MIN_CAPACITY 64
+
+static size_t image_size(uint64_t capacity)
+{
+    return sizeof(TreasureAggHeader) + capacity * sizeof(TreasureAggEntry);
+}
+
+static void stamp_header(TreasureAggHeader *header, const StoreStamp *stamp)
+{
+    header->data_ino = stamp->ino;
+    header->data_size = stamp->size;
+    header->data_mtime_sec = stamp->mtime_sec;
+    header->data_mtime_nsec = stamp->mtime_nsec;
+}
+
+static int header_is_current(const TreasureAggHeader *header, size_t file_size, TreasureStore *store)
+{
+    if (file_size < sizeof(TreasureAggHeader) ||
+        header->magic != TREASURE_AGG_MAGIC ||
+        header->version != TREASURE_AGG_VERSION ||
+        header->user_count > header->capacity ||
+        header->user_count > store->user_count ||
+        file_size != image_size(header->capacity))
+    {
+        return 0;
+    }
+
+    StoreStamp now;
+    return store_stamp_now(store, &now) &&
+           header->data_ino == now.ino &&
+           header->data_size == now.size &&
+           header->data_mtime_sec == now.mtime_sec &&
+           header->data_mtime_nsec == now.mtime_nsec;
+}
+
+static void unmap_agg(TreasureAgg *agg)
+{
+    if (agg->header != NULL)
+    {
+        munmap(agg->header, agg->map_size);
+        agg->header = NULL;
+        agg->entries = NULL;
+        agg->map_size = 0;
+    }
+    if (agg->agg_fd != -1)
+    {
+        close(agg->agg_fd);
+        agg->agg_fd = -1;
+    }
+}
+
+static int map_image(TreasureAgg *agg, int fd, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    agg->agg_fd = fd;
+    agg->header = map;
+    agg->entries = (TreasureAggEntry *)((char *)map + sizeof(TreasureAggHeader));
+    agg->map_size = size;
+    return 1;
+}
+
+/* Writes image next to the live file and renames it into place; the caller holds the hunt lock. */
+static int publish_image(TreasureAgg *agg, const void *image, size_t size)
+{
+    char agg_path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH];
+    store_hunt_path(agg_path, agg->store->hunt_id, TREASURE_AGG_FILE);
+    store_temp_path(temp_path, agg->store->hunt_id, TREASURE_AGG_FILE);
+
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    const char *p = image;
+    size_t left = size;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(temp_path);
+            return 0;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    close(fd);
+    if (rename(temp_path, agg_path) != 0)
+    {
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+/* Moves the aggregates into private memory, where writers change them and readers keep rebuilt ones. */
+static int adopt_anonymous(TreasureAgg *agg, void *image, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    memcpy(map, image, size);
+    unmap_agg(agg);
+    agg->header = map;
+    agg->entries = (TreasureAggEntry *)((char *)map + sizeof(TreasureAggHeader));
+    agg->map_size = size;
+    return 1;
+}
+
+/* Only writers publish; a reader's rebuilt copy stays private. */
+static int install_image(TreasureAgg *agg, void *image, size_t size)
+{
+    if (agg->writable)
+        publish_image(agg, image, size);
+    int ok = adopt_anonymous(agg, image, size);
+    free(image);
+    return ok;
+}
+
+static void *new_image(uint64_t capacity)
+{
+    TreasureAggHeader *header = calloc(1, image_size(capacity));
+    if (header != NULL)
+    {
+        header->magic = TREASURE_AGG_MAGIC;
+        header->version = TREASURE_AGG_VERSION;
+        header->capacity = capacity;
+    }
+    return header;
+}
+
+int treasure_agg_rebuild(TreasureAgg *agg)
+{
+    TreasureStore *store = agg->store;
+    if (!store_load_users(store))
+    {
+        return 0;
+    }
+
+    uint64_t capacity = AGG_MIN_CAPACITY;
+    while (capacity < store->user_count)
+    {
+        capacity <<= 1;
+    }
+
+    TreasureAggHeader *header = new_image(capacity);
+    if (header == NULL)
+    {
+        return 0;
+    }
+    TreasureAggEntry *entries = (TreasureAggEntry *)((char *)header + sizeof(TreasureAggHeader));
+    header->user_count = store->user_count;
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
+    {
+        if (record->user < store->user_count)
+        {
+            entries[record->user].total += record->value;
+            entries[record->user].count++;
+        }
+    }
+
+    stamp_header(header, &store->stamp);
+    return install_image(agg, header, image_size(capacity));
+}
+
+static int grow(TreasureAgg *agg, uint64_t needed)
+{
+    uint64_t capacity = agg->header->capacity;
+    while (capacity < needed)
+    {
+        capacity <<= 1;
+    }
+
+    TreasureAggHeader *header = new_image(capacity);
+    if (header == NULL)
+    {
+        return 0;
+    }
+    uint64_t old_capacity = agg->header->capacity;
+    memcpy(header, agg->header, image_size(old_capacity));
+    header->capacity = capacity;
+    int ok = adopt_anonymous(agg, header, image_size(capacity));
+    free(header);
+    return ok;
+}
+
+int treasure_agg_open(TreasureAgg *agg, TreasureStore *store, int writable)
+{
+    memset(agg, 0, sizeof(*agg));
+    agg->store = store;
+    agg->agg_fd = -1;
+    agg->writable = writable;
+
+    if (!store_load_users(store))
+    {
+        return 0;
+    }
+
+    char agg_path[MAX_PATH_LENGTH];
+    store_hunt_path(agg_path, store->hunt_id, TREASURE_AGG_FILE);
+
+    int fd = open(agg_path, O_RDONLY);
+    if (fd != -1)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreasureAggHeader) &&
+            map_image(agg, fd, (size_t)st.st_size))
+        {
+            if (header_is_current(agg->header, (size_t)st.st_size, store))
+            {
+                /* Writers work on a private copy and publish it whole from treasure_agg_sync(). */
+                if (writable && !adopt_anonymous(agg, agg->header, agg->map_size))
+                {
+                    treasure_agg_close(agg);
+                    return 0;
+                }
+                return 1;
+            }
+            unmap_agg(agg);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    if (!treasure_agg_rebuild(agg))
+    {
+        treasure_agg_close(agg);
+        return 0;
+    }
+    return 1;
+}
+
+void treasure_agg_close(TreasureAgg *agg)
+{
+    unmap_agg(agg);
+}
+
+/* Adds value and count (1 for a new treasure, -1 for a removed one) to user's totals. */
+int treasure_agg_update(TreasureAgg *agg, uint32_t user, long value, int count)
+{
+    if (user >= agg->header->capacity && !grow(agg, (uint64_t)user + 1))
+    {
+        return 0;
+    }
+
+    if (user >= agg->header->user_count)
+    {
+        agg->header->user_count = (uint64_t)user + 1;
+    }
+    agg->entries[user].total += value;
+    agg->entries[user].count += (uint64_t)(int64_t)count;
+    return 1;
+}
+
+/* Stamps the private copy with the current treasures.hot and publishes it in place of the live file. */
+void treasure_agg_sync(TreasureAgg *agg)
+{
+    stamp_header(agg->header, &agg->store->stamp);
+    publish_image(agg, agg->header, agg->map_size);
+}
@@ -0,0 +1,55 @@
+#ifndef TREASURE_AGG_H
+#define TREASURE_AGG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "treasure_store.h"
+
+/*
+ * Per-hunt score aggregates (treasures.agg): the total value and number of
+ * live treasures for every user number in treasures.users. treasure_manager
+ * updates it alongside each add and remove, so scoring a hunt costs O(users).
+ * Like the ID index, the header remembers the hot file it matches and a
+ * mismatch on open triggers a rebuild from the records. The file is small,
+ * so writers change a private copy and publish all of it on sync; readers
+ * never see a total and count from different updates.
+ */
+
+#define TREASURE_AGG_MAGIC 0x47474154u
+#define TREASURE_AGG_VERSION 1
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t user_count;
+    uint64_t data_ino;
+    int64_t data_size;
+    int64_t data_mtime_sec;
+    int64_t data_mtime_nsec;
+} TreasureAggHeader;
+
+typedef struct
+{
+    int64_t total;
+    uint64_t count;
+} TreasureAggEntry;
+
+typedef struct
+{
+    TreasureStore *store;
+    int agg_fd;
+    int writable;
+    TreasureAggHeader *header;
+    TreasureAggEntry *entries;
+    size_t map_size;
+} TreasureAgg;
+
+int treasure_agg_open(TreasureAgg *agg, TreasureStore *store, int writable);
+void treasure_agg_close(TreasureAgg *agg);
+int treasure_agg_update(TreasureAgg *agg, uint32_t user, long value, int count);
+int treasure_agg_rebuild(TreasureAgg *agg);
+void treasure_agg_sync(TreasureAgg *agg);
+
+#endif
@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "treasure.h"
+#include "treasure_protocol.h"
+
+/*
+ * Times the command-line tools and the hub <-> monitor protocol against
+ * generated hunts of each requested size. Every measurement is printed as
+ * one JSON object per line so runs can be stored and compared; progress
+ * goes to stderr. Run it from the directory holding the built binaries.
+ */
+
+#define DEFAULT_SIZES "1000,100000,1000000"
+#define DEFAULT_RUNS 20
+#define DEFAULT_DIR "bench_data"
+#define MAX_SIZES 16
+#define ROUND_TRIPS_PER_RUN 10
+
+typedef struct
+{
+    char manager[MAX_PATH_LENGTH];
+    char generator[MAX_PATH_LENGTH];
+    char scorer[MAX_PATH_LENGTH];
+    char monitor[MAX_PATH_LENGTH];
+    FILE *out;
+    int runs;
+} Bench;
+
+typedef struct
+{
+    int in_fd;
+    int out_fd;
+    pid_t pid;
+    FrameReader reader;
+} MonitorLink;
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Writes one result line; samples are sorted in place for the percentiles. */
+static void report(Bench *bench, const char *name, long records, double *samples, int count, int failures)
+{
+    if (count == 0)
+    {
+        fprintf(bench->out, "{\"benchmark\":\"%s\",\"records\":%ld,\"runs\":0,\"failures\":%d}\n",
+                name, records, failures);
+        return;
+    }
+
+    double total = 0;
+    qsort(samples, (size_t)count, sizeof(double), compare_doubles);
+    for (int i = 0; i < count; i++)
+        total += samples[i];
+
+    fprintf(bench->out,
+            "{\"benchmark\":\"%s\",\"records\":%ld,\"runs\":%d,\"failures\":%d,\"mean_us\":%.1f,"
+            "\"min_us\":%.1f,\"p50_us\":%.1f,\"p95_us\":%.1f,\"max_us\":%.1f}\n",
+            name, records, count, failures, total / count, samples[0], samples[count / 2],
+            samples[(count * 95) / 100 < count ? (count * 95) / 100 : count - 1], samples[count - 1]);
+    fflush(bench->out);
+    fprintf(stderr, "  %-12s %8ld records  mean %10.1f us  p50 %10.1f us\n", name, records, total / count,
+            samples[count / 2]);
+}
+
+/* Runs a tool with output discarded and input fed from text; returns its elapsed time in us, or -1 if it failed. */
+static double run_tool(const char *path, char *const argv[], const char *input)
+{
+    int input_pipe[2] = {-1, -1};
+    if (input != NULL && pipe(input_pipe) == -1)
+        return -1;
+
+    double start = now_us();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        if (input != NULL)
+        {
+            close(input_pipe[0]);
+            close(input_pipe[1]);
+        }
+        return -1;
+    }
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(input != NULL ? input_pipe[0] : null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (input != NULL)
+        {
+            close(input_pipe[0]);
+            close(input_pipe[1]);
+        }
+        execv(path, argv);
+        _exit(127);
+    }
+
+    if (input != NULL)
+    {
+        close(input_pipe[0]);
+        size_t left = strlen(input);
+        while (left > 0)
+        {
+            ssize_t n = write(input_pipe[1], input, left);
+            if (n <= 0)
+                break;
+            input += n;
+            left -= (size_t)n;
+        }
+        close(input_pipe[1]);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    double elapsed = now_us() - start;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+/* Runs a tool with no input and reports whether its standard output contains needle; 0 also when it failed. */
+static int tool_prints(const char *path, char *const argv[], const char *needle)
+{
+    int output_pipe[2];
+    if (pipe(output_pipe) == -1)
+        return 0;
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+        return 0;
+    }
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(output_pipe[1], STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(output_pipe[0]);
+        close(output_pipe[1]);
+        execv(path, argv);
+        _exit(127);
+    }
+
+    close(output_pipe[1]);
+    size_t used = 0, capacity = 4096;
+    char *output = malloc(capacity);
+    ssize_t n = 0;
+    while (output != NULL && (n = read(output_pipe[0], output + used, capacity - used - 1)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        used += (size_t)n;
+        if (capacity - used == 1)
+        {
+            char *grown = realloc(output, capacity * 2);
+            if (grown == NULL)
+                break;
+            output = grown;
+            capacity *= 2;
+        }
+    }
+    close(output_pipe[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    int found = 0;
+    if (output != NULL)
+    {
+        output[used] = '\0';
+        found = WIFEXITED(status) && WEXITSTATUS(status) == 0 && strstr(output, needle) != NULL;
+    }
+    free(output);
+    return found;
+}
+
+static int start_link(Bench *bench, MonitorLink *link)
+{
+    int requests[2], responses[2];
+    if (pipe(requests) == -1)
+        return 0;
+    if (pipe(responses) == -1)
+    {
+        close(requests[0]);
+        close(requests[1]);
+        return 0;
+    }
+
+    link->pid = fork();
+    if (link->pid == 0)
+    {
+        char request_fd[16], response_fd[16];
+        close(requests[1]);
+        close(responses[0]);
+        snprintf(request_fd, sizeof(request_fd), "%d", requests[0]);
+        snprintf(response_fd, sizeof(response_fd), "%d", responses[1]);
+        execl(bench->monitor, "treasure_monitor", request_fd, response_fd, (char *)NULL);
+        _exit(127);
+    }
+
+    close(requests[0]);
+    close(responses[1]);
+    if (link->pid == -1)
+    {
+        close(requests[1]);
+        close(responses[0]);
+        return 0;
+    }
+    link->out_fd = requests[1];
+    link->in_fd = responses[0];
+    frame_reader_init(&link->reader);
+    return 1;
+}
+
+/* Closing the request pipe is enough: the monitor exits on EOF from its hub. */
+static void stop_link(MonitorLink *link)
+{
+    close(link->out_fd);
+    close(link->in_fd);
+    waitpid(link->pid, NULL, 0);
+    frame_reader_free(&link->reader);
+}
+
+/* Sends one request and reads every chunk of its response; returns 0 if the monitor went away. */
+static int round_trip(MonitorLink *link, uint32_t request_id, FrameType type, int argc, const char *const *argv)
+{
+    char payload[FRAME_CHUNK_SIZE];
+    size_t length = frame_pack_args(payload, sizeof(payload), argc, argv);
+    if (!frame_write(link->out_fd, (uint16_t)type, 0, request_id, payload, length))
+        return 0;
+
+    for (;;)
+    {
+        FrameHeader header;
+        char *body;
+        int status = frame_reader_next(&link->reader, &header, &body);
+        if (status == -1)
+            return 0;
+        if (status == 1)
+        {
+            if (header.type == FRAME_RESPONSE && header.request_id == request_id && !(header.flags & FRAME_FLAG_MORE))
+                return 1;
+            continue;
+        }
+        ssize_t n = frame_reader_fill(&link->reader, link->in_fd);
+        if (n == 0 || (n < 0 && errno != EINTR))
+            return 0;
+    }
+}
+
+static void bench_size(Bench *bench, long records)
+{
+    char hunt_id[64], count_text[32];
+    snprintf(hunt_id, sizeof(hunt_id), "bench_%ld", records);
+    snprintf(count_text, sizeof(count_text), "%ld", records);
+
+    int runs = bench->runs;
+    double *samples = malloc(sizeof(double) * (size_t)runs * ROUND_TRIPS_PER_RUN);
+    if (samples == NULL)
+        return;
+    int count, failures;
+    double t;
+    uint64_t state = (uint64_t)records * 2654435761u + 1;
+
+    fprintf(stderr, "Hunt %s:\n", hunt_id);
+    char *remove_old[] = {"treasure_manager", "--remove_hunt", hunt_id, NULL};
+    run_tool(bench->manager, remove_old, NULL);
+
+    char *generate[] = {"treasure_generate", hunt_id, count_text, NULL};
+    t = run_tool(bench->generator, generate, NULL);
+    count = t >= 0;
+    samples[0] = t;
+    report(bench, "generate", records, samples, count, !count);
+    if (!count || records == 0)
+    {
+        free(samples);
+        return;
+    }
+
+    /*
+     * Random existing IDs for view and remove, drawn with a fixed seed so runs
+     * compare. Repeats are rejected so every remove hits a live treasure; only
+     * when there are more runs than records does an ID come round again.
+     */
+    char (*ids)[MAX_ID_LENGTH] = malloc(sizeof(*ids) * (size_t)runs);
+    if (ids == NULL)
+    {
+        free(samples);
+        return;
+    }
+    for (int i = 0; i < runs; i++)
+    {
+        int repeat;
+        do
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            snprintf(ids[i], MAX_ID_LENGTH, "G%ld", (long)((state >> 33) % (uint64_t)records));
+            repeat = 0;
+            for (long j = i - i % records; j < i && !repeat; j++)
+                repeat = strcmp(ids[j], ids[i]) == 0;
+        } while (repeat);
+    }
+
+    count = failures = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        char input[128];
+        snprintf(input, sizeof(input), "B%d\nbench_user\n45.5\n25.5\nbenchmark clue %d\n%d\n", i, i, i);
+        char *add[] = {"treasure_manager", "--add", hunt_id, NULL};
+        if ((t = run_tool(bench->manager, add, input)) >= 0)
+            samples[count++] = t;
+        else
+            failures++;
+    }
+    report(bench, "add", records, samples, count, failures);
+
+    /*
+     * A treasure 999 km from the query point, poleward of it and just past
+     * the old d / cos(lat) longitude bound of the grid box; a near query
+     * that misses it counts as a failure.
+     */
+    char *add_edge[] = {"treasure_manager", "--add", hunt_id, NULL};
+    char *near[] = {"treasure_manager", "--near", hunt_id, "60", "0", "1000000", NULL};
+    run_tool(bench->manager, add_edge, "BEDGE\nbench_user\n61.2\n18.2\nnear edge\n1\n");
+    count = 0;
+    failures = !tool_prints(bench->manager, near, "ID: BEDGE\n");
+    for (int i = 0; i < runs && i < 5; i++)
+    {
+        if ((t = run_tool(bench->manager, near, NULL)) >= 0)
+            samples[count++] = t;
+        else
+            failures++;
+    }
+    report(bench, "near", records, samples, count, failures);
+
+    count = failures = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        char *view[] = {"treasure_manager", "--view", hunt_id, ids[i], NULL};
+        if ((t = run_tool(bench->manager, view, NULL)) >= 0)
+            samples[count++] = t;
+        else
+            failures++;
+    }
+    report(bench, "view", records, samples, count, failures);
+
+    count = failures = 0;
+    for (int i = 0; i < runs && i < 5; i++)
+    {
+        char *list[] = {"treasure_manager", "--list", hunt_id, NULL};
+        if ((t = run_tool(bench->manager, list, NULL)) >= 0)
+            samples[count++] = t;
+        else
+            failures++;
+    }
+    report(bench, "list", records, samples, count, failures);
+
+    count = failures = 0;
+    for (int i = 0; i < runs && i < 5; i++)
+    {
+        char *score[] = {"score_calculator", hunt_id, NULL};
+        if ((t = run_tool(bench->scorer, score, NULL)) >= 0)
+            samples[count++] = t;
+        else
+            failures++;
+    }
+    report(bench, "score", records, samples, count, failures);
+
+    MonitorLink link;
+    count = failures = 0;
+    if (start_link(bench, &link))
+    {
+        uint32_t request_id = 1;
+        for (int i = 0; i < runs * ROUND_TRIPS_PER_RUN; i++)
+        {
+            const char *args[] = {hunt_id, ids[i % runs]};
+            double start = now_us();
+            if (!round_trip(&link, request_id++, FRAME_VIEW_TREASURE, 2, args))
+            {
+                failures++;
+                break;
+            }
+            samples[count++] = now_us() - start;
+        }
+        report(bench, "monitor_view", records, samples, count, failures);
+
+        count = failures = 0;
+        for (int i = 0; i < runs && i < 5; i++)
+        {
+            const char *args[] = {hunt_id};
+            double start = now_us();
+            if (!round_trip(&link, request_id++, FRAME_LIST_TREASURES, 1, args))
+            {
+                failures++;
+                break;
+            }
+            samples[count++] = now_us() - start;
+        }
+        report(bench, "monitor_list", records, samples, count, failures);
+
+        count = failures = 0;
+        for (int i = 0; i < runs && i < 5; i++)
+        {
+            const char *args[] = {hunt_id};
+            double start = now_us();
+            if (!round_trip(&link, request_id++, FRAME_LIST_RECORDS, 1, args))
+            {
+                failures++;
+                break;
+            }
+            samples[count++] = now_us() - start;
+        }
+        report(bench, "monitor_records", records, samples, count, failures);
+        stop_link(&link);
+    }
+    else
+    {
+        report(bench, "monitor_view", records, samples, 0, 1);
+    }
+
+    count = failures = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        char *remove[] = {"treasure_manager", "--remove_treasure", hunt_id, ids[i], NULL};
+        if ((t = run_tool(bench->manager, remove, NULL)) >= 0)
+            samples[count++] = t;
+        else
+            failures++;
+    }
+    report(bench, "remove", records, samples, count, failures);
+
+    char *remove_hunt[] = {"treasure_manager", "--remove_hunt", hunt_id, NULL};
+    t = run_tool(bench->manager, remove_hunt, NULL);
+    count = t >= 0;
+    samples[0] = t;
+    report(bench, "remove_hunt", records, samples, count, !count);
+
+    free(ids);
+    free(samples);
+}
+
+static int tool_path(char *out, const char *dir, const char *name)
+{
+    snprintf(out, MAX_PATH_LENGTH, "%s/%s", dir, name);
+    if (access(out, X_OK) != 0)
+    {
+        fprintf(stderr, "Error: %s not found; build it with compile.sh first\n", out);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *sizes = DEFAULT_SIZES, *dir = DEFAULT_DIR, *output = NULL;
+    Bench bench;
+    bench.runs = DEFAULT_RUNS;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+            goto usage;
+        if (strcmp(argv[i], "--sizes") == 0)
+            sizes = argv[i + 1];
+        else if (strcmp(argv[i], "--runs") == 0)
+        {
+            bench.runs = atoi(argv[i + 1]);
+            if (bench.runs <= 0)
+                goto usage;
+        }
+        else if (strcmp(argv[i], "--dir") == 0)
+            dir = argv[i + 1];
+        else if (strcmp(argv[i], "--output") == 0)
+            output = argv[i + 1];
+        else
+            goto usage;
+    }
+
+    long record_counts[MAX_SIZES];
+    int size_count = 0;
+    char *copy = strdup(sizes), *saveptr;
+    for (char *field = strtok_r(copy, ",", &saveptr); field != NULL && size_count < MAX_SIZES;
+         field = strtok_r(NULL, ",", &saveptr))
+    {
+        char *end;
+        record_counts[size_count] = strtol(field, &end, 10);
+        if (end == field || *end != '\0' || record_counts[size_count] < 0)
+        {
+            free(copy);
+            goto usage;
+        }
+        size_count++;
+    }
+    free(copy);
+
+    char tools[MAX_PATH_LENGTH];
+    if (getcwd(tools, sizeof(tools)) == NULL ||
+        !tool_path(bench.manager, tools, "treasure_manager") || !tool_path(bench.generator, tools, "treasure_generate") ||
+        !tool_path(bench.scorer, tools, "score_calculator") || !tool_path(bench.monitor, tools, "treasure_monitor"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    bench.out = stdout;
+    if (output != NULL && (bench.out = fopen(output, "w")) == NULL)
+    {
+        perror("Failed to open output file");
+        return EXIT_FAILURE;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Failed to create benchmark directory");
+        return EXIT_FAILURE;
+    }
+    if (chdir(dir) != 0)
+    {
+        perror("Failed to enter benchmark directory");
+        return EXIT_FAILURE;
+    }
+
+    /* Keep removals from triggering compaction so each one measures the same work. */
+    setenv("TREASURE_COMPACT_THRESHOLD", "100", 1);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(bench.out, "{\"benchmark\":\"meta\",\"unix_time\":%ld,\"cpus\":%ld,\"runs\":%d}\n",
+            (long)time(NULL), sysconf(_SC_NPROCESSORS_ONLN), bench.runs);
+    for (int i = 0; i < size_count; i++)
+    {
+        bench_size(&bench, record_counts[i]);
+    }
+
+    if (bench.out != stdout)
+        fclose(bench.out);
+    return EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "Usage: %s [--sizes N,N,...] [--runs N] [--dir PATH] [--output FILE]\n", argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "treasure_catalog.h"
+#include "treasure_agg.h"
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const CatalogEntry *)a)->name, ((const CatalogEntry *)b)->name);
+}
+
+/* Fills entry for the store's hunt from its score aggregates and file sizes. */
+static int summarize(TreasureStore *store, CatalogEntry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    if (strlen(store->hunt_id) >= CATALOG_NAME_LENGTH)
+    {
+        return 0;
+    }
+    strcpy(entry->name, store->hunt_id);
+
+    TreasureAgg agg;
+    if (!treasure_agg_open(&agg, store, 0))
+    {
+        return 0;
+    }
+    for (uint64_t user = 0; user < agg.header->user_count; user++)
+    {
+        entry->records += agg.entries[user].count;
+        entry->total_value += agg.entries[user].total;
+    }
+    treasure_agg_close(&agg);
+
+    entry->bytes = (uint64_t)store_disk_bytes(store);
+    entry->mtime_sec = store->stamp.mtime_sec;
+    return 1;
+}
+
+/* Reads the whole catalog with one read; returns the entry count, or -1 if it is missing or damaged. */
+static int read_catalog(CatalogEntry **entries)
+{
+    int fd = open(TREASURE_CATALOG_FILE, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    char *data = NULL;
+    ssize_t got = -1;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreasureCatalogHeader) &&
+        (data = malloc((size_t)st.st_size)) != NULL)
+    {
+        do
+        {
+            got = read(fd, data, (size_t)st.st_size);
+        } while (got == -1 && errno == EINTR);
+    }
+    close(fd);
+
+    TreasureCatalogHeader header;
+    if (got != (ssize_t)st.st_size)
+    {
+        free(data);
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != TREASURE_CATALOG_MAGIC || header.version != TREASURE_CATALOG_VERSION ||
+        (size_t)st.st_size != sizeof(header) + header.count * sizeof(CatalogEntry))
+    {
+        free(data);
+        return -1;
+    }
+
+    memmove(data, data + sizeof(header), header.count * sizeof(CatalogEntry));
+    *entries = (CatalogEntry *)data;
+    return (int)header.count;
+}
+
+/* Builds the entries the slow way, from the hunt directories. */
+static int scan_hunts(CatalogEntry **entries)
+{
+    char (*hunts)[MAX_PATH_LENGTH];
+    int hunt_count = store_list_hunts(&hunts);
+    if (hunt_count < 0)
+    {
+        return -1;
+    }
+
+    CatalogEntry *found = malloc(((size_t)hunt_count + 1) * sizeof(CatalogEntry));
+    if (found == NULL)
+    {
+        free(hunts);
+        return -1;
+    }
+
+    int count = 0;
+    for (int i = 0; i < hunt_count; i++)
+    {
+        TreasureStore store;
+        if (store_open(&store, hunts[i], 0))
+        {
+            if (summarize(&store, &found[count]))
+                count++;
+            store_close(&store);
+        }
+    }
+    free(hunts);
+
+    *entries = found;
+    return count;
+}
+
+static int write_catalog(const CatalogEntry *entries, int count)
+{
+    char temp_path[MAX_PATH_LENGTH];
+    store_temp_path(temp_path, ".", TREASURE_CATALOG_FILE);
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    TreasureCatalogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TREASURE_CATALOG_MAGIC;
+    header.version = TREASURE_CATALOG_VERSION;
+    header.count = (uint64_t)count;
+
+    int ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header);
+    const char *p = (const char *)entries;
+    size_t left = (size_t)count * sizeof(CatalogEntry);
+    while (ok && left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            ok = 0;
+        else
+        {
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+    close(fd);
+
+    if (!ok || rename(temp_path, TREASURE_CATALOG_FILE) != 0)
+    {
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static int lock_catalog()
+{
+    int fd = open(TREASURE_CATALOG_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    int status;
+    do
+    {
+        status = flock(fd, LOCK_EX);
+    } while (status == -1 && errno == EINTR);
+    if (status == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void unlock_catalog(int fd)
+{
+    if (fd != -1)
+        close(fd);
+}
+
+/* Called with the catalog lock held: the current entries, scanned for when there is no catalog yet. */
+static int current_entries(CatalogEntry **entries)
+{
+    int count = read_catalog(entries);
+    return count >= 0 ? count : scan_hunts(entries);
+}
+
+/* Fills *entries with every catalogued hunt, sorted by name; -1 on error. */
+int catalog_load(CatalogEntry **entries)
+{
+    int count = read_catalog(entries);
+    if (count >= 0)
+    {
+        return count;
+    }
+
+    /* A directory we cannot write to still gets an answer from the scan. */
+    int lock_fd = lock_catalog();
+    count = read_catalog(entries);
+    if (count < 0)
+    {
+        count = scan_hunts(entries);
+        if (count >= 0 && lock_fd != -1)
+            write_catalog(*entries, count);
+    }
+    unlock_catalog(lock_fd);
+    return count;
+}
+
+/* Drop-in for store_list_hunts() that reads the catalog instead of the directory. */
+int catalog_list_hunts(char (**hunts)[MAX_PATH_LENGTH])
+{
+    CatalogEntry *entries;
+    int count = catalog_load(&entries);
+    if (count < 0)
+    {
+        return -1;
+    }
+
+    char (*names)[MAX_PATH_LENGTH] = malloc(((size_t)count + 1) * sizeof(*names));
+    if (names == NULL)
+    {
+        free(entries);
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(names[i], MAX_PATH_LENGTH, "%s", entries[i].name);
+    }
+    free(entries);
+    *hunts = names;
+    return count;
+}
+
+/* Refreshes the entry for the store's hunt; writers call it once their sidecar files are synced. */
+int catalog_update(TreasureStore *store)
+{
+    CatalogEntry entry;
+    if (!summarize(store, &entry))
+    {
+        return 0;
+    }
+
+    int lock_fd = lock_catalog();
+    if (lock_fd == -1)
+    {
+        return 0;
+    }
+
+    CatalogEntry *entries;
+    int count = current_entries(&entries);
+    int ok = count >= 0;
+    if (ok)
+    {
+        CatalogEntry *match = bsearch(&entry, entries, (size_t)count, sizeof(CatalogEntry), compare_entries);
+        if (match != NULL)
+        {
+            *match = entry;
+        }
+        else
+        {
+            CatalogEntry *grown = realloc(entries, ((size_t)count + 1) * sizeof(CatalogEntry));
+            ok = grown != NULL;
+            if (ok)
+            {
+                entries = grown;
+                entries[count++] = entry;
+                qsort(entries, (size_t)count, sizeof(CatalogEntry), compare_entries);
+            }
+        }
+        ok = ok && write_catalog(entries, count);
+        free(entries);
+    }
+
+    unlock_catalog(lock_fd);
+    return ok;
+}
+
+int catalog_remove(const char *hunt_id)
+{
+    int lock_fd = lock_catalog();
+    if (lock_fd == -1)
+    {
+        return 0;
+    }
+
+    CatalogEntry *entries;
+    int count = current_entries(&entries);
+    int ok = count >= 0;
+    if (ok)
+    {
+        int kept = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (strcmp(entries[i].name, hunt_id) != 0)
+                entries[kept++] = entries[i];
+        }
+        ok = write_catalog(entries, kept);
+        free(entries);
+    }
+
+    unlock_catalog(lock_fd);
+    return ok;
+}
+
+/* Rewrites the catalog from the hunt directories; returns the number of hunts or -1. */
+int catalog_rebuild()
+{
+    int lock_fd = lock_catalog();
+    if (lock_fd == -1)
+    {
+        return -1;
+    }
+
+    CatalogEntry *entries;
+    int count = scan_hunts(&entries);
+    if (count >= 0)
+    {
+        if (!write_catalog(entries, count))
+            count = -1;
+        free(entries);
+    }
+
+    unlock_catalog(lock_fd);
+    return count;
+}
@@ -0,0 +1,47 @@
+#ifndef TREASURE_CATALOG_H
+#define TREASURE_CATALOG_H
+
+#include <stdint.h>
+#include "treasure.h"
+#include "treasure_store.h"
+
+/*
+ * Root-level catalog of hunts (hunts.catalog): one fixed-size entry per
+ * hunt, sorted by name, with its live treasure count, total value, bytes
+ * on disk and the time treasures.hot last changed. Listing hunts is a
+ * single read of this file instead of a stat and open per directory.
+ *
+ * Writers refresh their hunt's entry once they are done with it. Every
+ * change rewrites the catalog next to the live file and renames it into
+ * place under an flock() on hunts.catalog.lock, so readers never lock and
+ * never see half an update. A missing catalog is rebuilt by scanning the
+ * hunt directories, which is also what --rebuild_catalog does.
+ */
+
+#define TREASURE_CATALOG_MAGIC 0x54414348u
+#define TREASURE_CATALOG_VERSION 1
+#define CATALOG_NAME_LENGTH 128
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+} TreasureCatalogHeader;
+
+typedef struct
+{
+    char name[CATALOG_NAME_LENGTH];
+    uint64_t records;
+    int64_t total_value;
+    uint64_t bytes;
+    int64_t mtime_sec;
+} CatalogEntry;
+
+int catalog_load(CatalogEntry **entries);
+int catalog_list_hunts(char (**hunts)[MAX_PATH_LENGTH]);
+int catalog_update(TreasureStore *store);
+int catalog_remove(const char *hunt_id);
+int catalog_rebuild();
+
+#endif
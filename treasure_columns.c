@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "treasure_columns.h"
+#include "treasure_segment.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLUMNS_X86 1
+#endif
+
+typedef struct
+{
+    const char *name;
+    size_t (*filter)(const TreasureColumns *, const ColumnPredicate *, uint32_t *);
+    void (*stats)(const TreasureColumns *, const ColumnPredicate *, ColumnStats *);
+} ColumnKernels;
+
+static int row_matches(const TreasureColumns *c, const ColumnPredicate *p, size_t i)
+{
+    return c->value[i] >= p->min_value && c->value[i] <= p->max_value &&
+           c->latitude[i] >= p->min_lat && c->latitude[i] <= p->max_lat &&
+           c->longitude[i] >= p->min_lon && c->longitude[i] <= p->max_lon;
+}
+
+static size_t filter_rows(const TreasureColumns *c, const ColumnPredicate *p, size_t start, uint32_t *rows, size_t n)
+{
+    for (size_t i = start; i < c->count; i++)
+    {
+        if (row_matches(c, p, i))
+            rows[n++] = (uint32_t)i;
+    }
+    return n;
+}
+
+static void stats_rows(const TreasureColumns *c, const ColumnPredicate *p, size_t start, ColumnStats *s)
+{
+    for (size_t i = start; i < c->count; i++)
+    {
+        if (!row_matches(c, p, i))
+            continue;
+        int32_t v = c->value[i];
+        s->count++;
+        s->sum += v;
+        if (v < s->min)
+            s->min = v;
+        if (v > s->max)
+            s->max = v;
+    }
+}
+
+static size_t filter_scalar(const TreasureColumns *c, const ColumnPredicate *p, uint32_t *rows)
+{
+    return filter_rows(c, p, 0, rows, 0);
+}
+
+static void stats_scalar(const TreasureColumns *c, const ColumnPredicate *p, ColumnStats *s)
+{
+    stats_rows(c, p, 0, s);
+}
+
+#ifdef COLUMNS_X86
+
+/* Bit k of the result is set when row i + k matches, for 8 rows starting at i. */
+__attribute__((target("avx2"))) static inline int match_mask_avx2(const TreasureColumns *c, size_t i,
+                                                                   __m256i min_value, __m256i max_value,
+                                                                   __m256d min_lat, __m256d max_lat,
+                                                                   __m256d min_lon, __m256d max_lon)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)(c->value + i));
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(min_value, v), _mm256_cmpgt_epi32(v, max_value));
+    int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+
+    for (int half = 0; half < 2; half++)
+    {
+        __m256d lat = _mm256_loadu_pd(c->latitude + i + 4 * half);
+        __m256d lon = _mm256_loadu_pd(c->longitude + i + 4 * half);
+        __m256d ok = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(lat, min_lat, _CMP_GE_OQ),
+                                                 _mm256_cmp_pd(lat, max_lat, _CMP_LE_OQ)),
+                                   _mm256_and_pd(_mm256_cmp_pd(lon, min_lon, _CMP_GE_OQ),
+                                                 _mm256_cmp_pd(lon, max_lon, _CMP_LE_OQ)));
+        mask &= ~(0xf << (4 * half)) | (_mm256_movemask_pd(ok) << (4 * half));
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static size_t filter_avx2(const TreasureColumns *c, const ColumnPredicate *p,
+                                                           uint32_t *rows)
+{
+    __m256i min_value = _mm256_set1_epi32(p->min_value), max_value = _mm256_set1_epi32(p->max_value);
+    __m256d min_lat = _mm256_set1_pd(p->min_lat), max_lat = _mm256_set1_pd(p->max_lat);
+    __m256d min_lon = _mm256_set1_pd(p->min_lon), max_lon = _mm256_set1_pd(p->max_lon);
+    size_t n = 0, i = 0;
+
+    for (; i + 8 <= c->count; i += 8)
+    {
+        int mask = match_mask_avx2(c, i, min_value, max_value, min_lat, max_lat, min_lon, max_lon);
+        while (mask)
+        {
+            rows[n++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return filter_rows(c, p, i, rows, n);
+}
+
+__attribute__((target("avx2"))) static void stats_avx2(const TreasureColumns *c, const ColumnPredicate *p,
+                                                        ColumnStats *s)
+{
+    __m256i min_value = _mm256_set1_epi32(p->min_value), max_value = _mm256_set1_epi32(p->max_value);
+    __m256d min_lat = _mm256_set1_pd(p->min_lat), max_lat = _mm256_set1_pd(p->max_lat);
+    __m256d min_lon = _mm256_set1_pd(p->min_lon), max_lon = _mm256_set1_pd(p->max_lon);
+    __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i lowest = _mm256_set1_epi32(INT32_MIN), highest = _mm256_set1_epi32(INT32_MAX);
+    __m256i sum_low = _mm256_setzero_si256(), sum_high = _mm256_setzero_si256();
+    __m256i min_acc = highest, max_acc = lowest;
+    size_t i = 0;
+
+    for (; i + 8 <= c->count; i += 8)
+    {
+        int mask = match_mask_avx2(c, i, min_value, max_value, min_lat, max_lat, min_lon, max_lon);
+        if (mask == 0)
+            continue;
+
+        __m256i lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), lane_bits), lane_bits);
+        __m256i v = _mm256_loadu_si256((const __m256i *)(c->value + i));
+        __m256i kept = _mm256_and_si256(v, lanes);
+        sum_low = _mm256_add_epi64(sum_low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(kept)));
+        sum_high = _mm256_add_epi64(sum_high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(kept, 1)));
+        min_acc = _mm256_min_epi32(min_acc, _mm256_blendv_epi8(highest, v, lanes));
+        max_acc = _mm256_max_epi32(max_acc, _mm256_blendv_epi8(lowest, v, lanes));
+        s->count += __builtin_popcount(mask);
+    }
+
+    int64_t sums[4];
+    int32_t mins[8], maxs[8];
+    _mm256_storeu_si256((__m256i *)sums, _mm256_add_epi64(sum_low, sum_high));
+    _mm256_storeu_si256((__m256i *)mins, min_acc);
+    _mm256_storeu_si256((__m256i *)maxs, max_acc);
+    for (int k = 0; k < 8; k++)
+    {
+        if (k < 4)
+            s->sum += sums[k];
+        if (mins[k] < s->min)
+            s->min = mins[k];
+        if (maxs[k] > s->max)
+            s->max = maxs[k];
+    }
+    stats_rows(c, p, i, s);
+}
+
+/* Bit k of the result is set when row i + k matches, for 4 rows starting at i. */
+__attribute__((target("sse4.1"))) static inline int match_mask_sse(const TreasureColumns *c, size_t i,
+                                                                    __m128i min_value, __m128i max_value,
+                                                                    __m128d min_lat, __m128d max_lat,
+                                                                    __m128d min_lon, __m128d max_lon)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)(c->value + i));
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi32(min_value, v), _mm_cmpgt_epi32(v, max_value));
+    int mask = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+
+    for (int half = 0; half < 2; half++)
+    {
+        __m128d lat = _mm_loadu_pd(c->latitude + i + 2 * half);
+        __m128d lon = _mm_loadu_pd(c->longitude + i + 2 * half);
+        __m128d ok = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(lat, min_lat), _mm_cmple_pd(lat, max_lat)),
+                                _mm_and_pd(_mm_cmpge_pd(lon, min_lon), _mm_cmple_pd(lon, max_lon)));
+        mask &= ~(0x3 << (2 * half)) | (_mm_movemask_pd(ok) << (2 * half));
+    }
+    return mask;
+}
+
+__attribute__((target("sse4.1"))) static size_t filter_sse(const TreasureColumns *c, const ColumnPredicate *p,
+                                                            uint32_t *rows)
+{
+    __m128i min_value = _mm_set1_epi32(p->min_value), max_value = _mm_set1_epi32(p->max_value);
+    __m128d min_lat = _mm_set1_pd(p->min_lat), max_lat = _mm_set1_pd(p->max_lat);
+    __m128d min_lon = _mm_set1_pd(p->min_lon), max_lon = _mm_set1_pd(p->max_lon);
+    size_t n = 0, i = 0;
+
+    for (; i + 4 <= c->count; i += 4)
+    {
+        int mask = match_mask_sse(c, i, min_value, max_value, min_lat, max_lat, min_lon, max_lon);
+        while (mask)
+        {
+            rows[n++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return filter_rows(c, p, i, rows, n);
+}
+
+__attribute__((target("sse4.1"))) static void stats_sse(const TreasureColumns *c, const ColumnPredicate *p,
+                                                         ColumnStats *s)
+{
+    __m128i min_value = _mm_set1_epi32(p->min_value), max_value = _mm_set1_epi32(p->max_value);
+    __m128d min_lat = _mm_set1_pd(p->min_lat), max_lat = _mm_set1_pd(p->max_lat);
+    __m128d min_lon = _mm_set1_pd(p->min_lon), max_lon = _mm_set1_pd(p->max_lon);
+    __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    __m128i lowest = _mm_set1_epi32(INT32_MIN), highest = _mm_set1_epi32(INT32_MAX);
+    __m128i sum_acc = _mm_setzero_si128();
+    __m128i min_acc = highest, max_acc = lowest;
+    size_t i = 0;
+
+    for (; i + 4 <= c->count; i += 4)
+    {
+        int mask = match_mask_sse(c, i, min_value, max_value, min_lat, max_lat, min_lon, max_lon);
+        if (mask == 0)
+            continue;
+
+        __m128i lanes = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), lane_bits), lane_bits);
+        __m128i v = _mm_loadu_si128((const __m128i *)(c->value + i));
+        __m128i kept = _mm_and_si128(v, lanes);
+        sum_acc = _mm_add_epi64(sum_acc, _mm_cvtepi32_epi64(kept));
+        sum_acc = _mm_add_epi64(sum_acc, _mm_cvtepi32_epi64(_mm_srli_si128(kept, 8)));
+        min_acc = _mm_min_epi32(min_acc, _mm_blendv_epi8(highest, v, lanes));
+        max_acc = _mm_max_epi32(max_acc, _mm_blendv_epi8(lowest, v, lanes));
+        s->count += __builtin_popcount(mask);
+    }
+
+    int64_t sums[2];
+    int32_t mins[4], maxs[4];
+    _mm_storeu_si128((__m128i *)sums, sum_acc);
+    _mm_storeu_si128((__m128i *)mins, min_acc);
+    _mm_storeu_si128((__m128i *)maxs, max_acc);
+    s->sum += sums[0] + sums[1];
+    for (int k = 0; k < 4; k++)
+    {
+        if (mins[k] < s->min)
+            s->min = mins[k];
+        if (maxs[k] > s->max)
+            s->max = maxs[k];
+    }
+    stats_rows(c, p, i, s);
+}
+
+#endif
+
+static const ColumnKernels scalar_kernels = {"scalar", filter_scalar, stats_scalar};
+#ifdef COLUMNS_X86
+static const ColumnKernels sse_kernels = {"sse4.1", filter_sse, stats_sse};
+static const ColumnKernels avx2_kernels = {"avx2", filter_avx2, stats_avx2};
+#endif
+
+static const ColumnKernels *kernels()
+{
+    static const ColumnKernels *selected = NULL;
+    if (selected != NULL)
+    {
+        return selected;
+    }
+
+    selected = &scalar_kernels;
+#ifdef COLUMNS_X86
+    const char *limit = getenv(COLUMNS_SIMD_ENV);
+    int allow_avx2 = limit == NULL || strcmp(limit, "avx2") == 0;
+    int allow_sse = allow_avx2 || strcmp(limit, "sse") == 0;
+
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2"))
+        selected = &avx2_kernels;
+    else if (allow_sse && __builtin_cpu_supports("sse4.1"))
+        selected = &sse_kernels;
+#endif
+    return selected;
+}
+
+const char *columns_kernel_name()
+{
+    return kernels()->name;
+}
+
+int columns_load(TreasureColumns *columns, TreasureStore *store)
+{
+    memset(columns, 0, sizeof(*columns));
+    size_t capacity = (size_t)store_record_count(store);
+
+    columns->latitude = malloc((capacity + 1) * sizeof(double));
+    columns->longitude = malloc((capacity + 1) * sizeof(double));
+    columns->value = malloc((capacity + 1) * sizeof(int32_t));
+    columns->slot = malloc((capacity + 1) * sizeof(uint32_t));
+    if (columns->latitude == NULL || columns->longitude == NULL || columns->value == NULL || columns->slot == NULL)
+    {
+        columns_free(columns);
+        return 0;
+    }
+
+    /* Archived hunts keep these columns apart from ids and clues, so only they are decoded. */
+    if (store->segment != NULL)
+    {
+        size_t count;
+        while (columns->count < capacity &&
+               (count = segment_read_columns(store, (long)columns->count, columns->latitude + columns->count,
+                                             columns->longitude + columns->count, columns->value + columns->count)) > 0)
+        {
+            for (size_t i = columns->count; i < columns->count + count; i++)
+                columns->slot[i] = (uint32_t)i;
+            columns->count += count;
+        }
+        return 1;
+    }
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, store);
+    while ((record = store_cursor_next(&cursor)) != NULL && columns->count < capacity)
+    {
+        size_t i = columns->count++;
+        columns->latitude[i] = record->latitude;
+        columns->longitude[i] = record->longitude;
+        columns->value[i] = record->value;
+        columns->slot[i] = (uint32_t)cursor.slot;
+    }
+    return 1;
+}
+
+void columns_free(TreasureColumns *columns)
+{
+    free(columns->latitude);
+    free(columns->longitude);
+    free(columns->value);
+    free(columns->slot);
+    memset(columns, 0, sizeof(*columns));
+}
+
+void columns_predicate_init(ColumnPredicate *predicate)
+{
+    predicate->min_value = INT32_MIN;
+    predicate->max_value = INT32_MAX;
+    predicate->min_lat = -DBL_MAX;
+    predicate->max_lat = DBL_MAX;
+    predicate->min_lon = -DBL_MAX;
+    predicate->max_lon = DBL_MAX;
+}
+
+/*
+ * Parses "value=MIN:MAX" (either side may be left empty) and
+ * "box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON" arguments; returns 0 on the first
+ * one it does not understand.
+ */
+int columns_parse_predicate(ColumnPredicate *predicate, int argc, char *const *argv)
+{
+    columns_predicate_init(predicate);
+    for (int i = 0; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strncmp(arg, "value=", 6) == 0)
+        {
+            const char *range = arg + 6;
+            const char *colon = strchr(range, ':');
+            char *end;
+            if (colon == NULL)
+                return 0;
+            if (colon != range)
+            {
+                predicate->min_value = (int32_t)strtol(range, &end, 10);
+                if (end != colon)
+                    return 0;
+            }
+            if (colon[1] != '\0')
+            {
+                predicate->max_value = (int32_t)strtol(colon + 1, &end, 10);
+                if (*end != '\0')
+                    return 0;
+            }
+        }
+        else if (strncmp(arg, "box=", 4) == 0)
+        {
+            int consumed = 0;
+            if (sscanf(arg + 4, "%lf,%lf,%lf,%lf%n", &predicate->min_lat, &predicate->min_lon,
+                       &predicate->max_lat, &predicate->max_lon, &consumed) != 4 ||
+                arg[4 + consumed] != '\0')
+                return 0;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Writes the row numbers of matching treasures to rows (room for columns->count) and returns how many. */
+size_t columns_filter(const TreasureColumns *columns, const ColumnPredicate *predicate, uint32_t *rows)
+{
+    return kernels()->filter(columns, predicate, rows);
+}
+
+void columns_stats(const TreasureColumns *columns, const ColumnPredicate *predicate, ColumnStats *stats)
+{
+    stats->count = 0;
+    stats->sum = 0;
+    stats->min = INT32_MAX;
+    stats->max = INT32_MIN;
+    kernels()->stats(columns, predicate, stats);
+}
@@ -0,0 +1,54 @@
+#ifndef TREASURE_COLUMNS_H
+#define TREASURE_COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "treasure_store.h"
+
+/*
+ * Column-wise copy of a hunt's live records for full scans. Filters and
+ * aggregates run over the latitude, longitude and value arrays with AVX2 or
+ * SSE4.1 kernels when the CPU has them and a scalar loop otherwise; the
+ * choice is made once at run time and TREASURE_SIMD=scalar|sse|avx2 can
+ * force a narrower one.
+ */
+
+#define COLUMNS_SIMD_ENV "TREASURE_SIMD"
+
+typedef struct
+{
+    size_t count;
+    double *latitude;
+    double *longitude;
+    int32_t *value;
+    uint32_t *slot;
+} TreasureColumns;
+
+/* Inclusive ranges; columns_predicate_init() makes every range unbounded. */
+typedef struct
+{
+    int32_t min_value;
+    int32_t max_value;
+    double min_lat;
+    double max_lat;
+    double min_lon;
+    double max_lon;
+} ColumnPredicate;
+
+typedef struct
+{
+    long count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+} ColumnStats;
+
+int columns_load(TreasureColumns *columns, TreasureStore *store);
+void columns_free(TreasureColumns *columns);
+void columns_predicate_init(ColumnPredicate *predicate);
+int columns_parse_predicate(ColumnPredicate *predicate, int argc, char *const *argv);
+size_t columns_filter(const TreasureColumns *columns, const ColumnPredicate *predicate, uint32_t *rows);
+void columns_stats(const TreasureColumns *columns, const ColumnPredicate *predicate, ColumnStats *stats);
+const char *columns_kernel_name();
+
+#endif
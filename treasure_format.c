@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include "treasure_format.h"
+
+static const char *format_names[] = {
+    [OUTPUT_TEXT] = "text",
+    [OUTPUT_JSON] = "json",
+    [OUTPUT_NDJSON] = "ndjson",
+    [OUTPUT_BINARY] = "binary",
+};
+
+int format_parse(const char *name, OutputFormat *format)
+{
+    for (int i = 0; i < (int)(sizeof(format_names) / sizeof(format_names[0])); i++)
+    {
+        if (strcmp(name, format_names[i]) == 0)
+        {
+            *format = (OutputFormat)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Removes --format=NAME or --format NAME from argv; returns 0 if the name is not a format. */
+int format_take_option(int *argc, char *argv[], OutputFormat *format)
+{
+    for (int i = 1; i < *argc; i++)
+    {
+        const char *name;
+        int used;
+        if (strncmp(argv[i], "--format=", 9) == 0)
+        {
+            name = argv[i] + 9;
+            used = 1;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < *argc)
+        {
+            name = argv[i + 1];
+            used = 2;
+        }
+        else
+        {
+            continue;
+        }
+
+        if (!format_parse(name, format))
+        {
+            return 0;
+        }
+        for (int j = i; j + used <= *argc; j++)
+        {
+            argv[j] = argv[j + used];
+        }
+        *argc -= used;
+        return 1;
+    }
+    return 1;
+}
+
+static void fd_sink(void *context, const char *data, size_t length)
+{
+    int fd = *(int *)context;
+    while (length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        length -= (size_t)n;
+    }
+}
+
+static void put(FormatWriter *writer, const void *data, size_t length)
+{
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
+
+static void put_literal(FormatWriter *writer, const char *text)
+{
+    put(writer, text, strlen(text));
+}
+
+#define WORD_ONES 0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+
+/* Bytes the open object may still use. */
+static size_t object_room(const FormatWriter *writer)
+{
+    size_t end = writer->object_start + FORMAT_OBJECT_MAX;
+    return end > writer->used ? end - writer->used : 0;
+}
+
+/*
+ * A JSON string body of at most length bytes. Runs of plain bytes are
+ * found a word at a time and copied whole. When the worst case (every
+ * byte escaped) might not fit in the object, the text is cut short rather
+ * than overrun it.
+ */
+static void put_json_text(FormatWriter *writer, const char *text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    int bounded = object_room(writer) < 6 * length + 16;
+    size_t i = 0;
+    while (i < length)
+    {
+        size_t run = i;
+        uint64_t word;
+        while (run + sizeof(word) <= length)
+        {
+            /* Stop at the word holding a byte below 0x20, a '"' or a '\\'. */
+            memcpy(&word, text + run, sizeof(word));
+            uint64_t quote = word ^ (WORD_ONES * '"');
+            uint64_t backslash = word ^ (WORD_ONES * '\\');
+            if ((((word - WORD_ONES * 0x20) & ~word) | ((quote - WORD_ONES) & ~quote) |
+                 ((backslash - WORD_ONES) & ~backslash)) & WORD_HIGHS)
+                break;
+            run += sizeof(word);
+        }
+        unsigned char c = 0;
+        while (run < length && (c = (unsigned char)text[run]) >= 0x20 && c != '"' && c != '\\')
+            run++;
+        if (bounded && object_room(writer) < run - i + 16)
+        {
+            size_t room = object_room(writer);
+            memcpy(writer->buffer + writer->used, text + i, room > 16 ? room - 16 : 0);
+            writer->used += room > 16 ? room - 16 : 0;
+            return;
+        }
+        char *out = writer->buffer + writer->used;
+        memcpy(out, text + i, run - i);
+        writer->used += run - i;
+        out += run - i;
+        if (run == length)
+            return;
+
+        if (c == '"' || c == '\\')
+        {
+            out[0] = '\\';
+            out[1] = (char)c;
+            writer->used += 2;
+        }
+        else
+        {
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[c >> 4];
+            out[5] = hex[c & 0xf];
+            writer->used += 6;
+        }
+        i = run + 1;
+    }
+}
+
+/* Keys are the callers' own identifiers, so they go out unescaped; quoted opens a string value. */
+static void put_json_key(FormatWriter *writer, const char *key, int quoted)
+{
+    size_t length = strlen(key);
+    char *out = writer->buffer + writer->used;
+    out[0] = ',';
+    out[1] = '"';
+    memcpy(out + 2, key, length);
+    out[2 + length] = '"';
+    out[3 + length] = ':';
+    out[4 + length] = '"';
+    writer->used += length + 4 + (quoted != 0);
+}
+
+static void put_binary_key(FormatWriter *writer, char tag, const char *key)
+{
+    size_t length = strnlen(key, 255);
+    char *out = writer->buffer + writer->used;
+    out[0] = tag;
+    out[1] = (char)length;
+    memcpy(out + 2, key, length);
+    writer->used += length + 2;
+}
+
+void format_begin(FormatWriter *writer, OutputFormat format, FormatSink sink, void *context)
+{
+    writer->format = format;
+    writer->sink = sink;
+    writer->context = context;
+    writer->used = 0;
+    writer->object_start = 0;
+    writer->objects = 0;
+    writer->fields = 0;
+
+    if (format == OUTPUT_JSON)
+    {
+        put_literal(writer, "[");
+    }
+    else if (format == OUTPUT_BINARY)
+    {
+        uint32_t magic = FORMAT_BINARY_MAGIC;
+        put(writer, &magic, sizeof(magic));
+    }
+}
+
+void format_begin_fd(FormatWriter *writer, OutputFormat format, int fd)
+{
+    writer->fd = fd;
+    format_begin(writer, format, fd_sink, &writer->fd);
+}
+
+void format_flush(FormatWriter *writer)
+{
+    if (writer->used > 0 && writer->sink != NULL)
+    {
+        writer->sink(writer->context, writer->buffer, writer->used);
+    }
+    writer->used = 0;
+}
+
+void format_object(FormatWriter *writer, const char *type)
+{
+    if (FORMAT_BUFFER_SIZE - writer->used < FORMAT_OBJECT_MAX + 8)
+    {
+        format_flush(writer);
+    }
+    if (writer->format == OUTPUT_JSON)
+    {
+        put_literal(writer, writer->objects > 0 ? ",\n" : "\n");
+    }
+    writer->object_start = writer->used;
+    writer->fields = 0;
+    writer->objects++;
+
+    if (writer->format == OUTPUT_BINARY)
+    {
+        uint32_t length = 0;
+        uint8_t type_length = (uint8_t)strnlen(type, 255);
+        put(writer, &length, sizeof(length));
+        put(writer, &type_length, 1);
+        put(writer, type, type_length);
+    }
+    else
+    {
+        put_literal(writer, "{\"type\":\"");
+        put_json_text(writer, type, strnlen(type, 255));
+        put_literal(writer, "\"");
+    }
+}
+
+void format_string(FormatWriter *writer, const char *key, const char *value, size_t max)
+{
+    size_t length = strnlen(value, max);
+    if (object_room(writer) < 16 + 2 * 255)
+    {
+        return;
+    }
+    writer->fields++;
+
+    if (writer->format == OUTPUT_BINARY)
+    {
+        size_t room = object_room(writer) - (4 + strnlen(key, 255));
+        if (length > room)
+            length = room;
+        uint16_t length16 = (uint16_t)(length < UINT16_MAX ? length : UINT16_MAX);
+        put_binary_key(writer, 's', key);
+        put(writer, &length16, sizeof(length16));
+        put(writer, value, length16);
+        return;
+    }
+
+    put_json_key(writer, key, 1);
+    put_json_text(writer, value, length);
+    writer->buffer[writer->used++] = '"';
+}
+
+void format_int(FormatWriter *writer, const char *key, long long value)
+{
+    if (object_room(writer) < 32 + 255)
+    {
+        return;
+    }
+    writer->fields++;
+
+    if (writer->format == OUTPUT_BINARY)
+    {
+        int64_t value64 = value;
+        put_binary_key(writer, 'i', key);
+        put(writer, &value64, sizeof(value64));
+        return;
+    }
+
+    put_json_key(writer, key, 0);
+    writer->used = (size_t)(format_put_int(writer->buffer + writer->used, value) - writer->buffer);
+}
+
+/* JSON has no NaN or infinity, so those become null. */
+void format_double(FormatWriter *writer, const char *key, double value)
+{
+    if (object_room(writer) < 48 + 255)
+    {
+        return;
+    }
+    writer->fields++;
+
+    if (writer->format == OUTPUT_BINARY)
+    {
+        put_binary_key(writer, 'd', key);
+        put(writer, &value, sizeof(value));
+        return;
+    }
+
+    put_json_key(writer, key, 0);
+    if (!isfinite(value))
+    {
+        put_literal(writer, "null");
+    }
+    else if (fabs(value) < 1e6)
+    {
+        writer->used = (size_t)(format_put_fixed6(writer->buffer + writer->used, value) - writer->buffer);
+    }
+    else
+    {
+        writer->used += (size_t)snprintf(writer->buffer + writer->used, 32, "%.17g", value);
+    }
+}
+
+void format_end_object(FormatWriter *writer)
+{
+    if (writer->format == OUTPUT_BINARY)
+    {
+        uint32_t length = (uint32_t)(writer->used - writer->object_start - sizeof(uint32_t));
+        memcpy(writer->buffer + writer->object_start, &length, sizeof(length));
+    }
+    else
+    {
+        put_literal(writer, writer->format == OUTPUT_NDJSON ? "}\n" : "}");
+    }
+}
+
+void format_finish(FormatWriter *writer)
+{
+    if (writer->format == OUTPUT_JSON)
+    {
+        put_literal(writer, writer->objects > 0 ? "\n]\n" : "]\n");
+    }
+    format_flush(writer);
+}
+
+/* A treasure as listed by every command; clue may be NULL for listings that leave it out. */
+void format_treasure(FormatWriter *writer, const char *id, const char *user, double latitude, double longitude,
+                     long value, const char *clue)
+{
+    format_object(writer, "treasure");
+    format_string(writer, "id", id, 32);
+    format_string(writer, "user", user, 64);
+    format_double(writer, "latitude", latitude);
+    format_double(writer, "longitude", longitude);
+    format_int(writer, "value", value);
+    if (clue != NULL)
+        format_string(writer, "clue", clue, 256);
+    format_end_object(writer);
+}
+
+void format_error(FormatWriter *writer, const char *message)
+{
+    format_object(writer, "error");
+    format_string(writer, "message", message, 1024);
+    format_end_object(writer);
+}
+
+char *format_put_int(char *out, long long value)
+{
+    char digits[24];
+    int n = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do
+    {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0)
+        *out++ = '-';
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+/*
+ * Same text as "%.6f" for |value| < 1e6. Values that land too close to a
+ * rounding tie for the scaled product to decide it go through snprintf.
+ */
+char *format_put_fixed6(char *out, double value)
+{
+    double scaled = fabs(value) * 1e6;
+    double whole = floor(scaled);
+    if (fabs(scaled - whole - 0.5) < 1e-3)
+    {
+        return out + snprintf(out, 32, "%.6f", value);
+    }
+
+    uint64_t units = (uint64_t)whole + (scaled - whole > 0.5);
+    if (signbit(value))
+        *out++ = '-';
+    out = format_put_int(out, (long long)(units / 1000000));
+    *out++ = '.';
+    uint32_t fraction = (uint32_t)(units % 1000000);
+    for (int i = 5; i >= 0; i--)
+    {
+        out[i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    return out + 6;
+}
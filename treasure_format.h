@@ -0,0 +1,73 @@
+#ifndef TREASURE_FORMAT_H
+#define TREASURE_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Machine-readable output shared by treasure_manager, score_calculator and
+ * the monitor. A command's output is a stream of flat objects, each with a
+ * "type" ("treasure", "hunt", "score", "stats", "summary", "error", ...)
+ * and a few string, integer or floating-point fields:
+ *
+ *   json    one array holding every object
+ *   ndjson  one object per line
+ *   binary  FORMAT_BINARY_MAGIC, then per object a uint32 byte length of
+ *           the rest, the type (uint8 length + bytes) and its fields, each
+ *           a tag byte ('s', 'i' or 'd'), the key (uint8 length + bytes)
+ *           and the value: uint16 length + bytes, int64 or double, all in
+ *           host byte order
+ *
+ * The writer formats into its own buffer and hands full buffers to a sink,
+ * so nothing is allocated per object. Objects must stay under
+ * FORMAT_OBJECT_MAX bytes; longer strings are cut short to fit.
+ */
+
+#define FORMAT_BUFFER_SIZE (64u * 1024u)
+#define FORMAT_OBJECT_MAX 4096
+#define FORMAT_BINARY_MAGIC 0x31465254u
+
+typedef enum
+{
+    OUTPUT_TEXT = 0,
+    OUTPUT_JSON,
+    OUTPUT_NDJSON,
+    OUTPUT_BINARY
+} OutputFormat;
+
+typedef void (*FormatSink)(void *context, const char *data, size_t length);
+
+typedef struct
+{
+    OutputFormat format;
+    FormatSink sink;
+    void *context;
+    int fd;
+    size_t used;
+    size_t object_start;
+    long objects;
+    int fields;
+    char buffer[FORMAT_BUFFER_SIZE];
+} FormatWriter;
+
+int format_parse(const char *name, OutputFormat *format);
+int format_take_option(int *argc, char *argv[], OutputFormat *format);
+
+void format_begin(FormatWriter *writer, OutputFormat format, FormatSink sink, void *context);
+void format_begin_fd(FormatWriter *writer, OutputFormat format, int fd);
+void format_object(FormatWriter *writer, const char *type);
+void format_string(FormatWriter *writer, const char *key, const char *value, size_t max);
+void format_int(FormatWriter *writer, const char *key, long long value);
+void format_double(FormatWriter *writer, const char *key, double value);
+void format_end_object(FormatWriter *writer);
+void format_flush(FormatWriter *writer);
+void format_finish(FormatWriter *writer);
+
+void format_treasure(FormatWriter *writer, const char *id, const char *user, double latitude, double longitude,
+                     long value, const char *clue);
+void format_error(FormatWriter *writer, const char *message);
+
+char *format_put_int(char *out, long long value);
+char *format_put_fixed6(char *out, double value);
+
+#endif
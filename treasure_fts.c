@@ -0,0 +1,651 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "treasure_fts.h"
+
+#define FTS_MIN_CAPACITY 64
+#define FTS_MAX_CLUE_TERMS (MAX_CLUE_LENGTH / 2 + 1)
+
+typedef struct
+{
+    char text[FTS_TERM_LENGTH];
+    size_t length;
+    int prefix;
+} FtsQueryTerm;
+
+static int is_term_byte(unsigned char c)
+{
+    return isalnum(c) || c >= 0x80;
+}
+
+/* Copies the next term of *text into term, lower-cased, and moves past it; returns its length, 0 at the end. */
+static size_t next_term(const char **text, char term[FTS_TERM_LENGTH])
+{
+    const unsigned char *p = (const unsigned char *)*text;
+    size_t length = 0;
+
+    while (*p != '\0' && !is_term_byte(*p))
+        p++;
+    while (*p != '\0' && is_term_byte(*p))
+    {
+        if (length < FTS_TERM_LENGTH - 1)
+            term[length++] = (char)tolower(*p);
+        p++;
+    }
+    memset(term + length, 0, FTS_TERM_LENGTH - length);
+    *text = (const char *)p;
+    return length;
+}
+
+/* Fills out with one entry per distinct term of clue and returns how many there are. */
+static size_t clue_entries(const char *clue, long slot, TreasureFtsEntry *out)
+{
+    char term[FTS_TERM_LENGTH];
+    size_t count = 0;
+    while (count < FTS_MAX_CLUE_TERMS && next_term(&clue, term) > 0)
+    {
+        size_t i = 0;
+        while (i < count && memcmp(out[i].term, term, FTS_TERM_LENGTH) != 0)
+            i++;
+        if (i == count)
+        {
+            memcpy(out[count].term, term, FTS_TERM_LENGTH);
+            out[count].slot = (uint32_t)slot;
+            out[count].frequency = 0;
+            count++;
+        }
+        out[i].frequency++;
+    }
+    return count;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const TreasureFtsEntry *x = a;
+    const TreasureFtsEntry *y = b;
+    int order = memcmp(x->term, y->term, FTS_TERM_LENGTH);
+    if (order != 0)
+        return order;
+    return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+static size_t image_size(uint64_t term_count, uint64_t posting_count, uint64_t tail_capacity)
+{
+    return sizeof(TreasureFtsHeader) + term_count * sizeof(TreasureFtsTerm) +
+           posting_count * sizeof(TreasureFtsPosting) + tail_capacity * sizeof(TreasureFtsEntry);
+}
+
+/* Points terms, postings and tail into the image that starts with header. */
+static void set_sections(TreasureFts *fts, TreasureFtsHeader *header, size_t size)
+{
+    fts->header = header;
+    fts->terms = (TreasureFtsTerm *)((char *)header + sizeof(TreasureFtsHeader));
+    fts->postings = (TreasureFtsPosting *)(fts->terms + header->term_count);
+    fts->tail = (TreasureFtsEntry *)(fts->postings + header->posting_count);
+    fts->map_size = size;
+}
+
+/* data_size goes last: until it is stored, the -1 a writer left there keeps readers off the index. */
+static void stamp_header(TreasureFtsHeader *header, const StoreStamp *stamp)
+{
+    header->data_ino = stamp->ino;
+    header->data_mtime_sec = stamp->mtime_sec;
+    header->data_mtime_nsec = stamp->mtime_nsec;
+    SIDECAR_PUBLISH(header->data_size, stamp->size);
+}
+
+static int header_is_current(const TreasureFtsHeader *header, size_t file_size, TreasureStore *store)
+{
+    if (file_size < sizeof(TreasureFtsHeader) ||
+        header->magic != TREASURE_FTS_MAGIC ||
+        header->version != TREASURE_FTS_VERSION ||
+        header->term_count > header->posting_count ||
+        header->posting_count > UINT32_MAX ||
+        header->tail_count > header->tail_capacity ||
+        header->tail_capacity > file_size ||
+        file_size != image_size(header->term_count, header->posting_count, header->tail_capacity))
+    {
+        return 0;
+    }
+
+    StoreStamp now;
+    return store_stamp_now(store, &now) &&
+           SIDECAR_LOAD(header->data_size) == now.size &&
+           header->data_ino == now.ino &&
+           header->data_mtime_sec == now.mtime_sec &&
+           header->data_mtime_nsec == now.mtime_nsec;
+}
+
+static void unmap_fts(TreasureFts *fts)
+{
+    if (fts->header != NULL)
+    {
+        munmap(fts->header, fts->map_size);
+        fts->header = NULL;
+        fts->terms = NULL;
+        fts->postings = NULL;
+        fts->tail = NULL;
+        fts->map_size = 0;
+    }
+    if (fts->fts_fd != -1)
+    {
+        close(fts->fts_fd);
+        fts->fts_fd = -1;
+    }
+}
+
+static int map_image(TreasureFts *fts, int fd, size_t size)
+{
+    int prot = fts->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    fts->fts_fd = fd;
+    set_sections(fts, map, size);
+    return 1;
+}
+
+/* Writes a fresh image next to the live file and renames it into place. */
+static int publish_image(TreasureFts *fts, const void *image, size_t size)
+{
+    char fts_path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH];
+    store_hunt_path(fts_path, fts->store->hunt_id, TREASURE_FTS_FILE);
+    store_temp_path(temp_path, fts->store->hunt_id, TREASURE_FTS_FILE);
+
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    const char *p = image;
+    size_t left = size;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(temp_path);
+            return 0;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (rename(temp_path, fts_path) != 0)
+    {
+        close(fd);
+        unlink(temp_path);
+        return 0;
+    }
+
+    unmap_fts(fts);
+    if (!map_image(fts, fd, size))
+    {
+        close(fd);
+        return 0;
+    }
+    return 1;
+}
+
+/* Keeps the index in private memory when the hunt directory is not writable. */
+static int adopt_anonymous(TreasureFts *fts, void *image, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    memcpy(map, image, size);
+    unmap_fts(fts);
+    set_sections(fts, map, size);
+    return 1;
+}
+
+/* Only writers, who hold the hunt lock, replace the file; readers keep what they built to themselves. */
+static int install_image(TreasureFts *fts, void *image, size_t size)
+{
+    int ok = (fts->writable && publish_image(fts, image, size)) || adopt_anonymous(fts, image, size);
+    free(image);
+    return ok;
+}
+
+/* Collects entries in (term, slot) order into a dictionary and its postings. */
+typedef struct
+{
+    TreasureFtsTerm *terms;
+    TreasureFtsPosting *postings;
+    uint64_t term_count;
+    uint64_t posting_count;
+} FtsBuilder;
+
+static int builder_init(FtsBuilder *builder, uint64_t max_terms, uint64_t max_postings)
+{
+    builder->terms = malloc((max_terms + 1) * sizeof(TreasureFtsTerm));
+    builder->postings = malloc((max_postings + 1) * sizeof(TreasureFtsPosting));
+    builder->term_count = 0;
+    builder->posting_count = 0;
+    if (builder->terms == NULL || builder->postings == NULL)
+    {
+        free(builder->terms);
+        free(builder->postings);
+        return 0;
+    }
+    return 1;
+}
+
+static void builder_add(FtsBuilder *builder, const char *term, uint32_t slot, uint32_t frequency)
+{
+    TreasureFtsTerm *last = builder->term_count > 0 ? &builder->terms[builder->term_count - 1] : NULL;
+    if (last == NULL || memcmp(last->term, term, FTS_TERM_LENGTH) != 0)
+    {
+        last = &builder->terms[builder->term_count++];
+        memcpy(last->term, term, FTS_TERM_LENGTH);
+        last->first = (uint32_t)builder->posting_count;
+        last->count = 0;
+    }
+    last->count++;
+    builder->postings[builder->posting_count].slot = slot;
+    builder->postings[builder->posting_count].frequency = frequency;
+    builder->posting_count++;
+}
+
+/* Lays the builder out as a stamped image with an empty tail and frees it; NULL when out of memory. */
+static TreasureFtsHeader *builder_image(FtsBuilder *builder, const StoreStamp *stamp, size_t *size)
+{
+    uint64_t tail_capacity = builder->posting_count / FTS_TAIL_SHARE;
+    if (tail_capacity < FTS_MAX_TAIL)
+        tail_capacity = FTS_MAX_TAIL;
+
+    *size = image_size(builder->term_count, builder->posting_count, tail_capacity);
+    TreasureFtsHeader *header = calloc(1, *size);
+    if (header != NULL)
+    {
+        header->magic = TREASURE_FTS_MAGIC;
+        header->version = TREASURE_FTS_VERSION;
+        header->term_count = builder->term_count;
+        header->posting_count = builder->posting_count;
+        header->tail_capacity = tail_capacity;
+        char *terms = (char *)header + sizeof(TreasureFtsHeader);
+        memcpy(terms, builder->terms, builder->term_count * sizeof(TreasureFtsTerm));
+        memcpy(terms + builder->term_count * sizeof(TreasureFtsTerm), builder->postings,
+               builder->posting_count * sizeof(TreasureFtsPosting));
+        stamp_header(header, stamp);
+    }
+    free(builder->terms);
+    free(builder->postings);
+    return header;
+}
+
+int treasure_fts_rebuild(TreasureFts *fts)
+{
+    TreasureStore *store = fts->store;
+    size_t capacity = FTS_MIN_CAPACITY, count = 0;
+    TreasureFtsEntry *entries = malloc(capacity * sizeof(TreasureFtsEntry));
+    if (entries == NULL)
+    {
+        return 0;
+    }
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    char clue[MAX_CLUE_LENGTH];
+    store_cursor_open(&cursor, store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
+    {
+        if (!store_read_clue(store, record, clue))
+            continue;
+        if (count + FTS_MAX_CLUE_TERMS > capacity)
+        {
+            TreasureFtsEntry *grown = realloc(entries, capacity * 2 * sizeof(TreasureFtsEntry));
+            if (grown == NULL)
+            {
+                free(entries);
+                return 0;
+            }
+            entries = grown;
+            capacity *= 2;
+        }
+        count += clue_entries(clue, cursor.slot, entries + count);
+    }
+    qsort(entries, count, sizeof(TreasureFtsEntry), compare_entries);
+
+    FtsBuilder builder;
+    if (!builder_init(&builder, count, count))
+    {
+        free(entries);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        builder_add(&builder, entries[i].term, entries[i].slot, entries[i].frequency);
+    }
+    free(entries);
+
+    size_t size;
+    TreasureFtsHeader *header = builder_image(&builder, &store->stamp, &size);
+    return header != NULL && install_image(fts, header, size);
+}
+
+/*
+ * Merges a sorted copy of the tail with the dictionary into a new image,
+ * which replaces the live file; readers of the old one see no change.
+ */
+static int merge_tail(TreasureFts *fts)
+{
+    const TreasureFtsHeader *old = fts->header;
+    uint64_t tail = old->tail_count;
+    TreasureFtsEntry *pending = malloc((tail + 1) * sizeof(TreasureFtsEntry));
+    FtsBuilder builder;
+    if (pending == NULL || !builder_init(&builder, old->term_count + tail, old->posting_count + tail))
+    {
+        free(pending);
+        return 0;
+    }
+    memcpy(pending, fts->tail, tail * sizeof(TreasureFtsEntry));
+    qsort(pending, tail, sizeof(TreasureFtsEntry), compare_entries);
+
+    uint64_t next = 0, t = 0, p = 0, end = 0, j = 0;
+    for (;;)
+    {
+        while (p >= end && next < old->term_count)
+        {
+            t = next++;
+            p = fts->terms[t].first;
+            end = p + fts->terms[t].count;
+            if (end > old->posting_count)
+                end = old->posting_count;
+        }
+        if (p >= end && j == tail)
+            break;
+
+        int take_old = p < end;
+        if (take_old && j < tail)
+        {
+            int order = memcmp(fts->terms[t].term, pending[j].term, FTS_TERM_LENGTH);
+            take_old = order < 0 || (order == 0 && fts->postings[p].slot <= pending[j].slot);
+        }
+        if (take_old)
+        {
+            builder_add(&builder, fts->terms[t].term, fts->postings[p].slot, fts->postings[p].frequency);
+            p++;
+        }
+        else
+        {
+            builder_add(&builder, pending[j].term, pending[j].slot, pending[j].frequency);
+            j++;
+        }
+    }
+    free(pending);
+
+    StoreStamp stamp = {old->data_ino, old->data_size, old->data_mtime_sec, old->data_mtime_nsec};
+    size_t size;
+    TreasureFtsHeader *header = builder_image(&builder, &stamp, &size);
+    return header != NULL && install_image(fts, header, size);
+}
+
+int treasure_fts_open(TreasureFts *fts, TreasureStore *store, int writable)
+{
+    memset(fts, 0, sizeof(*fts));
+    fts->store = store;
+    fts->fts_fd = -1;
+    fts->writable = writable;
+
+    char fts_path[MAX_PATH_LENGTH];
+    store_hunt_path(fts_path, store->hunt_id, TREASURE_FTS_FILE);
+
+    int fd = open(fts_path, writable ? O_RDWR : O_RDONLY);
+    if (fd != -1)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreasureFtsHeader) &&
+            map_image(fts, fd, (size_t)st.st_size))
+        {
+            if (header_is_current(fts->header, (size_t)st.st_size, store))
+            {
+                return 1;
+            }
+            unmap_fts(fts);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    if (!treasure_fts_rebuild(fts))
+    {
+        treasure_fts_close(fts);
+        return 0;
+    }
+    return 1;
+}
+
+void treasure_fts_close(TreasureFts *fts)
+{
+    unmap_fts(fts);
+}
+
+int treasure_fts_insert(TreasureFts *fts, long slot, const char *clue)
+{
+    TreasureFtsEntry terms[FTS_MAX_CLUE_TERMS];
+    size_t count = clue_entries(clue, slot, terms);
+    if (fts->header->tail_count + count > fts->header->tail_capacity && !merge_tail(fts))
+    {
+        return 0;
+    }
+
+    SIDECAR_PUBLISH(fts->header->data_size, -1);
+    memcpy(&fts->tail[fts->header->tail_count], terms, count * sizeof(TreasureFtsEntry));
+    SIDECAR_PUBLISH(fts->header->tail_count, fts->header->tail_count + count);
+    return 1;
+}
+
+/* Records the current state of treasures.hot once the caller has finished writing it. */
+void treasure_fts_sync(TreasureFts *fts)
+{
+    stamp_header(fts->header, &fts->store->stamp);
+}
+
+static int term_matches(const char *text, const FtsQueryTerm *term)
+{
+    return strncmp(text, term->text, term->prefix ? term->length : FTS_TERM_LENGTH) == 0;
+}
+
+static int compare_match_slots(const void *a, const void *b)
+{
+    const FtsMatch *x = a;
+    const FtsMatch *y = b;
+    return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+static int compare_match_scores(const void *a, const void *b)
+{
+    const FtsMatch *x = a;
+    const FtsMatch *y = b;
+    if (x->score != y->score)
+        return x->score < y->score ? 1 : -1;
+    return compare_match_slots(a, b);
+}
+
+static int add_hit(FtsMatch **hits, size_t *count, size_t *capacity, uint32_t slot, uint32_t frequency)
+{
+    if (*count == *capacity)
+    {
+        size_t grown_capacity = *capacity ? *capacity * 2 : FTS_MIN_CAPACITY;
+        FtsMatch *grown = realloc(*hits, grown_capacity * sizeof(FtsMatch));
+        if (grown == NULL)
+            return 0;
+        *hits = grown;
+        *capacity = grown_capacity;
+    }
+    (*hits)[*count].slot = slot;
+    (*hits)[*count].score = frequency;
+    (*count)++;
+    return 1;
+}
+
+/* Collects the records containing term, ordered by slot with one hit per record; -1 when out of memory. */
+static long term_hits(TreasureFts *fts, const FtsQueryTerm *term, FtsMatch **hits_out)
+{
+    const TreasureFtsHeader *header = fts->header;
+    uint64_t tail = SIDECAR_LOAD(header->tail_count);
+    FtsMatch *hits = NULL;
+    size_t count = 0, capacity = 0;
+
+    uint64_t lo = 0, hi = header->term_count;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (strncmp(fts->terms[mid].term, term->text, FTS_TERM_LENGTH) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint64_t i = lo; i < header->term_count && term_matches(fts->terms[i].term, term); i++)
+    {
+        uint64_t first = fts->terms[i].first;
+        uint64_t end = first + fts->terms[i].count;
+        if (end > header->posting_count)
+            end = header->posting_count;
+        for (uint64_t p = first; p < end; p++)
+        {
+            if (!add_hit(&hits, &count, &capacity, fts->postings[p].slot, fts->postings[p].frequency))
+                goto failed;
+        }
+    }
+    for (uint64_t i = 0; i < tail; i++)
+    {
+        if (term_matches(fts->tail[i].term, term) &&
+            !add_hit(&hits, &count, &capacity, fts->tail[i].slot, fts->tail[i].frequency))
+            goto failed;
+    }
+
+    /* A prefix can match several terms of the same clue; fold them into one hit. */
+    qsort(hits, count, sizeof(FtsMatch), compare_match_slots);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (kept > 0 && hits[kept - 1].slot == hits[i].slot)
+            hits[kept - 1].score += hits[i].score;
+        else
+            hits[kept++] = hits[i];
+    }
+    *hits_out = hits;
+    return (long)kept;
+
+failed:
+    free(hits);
+    return -1;
+}
+
+/* Splits the query arguments into terms; a term directly followed by '*' matches as a prefix. */
+static int parse_query(int argc, char *const *argv, FtsQueryTerm *terms)
+{
+    int count = 0;
+    for (int i = 0; i < argc; i++)
+    {
+        const char *text = argv[i];
+        size_t length;
+        while (count < FTS_MAX_QUERY_TERMS && (length = next_term(&text, terms[count].text)) > 0)
+        {
+            terms[count].length = length;
+            terms[count].prefix = *text == '*';
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Finds the live treasures whose clue contains every query term and stores
+ * them in *matches (freed by the caller), best score first. Returns the
+ * number of matches, or -1 when out of memory.
+ */
+long treasure_fts_search(TreasureFts *fts, int argc, char *const *argv, FtsMatch **matches)
+{
+    FtsQueryTerm terms[FTS_MAX_QUERY_TERMS];
+    int term_count = parse_query(argc, argv, terms);
+    FtsMatch *result = NULL;
+    long count = 0;
+
+    *matches = NULL;
+    for (int t = 0; t < term_count; t++)
+    {
+        FtsMatch *hits;
+        long hit_count = term_hits(fts, &terms[t], &hits);
+        if (hit_count < 0)
+        {
+            free(result);
+            return -1;
+        }
+        if (t == 0)
+        {
+            result = hits;
+            count = hit_count;
+            continue;
+        }
+
+        /* Both lists are ordered by slot, so the AND is a single merge pass. */
+        long kept = 0, i = 0, j = 0;
+        while (i < count && j < hit_count)
+        {
+            if (result[i].slot < hits[j].slot)
+                i++;
+            else if (result[i].slot > hits[j].slot)
+                j++;
+            else
+            {
+                result[kept] = result[i++];
+                result[kept++].score += hits[j++].score;
+            }
+        }
+        free(hits);
+        count = kept;
+        if (count == 0)
+            break;
+    }
+
+    long live = 0;
+    for (long i = 0; i < count; i++)
+    {
+        TreasureRecord record;
+        if (store_read_record(fts->store, result[i].slot, &record) && !RECORD_IS_DEAD(&record))
+            result[live++] = result[i];
+    }
+    qsort(result, (size_t)live, sizeof(FtsMatch), compare_match_scores);
+    *matches = result;
+    return live;
+}
+
+/* Removes "limit=N" arguments from argv, storing N in *limit; returns 0 when N is not a positive number. */
+int fts_take_limit(int *argc, char **argv, long *limit)
+{
+    int kept = 0;
+    for (int i = 0; i < *argc; i++)
+    {
+        if (strncmp(argv[i], "limit=", 6) != 0)
+        {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        char *end;
+        errno = 0;
+        *limit = strtol(argv[i] + 6, &end, 10);
+        if (errno != 0 || end == argv[i] + 6 || *end != '\0' || *limit <= 0)
+            return 0;
+    }
+    *argc = kept;
+    return 1;
+}
@@ -0,0 +1,92 @@
+#ifndef TREASURE_FTS_H
+#define TREASURE_FTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "treasure_store.h"
+
+/*
+ * Sidecar inverted index (treasures.fts) over clue text. Clues are split
+ * into lower-case alphanumeric terms (cut to FTS_TERM_LENGTH - 1 bytes).
+ * The file holds a sorted dictionary of the distinct terms, each naming
+ * its run of (slot, frequency) postings ordered by slot, and then a tail
+ * of whole (term, slot, frequency) entries for treasures added since. The
+ * tail is appended in place; once it is full, the tail is merged into the
+ * dictionary and postings of a new file, whose tail has room for an
+ * FTS_TAIL_SHARE-th of its postings (at least FTS_MAX_TAIL), which keeps
+ * bulk imports O(n log n). Removed treasures are skipped at query time and
+ * dropped when compaction forces a rebuild.
+ */
+
+#define TREASURE_FTS_MAGIC 0x53544654u
+#define TREASURE_FTS_VERSION 2
+#define FTS_TERM_LENGTH 24
+#define FTS_MAX_TAIL 4096
+#define FTS_TAIL_SHARE 16
+#define FTS_MAX_QUERY_TERMS 16
+#define FTS_ALL_LIMIT 100
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t term_count;
+    uint64_t posting_count;
+    uint64_t tail_capacity;
+    uint64_t tail_count;
+    uint64_t data_ino;
+    int64_t data_size;
+    int64_t data_mtime_sec;
+    int64_t data_mtime_nsec;
+} TreasureFtsHeader;
+
+/* A dictionary term; its postings are postings[first] to postings[first + count - 1]. */
+typedef struct
+{
+    char term[FTS_TERM_LENGTH];
+    uint32_t first;
+    uint32_t count;
+} TreasureFtsTerm;
+
+typedef struct
+{
+    uint32_t slot;
+    uint32_t frequency;
+} TreasureFtsPosting;
+
+/* A tail entry, also used while building the dictionary. */
+typedef struct
+{
+    char term[FTS_TERM_LENGTH];
+    uint32_t slot;
+    uint32_t frequency;
+} TreasureFtsEntry;
+
+typedef struct
+{
+    TreasureStore *store;
+    int fts_fd;
+    int writable;
+    TreasureFtsHeader *header;
+    TreasureFtsTerm *terms;
+    TreasureFtsPosting *postings;
+    TreasureFtsEntry *tail;
+    size_t map_size;
+} TreasureFts;
+
+/* One search hit; score is the summed frequency of the query terms in the clue. */
+typedef struct
+{
+    long slot;
+    uint32_t score;
+} FtsMatch;
+
+int treasure_fts_open(TreasureFts *fts, TreasureStore *store, int writable);
+void treasure_fts_close(TreasureFts *fts);
+int treasure_fts_insert(TreasureFts *fts, long slot, const char *clue);
+int treasure_fts_rebuild(TreasureFts *fts);
+void treasure_fts_sync(TreasureFts *fts);
+long treasure_fts_search(TreasureFts *fts, int argc, char *const *argv, FtsMatch **matches);
+int fts_take_limit(int *argc, char **argv, long *limit);
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "treasure.h"
+#include "treasure_store.h"
+#include "treasure_index.h"
+#include "treasure_agg.h"
+#include "treasure_geo.h"
+#include "treasure_fts.h"
+#include "treasure_catalog.h"
+
+#define GENERATE_BATCH_RECORDS 4096
+#define DEFAULT_USERS 1000
+#define DEFAULT_CLUE_LENGTH 48
+
+/*
+ * Writes a synthetic hunt straight through the store: IDs are G<n>, users
+ * user<k> with k drawn from the given cardinality, coordinates uniform over
+ * the globe and clues built from a small vocabulary. The sidecar files are
+ * built at the end so later runs start from a warm hunt.
+ */
+
+static const char *clue_words[] = {
+    "golden", "oak", "river", "stone", "bridge", "ancient", "tower", "gold", "shadow", "light",
+    "north", "south", "east", "west", "under", "beneath", "old", "tree", "cave", "hill",
+    "mill", "church", "well", "gate", "wall", "garden", "statue", "fountain", "lamp", "path"};
+
+/* xorshift64*: fast, and the same seed always gives the same hunt. */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double random_between(uint64_t *state, double min, double max)
+{
+    return min + (max - min) * ((double)(next_random(state) >> 11) / 9007199254740992.0);
+}
+
+static void make_clue(uint64_t *state, char *clue, int length)
+{
+    size_t word_count = sizeof(clue_words) / sizeof(clue_words[0]);
+    int used = 0;
+    clue[0] = '\0';
+    while (used < length)
+    {
+        const char *word = clue_words[next_random(state) % word_count];
+        int n = snprintf(clue + used, (size_t)(MAX_CLUE_LENGTH - used), used == 0 ? "%s" : " %s", word);
+        if (n <= 0 || used + n >= MAX_CLUE_LENGTH - 1)
+            break;
+        used += n;
+    }
+}
+
+static int parse_count(const char *text, long min, long *out)
+{
+    char *end;
+    *out = strtol(text, &end, 10);
+    return end != text && *end == '\0' && *out >= min;
+}
+
+/* Opens every sidecar once so it is built from the finished hot file. */
+static int build_sidecars(TreasureStore *store)
+{
+    TreasureIndex index;
+    TreasureAgg agg;
+    TreasureGeo geo;
+    TreasureFts fts;
+    int ok = 1;
+
+    if (treasure_index_open(&index, store, 1))
+        treasure_index_close(&index);
+    else
+        ok = 0;
+    if (treasure_agg_open(&agg, store, 1))
+        treasure_agg_close(&agg);
+    else
+        ok = 0;
+    if (treasure_geo_open(&geo, store, 1))
+        treasure_geo_close(&geo);
+    else
+        ok = 0;
+    if (treasure_fts_open(&fts, store, 1))
+        treasure_fts_close(&fts);
+    else
+        ok = 0;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    long records = 0, users = DEFAULT_USERS, clue_length = DEFAULT_CLUE_LENGTH, seed = 1;
+    int usage = argc < 3 || !parse_count(argv[2], 0, &records);
+
+    for (int i = 3; !usage && i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+            usage = 1;
+        else if (strcmp(argv[i], "--users") == 0)
+            usage = !parse_count(argv[i + 1], 1, &users);
+        else if (strcmp(argv[i], "--clue-length") == 0)
+            usage = !parse_count(argv[i + 1], 0, &clue_length) || clue_length >= MAX_CLUE_LENGTH;
+        else if (strcmp(argv[i], "--seed") == 0)
+            usage = !parse_count(argv[i + 1], 1, &seed);
+        else
+            usage = 1;
+    }
+    if (usage)
+    {
+        printf("Usage: %s <hunt_id> <records> [--users N] [--clue-length N] [--seed N]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *hunt_id = argv[1];
+    if (store_hunt_exists(hunt_id))
+    {
+        printf("Error: Hunt '%s' already exists\n", hunt_id);
+        return EXIT_FAILURE;
+    }
+    if (mkdir(hunt_id, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Failed to create hunt directory");
+        return EXIT_FAILURE;
+    }
+
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 1))
+    {
+        perror("Failed to open treasure file");
+        return EXIT_FAILURE;
+    }
+
+    Treasure *batch = calloc(GENERATE_BATCH_RECORDS, sizeof(Treasure));
+    if (batch == NULL)
+    {
+        perror("Failed to allocate memory");
+        store_close(&store);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t state = (uint64_t)seed * 0x9e3779b97f4a7c15ULL;
+    long written = 0;
+    int ok = 1;
+    while (ok && written < records)
+    {
+        size_t count = 0;
+        while (count < GENERATE_BATCH_RECORDS && written + (long)count < records)
+        {
+            Treasure *t = &batch[count];
+            snprintf(t->id, MAX_ID_LENGTH, "G%ld", written + (long)count);
+            snprintf(t->username, MAX_USERNAME_LENGTH, "user%lu", (unsigned long)(next_random(&state) % (uint64_t)users));
+            t->latitude = random_between(&state, -90.0, 90.0);
+            t->longitude = random_between(&state, -180.0, 180.0);
+            make_clue(&state, t->clue, (int)clue_length);
+            t->value = (int)(next_random(&state) % 1000);
+            count++;
+        }
+
+        long first_slot;
+        ok = store_append(&store, batch, count, &first_slot);
+        written += (long)count;
+    }
+    free(batch);
+
+    if (!ok)
+    {
+        perror("Failed to write treasure data");
+    }
+    else if (!build_sidecars(&store))
+    {
+        printf("Warning: Could not build every index for hunt '%s'\n", hunt_id);
+    }
+    else if (!catalog_update(&store))
+    {
+        printf("Warning: Could not update %s; run treasure_manager --rebuild_catalog\n", TREASURE_CATALOG_FILE);
+    }
+    store_close(&store);
+
+    if (ok)
+    {
+        printf("Generated %ld treasures in hunt %s (%ld users, clues of about %ld bytes).\n",
+               records, hunt_id, users, clue_length);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "treasure_geo.h"
+
+#define GEO_MIN_CAPACITY 64
+#define GEO_EARTH_RADIUS_M 6371000.0
+#define GEO_ROWS (180 * GEO_CELLS_PER_DEGREE)
+#define GEO_COLUMNS (360 * GEO_CELLS_PER_DEGREE)
+
+typedef struct
+{
+    double min_lat;
+    double min_lon;
+    double max_lat;
+    double max_lon;
+    int near;
+    double latitude;
+    double longitude;
+    double radius_m;
+} GeoQuery;
+
+static uint32_t cell_row(double latitude)
+{
+    double row = floor((latitude + 90.0) * GEO_CELLS_PER_DEGREE);
+    return row < 0 ? 0 : row > GEO_ROWS ? GEO_ROWS : (uint32_t)row;
+}
+
+static uint32_t cell_column(double longitude)
+{
+    double column = floor((longitude + 180.0) * GEO_CELLS_PER_DEGREE);
+    return column < 0 ? 0 : column > GEO_COLUMNS ? GEO_COLUMNS : (uint32_t)column;
+}
+
+static uint64_t cell_key(double latitude, double longitude)
+{
+    return ((uint64_t)cell_row(latitude) << 32) | cell_column(longitude);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const TreasureGeoEntry *x = a;
+    const TreasureGeoEntry *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+static size_t image_size(uint64_t capacity)
+{
+    return sizeof(TreasureGeoHeader) + capacity * sizeof(TreasureGeoEntry);
+}
+
+static void stamp_header(TreasureGeoHeader *header, const StoreStamp *stamp)
+{
+    header->data_ino = stamp->ino;
+    header->data_mtime_sec = stamp->mtime_sec;
+    header->data_mtime_nsec = stamp->mtime_nsec;
+    SIDECAR_PUBLISH(header->data_size, stamp->size);
+}
+
+static int header_is_current(const TreasureGeoHeader *header, size_t file_size, TreasureStore *store)
+{
+    if (file_size < sizeof(TreasureGeoHeader) ||
+        header->magic != TREASURE_GEO_MAGIC ||
+        header->version != TREASURE_GEO_VERSION ||
+        header->cells_per_degree != GEO_CELLS_PER_DEGREE ||
+        header->sorted_count + header->tail_count > header->capacity ||
+        file_size != image_size(header->capacity))
+    {
+        return 0;
+    }
+
+    StoreStamp now;
+    return store_stamp_now(store, &now) &&
+           SIDECAR_LOAD(header->data_size) == now.size &&
+           header->data_ino == now.ino &&
+           header->data_mtime_sec == now.mtime_sec &&
+           header->data_mtime_nsec == now.mtime_nsec;
+}
+
+static void unmap_geo(TreasureGeo *geo)
+{
+    if (geo->header != NULL)
+    {
+        munmap(geo->header, geo->map_size);
+        geo->header = NULL;
+        geo->entries = NULL;
+        geo->map_size = 0;
+    }
+    if (geo->geo_fd != -1)
+    {
+        close(geo->geo_fd);
+        geo->geo_fd = -1;
+    }
+}
+
+static int map_image(TreasureGeo *geo, int fd, size_t size)
+{
+    int prot = geo->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    geo->geo_fd = fd;
+    geo->header = map;
+    geo->entries = (TreasureGeoEntry *)((char *)map + sizeof(TreasureGeoHeader));
+    geo->map_size = size;
+    return 1;
+}
+
+/* Writes a fresh image next to the live file and renames it into place. */
+static int publish_image(TreasureGeo *geo, const void *image, size_t size)
+{
+    char geo_path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH];
+    store_hunt_path(geo_path, geo->store->hunt_id, TREASURE_GEO_FILE);
+    store_temp_path(temp_path, geo->store->hunt_id, TREASURE_GEO_FILE);
+
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    const char *p = image;
+    size_t left = size;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(temp_path);
+            return 0;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (rename(temp_path, geo_path) != 0)
+    {
+        close(fd);
+        unlink(temp_path);
+        return 0;
+    }
+
+    unmap_geo(geo);
+    if (!map_image(geo, fd, size))
+    {
+        close(fd);
+        return 0;
+    }
+    return 1;
+}
+
+/* Keeps the grid in private memory when the hunt directory is not writable. */
+static int adopt_anonymous(TreasureGeo *geo, void *image, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    memcpy(map, image, size);
+    unmap_geo(geo);
+    geo->header = map;
+    geo->entries = (TreasureGeoEntry *)((char *)map + sizeof(TreasureGeoHeader));
+    geo->map_size = size;
+    return 1;
+}
+
+/* Only writers, who hold the hunt lock, replace the file; readers keep what they built to themselves. */
+static int install_image(TreasureGeo *geo, void *image, size_t size)
+{
+    int ok = (geo->writable && publish_image(geo, image, size)) || adopt_anonymous(geo, image, size);
+    free(image);
+    return ok;
+}
+
+static void *new_image(uint64_t capacity)
+{
+    TreasureGeoHeader *header = calloc(1, image_size(capacity));
+    if (header != NULL)
+    {
+        header->magic = TREASURE_GEO_MAGIC;
+        header->version = TREASURE_GEO_VERSION;
+        header->cells_per_degree = GEO_CELLS_PER_DEGREE;
+        header->capacity = capacity;
+    }
+    return header;
+}
+
+int treasure_geo_rebuild(TreasureGeo *geo)
+{
+    TreasureStore *store = geo->store;
+    uint64_t records = (uint64_t)store_record_count(store);
+    uint64_t capacity = GEO_MIN_CAPACITY;
+    while (capacity < records)
+    {
+        capacity <<= 1;
+    }
+
+    TreasureGeoHeader *header = new_image(capacity);
+    if (header == NULL)
+    {
+        return 0;
+    }
+    TreasureGeoEntry *entries = (TreasureGeoEntry *)((char *)header + sizeof(TreasureGeoHeader));
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, store);
+    while ((record = store_cursor_next(&cursor)) != NULL && header->sorted_count < capacity)
+    {
+        entries[header->sorted_count].key = cell_key(record->latitude, record->longitude);
+        entries[header->sorted_count].slot = (uint64_t)cursor.slot;
+        header->sorted_count++;
+    }
+    qsort(entries, header->sorted_count, sizeof(TreasureGeoEntry), compare_entries);
+
+    stamp_header(header, &store->stamp);
+    return install_image(geo, header, image_size(capacity));
+}
+
+static int grow(TreasureGeo *geo)
+{
+    uint64_t old_capacity = geo->header->capacity;
+    TreasureGeoHeader *header = new_image(old_capacity * 2);
+    if (header == NULL)
+    {
+        return 0;
+    }
+    memcpy(header, geo->header, image_size(old_capacity));
+    header->capacity = old_capacity * 2;
+    return install_image(geo, header, image_size(old_capacity * 2));
+}
+
+/*
+ * Sorts a copy of the tail and merges it with the sorted run into a new
+ * image, which replaces the live file; readers of the old one see no change.
+ */
+static int merge_tail(TreasureGeo *geo)
+{
+    uint64_t sorted = geo->header->sorted_count;
+    uint64_t tail = geo->header->tail_count;
+    uint64_t capacity = geo->header->capacity;
+    TreasureGeoHeader *header = new_image(capacity);
+    TreasureGeoEntry *pending = malloc((tail + 1) * sizeof(TreasureGeoEntry));
+    if (header == NULL || pending == NULL)
+    {
+        free(header);
+        free(pending);
+        return 0;
+    }
+
+    const TreasureGeoEntry *entries = geo->entries;
+    TreasureGeoEntry *merged = (TreasureGeoEntry *)((char *)header + sizeof(TreasureGeoHeader));
+    memcpy(pending, entries + sorted, tail * sizeof(TreasureGeoEntry));
+    qsort(pending, tail, sizeof(TreasureGeoEntry), compare_entries);
+    uint64_t i = 0, j = 0, k = 0;
+    while (i < sorted && j < tail)
+    {
+        merged[k++] = compare_entries(&entries[i], &pending[j]) <= 0 ? entries[i++] : pending[j++];
+    }
+    while (i < sorted)
+        merged[k++] = entries[i++];
+    while (j < tail)
+        merged[k++] = pending[j++];
+    free(pending);
+
+    *header = *geo->header;
+    header->sorted_count = k;
+    header->tail_count = 0;
+    return install_image(geo, header, image_size(capacity));
+}
+
+int treasure_geo_open(TreasureGeo *geo, TreasureStore *store, int writable)
+{
+    memset(geo, 0, sizeof(*geo));
+    geo->store = store;
+    geo->geo_fd = -1;
+    geo->writable = writable;
+
+    char geo_path[MAX_PATH_LENGTH];
+    store_hunt_path(geo_path, store->hunt_id, TREASURE_GEO_FILE);
+
+    int fd = open(geo_path, writable ? O_RDWR : O_RDONLY);
+    if (fd != -1)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreasureGeoHeader) &&
+            map_image(geo, fd, (size_t)st.st_size))
+        {
+            if (header_is_current(geo->header, (size_t)st.st_size, store))
+            {
+                store_map(store, MADV_RANDOM);
+                return 1;
+            }
+            unmap_geo(geo);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    if (!treasure_geo_rebuild(geo))
+    {
+        treasure_geo_close(geo);
+        return 0;
+    }
+    store_map(store, MADV_RANDOM);
+    return 1;
+}
+
+void treasure_geo_close(TreasureGeo *geo)
+{
+    unmap_geo(geo);
+}
+
+int treasure_geo_insert(TreasureGeo *geo, long slot, double latitude, double longitude)
+{
+    if (geo->header->sorted_count + geo->header->tail_count == geo->header->capacity && !grow(geo))
+    {
+        return 0;
+    }
+
+    SIDECAR_PUBLISH(geo->header->data_size, -1);
+    TreasureGeoEntry *entry = &geo->entries[geo->header->sorted_count + geo->header->tail_count];
+    entry->key = cell_key(latitude, longitude);
+    entry->slot = (uint64_t)slot;
+    SIDECAR_PUBLISH(geo->header->tail_count, geo->header->tail_count + 1);
+
+    if (geo->header->tail_count > GEO_MAX_TAIL && geo->header->tail_count * 8 > geo->header->sorted_count)
+    {
+        return merge_tail(geo);
+    }
+    return 1;
+}
+
+/* Records the current state of treasures.hot once the caller has finished writing it. */
+void treasure_geo_sync(TreasureGeo *geo)
+{
+    stamp_header(geo->header, &geo->store->stamp);
+}
+
+double geo_distance_m(double lat1, double lon1, double lat2, double lon2)
+{
+    double to_rad = M_PI / 180.0;
+    double dlat = (lat2 - lat1) * to_rad;
+    double dlon = (lon2 - lon1) * to_rad;
+    double a = sin(dlat / 2) * sin(dlat / 2) +
+               cos(lat1 * to_rad) * cos(lat2 * to_rad) * sin(dlon / 2) * sin(dlon / 2);
+    return 2.0 * GEO_EARTH_RADIUS_M * atan2(sqrt(a), sqrt(1.0 - a));
+}
+
+static int query_matches(const GeoQuery *query, const TreasureRecord *record)
+{
+    if (record->latitude < query->min_lat || record->latitude > query->max_lat ||
+        record->longitude < query->min_lon || record->longitude > query->max_lon)
+    {
+        return 0;
+    }
+    return !query->near ||
+           geo_distance_m(query->latitude, query->longitude, record->latitude, record->longitude) <= query->radius_m;
+}
+
+/* Checks one candidate slot; returns -1 to stop, otherwise the number of matches (0 or 1). */
+static int visit_slot(TreasureGeo *geo, const GeoQuery *query, uint64_t slot, GeoVisit visit, void *context)
+{
+    TreasureRecord record;
+    if (!store_read_record(geo->store, (long)slot, &record) || RECORD_IS_DEAD(&record) ||
+        !query_matches(query, &record))
+    {
+        return 0;
+    }
+    return visit == NULL || visit(&record, (long)slot, context) ? 1 : -1;
+}
+
+static uint64_t lower_bound(const TreasureGeoEntry *entries, uint64_t count, uint64_t key)
+{
+    uint64_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Runs a query whose longitude range does not cross the antimeridian; returns matches or -1 if stopped. */
+static long run_query(TreasureGeo *geo, const GeoQuery *query, GeoVisit visit, void *context)
+{
+    uint32_t first_row = cell_row(query->min_lat), last_row = cell_row(query->max_lat);
+    uint32_t first_column = cell_column(query->min_lon), last_column = cell_column(query->max_lon);
+    uint64_t sorted = geo->header->sorted_count;
+    uint64_t tail = SIDECAR_LOAD(geo->header->tail_count);
+    long matches = 0;
+    int status;
+
+    for (uint64_t row = first_row; row <= last_row; row++)
+    {
+        uint64_t last_key = (row << 32) | last_column;
+        for (uint64_t i = lower_bound(geo->entries, sorted, (row << 32) | first_column);
+             i < sorted && geo->entries[i].key <= last_key; i++)
+        {
+            if ((status = visit_slot(geo, query, geo->entries[i].slot, visit, context)) < 0)
+                return -1;
+            matches += status;
+        }
+    }
+
+    for (uint64_t i = sorted; i < sorted + tail; i++)
+    {
+        uint64_t row = geo->entries[i].key >> 32, column = geo->entries[i].key & 0xffffffffu;
+        if (row < first_row || row > last_row || column < first_column || column > last_column)
+            continue;
+        if ((status = visit_slot(geo, query, geo->entries[i].slot, visit, context)) < 0)
+            return -1;
+        matches += status;
+    }
+    return matches;
+}
+
+/* Splits a query that wraps past +/-180 degrees longitude into two plain ones. */
+static long run_wrapped(TreasureGeo *geo, GeoQuery query, GeoVisit visit, void *context)
+{
+    if (query.min_lon <= query.max_lon)
+    {
+        return run_query(geo, &query, visit, context);
+    }
+
+    GeoQuery east = query, west = query;
+    east.max_lon = 180.0;
+    west.min_lon = -180.0;
+    long first = run_query(geo, &east, visit, context);
+    if (first < 0)
+        return -1;
+    long second = run_query(geo, &west, visit, context);
+    return second < 0 ? -1 : first + second;
+}
+
+/* Visits live treasures inside the box; min_lon > max_lon selects a box crossing the antimeridian. */
+long treasure_geo_bbox(TreasureGeo *geo, double min_lat, double min_lon, double max_lat, double max_lon,
+                       GeoVisit visit, void *context)
+{
+    GeoQuery query = {min_lat, min_lon, max_lat, max_lon, 0, 0, 0, 0};
+    return run_wrapped(geo, query, visit, context);
+}
+
+/* Visits live treasures within radius_m metres (great-circle distance) of the point. */
+long treasure_geo_near(TreasureGeo *geo, double latitude, double longitude, double radius_m,
+                       GeoVisit visit, void *context)
+{
+    /*
+     * The circle is widest in longitude at the latitude where its edge is
+     * tangent to a meridian, which lies poleward of the centre, so the
+     * half-width is asin(sin(d) / cos(lat)) rather than d / cos(lat).
+     */
+    double d = radius_m / GEO_EARTH_RADIUS_M;
+    double dlat = d * 180.0 / M_PI;
+    double coslat = cos(latitude * M_PI / 180.0);
+    double dlon = d < M_PI / 2 && sin(d) < coslat ? asin(sin(d) / coslat) * 180.0 / M_PI : 360.0;
+
+    GeoQuery query = {latitude - dlat, longitude - dlon, latitude + dlat, longitude + dlon,
+                      1, latitude, longitude, radius_m};
+    if (query.min_lat < -90.0)
+        query.min_lat = -90.0;
+    if (query.max_lat > 90.0)
+        query.max_lat = 90.0;
+
+    /* Near a pole, or for huge radii, the box spans every longitude. */
+    if (dlon >= 180.0 || query.min_lat == -90.0 || query.max_lat == 90.0)
+    {
+        query.min_lon = -180.0;
+        query.max_lon = 180.0;
+    }
+    else if (query.min_lon < -180.0)
+    {
+        query.min_lon += 360.0;
+    }
+    else if (query.max_lon > 180.0)
+    {
+        query.max_lon -= 360.0;
+    }
+    return run_wrapped(geo, query, visit, context);
+}
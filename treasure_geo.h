@@ -0,0 +1,69 @@
+#ifndef TREASURE_GEO_H
+#define TREASURE_GEO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "treasure_store.h"
+
+/*
+ * Sidecar grid index (treasures.geo) over treasure coordinates. The globe is
+ * cut into cells of 1/cells_per_degree degrees and every record slot is
+ * filed under its cell key (row << 32 | column). The first sorted_count
+ * entries are kept sorted by key; new treasures go to an unsorted tail that
+ * is merged in once it is longer than both GEO_MAX_TAIL and an eighth of the
+ * sorted run, which keeps bulk imports O(n log n). Removed treasures are
+ * skipped at query time and dropped when compaction forces a rebuild. The
+ * header is stamped against treasures.hot the same way as the ID index.
+ */
+
+#define TREASURE_GEO_MAGIC 0x4f454754u
+#define TREASURE_GEO_VERSION 1
+#define GEO_CELLS_PER_DEGREE 100
+#define GEO_MAX_TAIL 4096
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cells_per_degree;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t sorted_count;
+    uint64_t tail_count;
+    uint64_t data_ino;
+    int64_t data_size;
+    int64_t data_mtime_sec;
+    int64_t data_mtime_nsec;
+} TreasureGeoHeader;
+
+typedef struct
+{
+    uint64_t key;
+    uint64_t slot;
+} TreasureGeoEntry;
+
+typedef struct
+{
+    TreasureStore *store;
+    int geo_fd;
+    int writable;
+    TreasureGeoHeader *header;
+    TreasureGeoEntry *entries;
+    size_t map_size;
+} TreasureGeo;
+
+/* Called for every live treasure a query matches; returning 0 stops the query. */
+typedef int (*GeoVisit)(const TreasureRecord *record, long slot, void *context);
+
+int treasure_geo_open(TreasureGeo *geo, TreasureStore *store, int writable);
+void treasure_geo_close(TreasureGeo *geo);
+int treasure_geo_insert(TreasureGeo *geo, long slot, double latitude, double longitude);
+int treasure_geo_rebuild(TreasureGeo *geo);
+void treasure_geo_sync(TreasureGeo *geo);
+long treasure_geo_bbox(TreasureGeo *geo, double min_lat, double min_lon, double max_lat, double max_lon,
+                       GeoVisit visit, void *context);
+long treasure_geo_near(TreasureGeo *geo, double latitude, double longitude, double radius_m,
+                       GeoVisit visit, void *context);
+double geo_distance_m(double lat1, double lon1, double lat2, double lon2);
+
+#endif
@@ -3,42 +3,74 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
-#include <dirent.h>
 #include <errno.h>
+#include "treasure_store.h"
+#include "treasure_catalog.h"
+#include "treasure_protocol.h"
+#include "score_engine.h"
+#include "treasure_format.h"
 
 #define MAX_CMD_LENGTH 256
-#define MAX_PATH_LENGTH 512
-#define COMMAND_FILE "command.tmp"
-#define ARGS_FILE "args.tmp"
-#define SCORE_CALCULATOR_EXEC "./score_calculator"
-#define TREASURE_FILE_CHECK "treasures.dat"
-#define END_OF_MONITOR_OUTPUT "---END_OF_MONITOR_OUTPUT---"
+#define MAX_PIPELINED_REQUESTS 64
+#define DEFAULT_LEADERBOARD_SIZE 10
+#define FILTER_PROMPT "Enter filter (value=MIN:MAX box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON, empty for all)"
 
 volatile sig_atomic_t monitor_stopping = 0;
 volatile sig_atomic_t monitor_running = 0;
 volatile sig_atomic_t waiting_for_monitor_end = 0;
 
 pid_t monitor_pid = -1;
+int hub_to_monitor_pipe[2] = {-1, -1};
 int monitor_to_hub_pipe[2] = {-1, -1};
+FrameReader response_reader;
+uint32_t next_request_id = 1;
+OutputFormat response_format = OUTPUT_TEXT;
 
 #define MONITOR_STOP_DELAY 20
 
 void start_monitor();
+void connect_monitor();
+void disconnect_monitor();
 void list_hunts();
 void list_treasures();
 void view_treasure();
+void spatial_query(FrameType type, const char *prompt, int fields);
+void term_query(FrameType type, const char *prompt);
+void monitor_stats(int reset);
+void set_format(const char *name);
 void stop_monitor();
-void calculate_score();
+void calculate_score(int jobs);
+void leaderboard(int k);
 void handle_child_exit(int sig);
-void read_from_monitor_pipe();
+void await_response(uint32_t request_id);
+
+void close_pipe(int fds[2])
+{
+    if (fds[0] != -1)
+    {
+        close(fds[0]);
+        fds[0] = -1;
+    }
+    if (fds[1] != -1)
+    {
+        close(fds[1]);
+        fds[1] = -1;
+    }
+}
 
 void sigchld_handler(int sig)
 {
     int status;
+    /* Only the monitor is collected here; waitpid(-1) would reap children we do not own. */
+    if (monitor_pid <= 0)
+        return;
     pid_t pid = waitpid(monitor_pid, &status, WNOHANG);
     if (pid == monitor_pid)
     {
@@ -47,16 +79,8 @@ void sigchld_handler(int sig)
         monitor_stopping = 0;
         monitor_pid = -1;
         waiting_for_monitor_end = 0;
-        if (monitor_to_hub_pipe[0] != -1)
-        {
-            close(monitor_to_hub_pipe[0]);
-            monitor_to_hub_pipe[0] = -1;
-        }
-        if (monitor_to_hub_pipe[1] != -1)
-        {
-            close(monitor_to_hub_pipe[1]);
-            monitor_to_hub_pipe[1] = -1;
-        }
+        close_pipe(hub_to_monitor_pipe);
+        close_pipe(monitor_to_hub_pipe);
         printf("> ");
         fflush(stdout);
     }
@@ -70,6 +94,35 @@ void setup_signal_handlers()
     sa.sa_handler = sigchld_handler;
     sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
     sigaction(SIGCHLD, &sa, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+}
+
+/* Returns the next frame from the monitor, reading more of the pipe as needed; 0 once it is closed. */
+int read_monitor_frame(FrameHeader *header, char **payload)
+{
+    for (;;)
+    {
+        int status = frame_reader_next(&response_reader, header, payload);
+        if (status == 1)
+            return 1;
+        if (status == -1)
+        {
+            printf("Error: Oversized frame from monitor.\n");
+            return 0;
+        }
+        if (monitor_to_hub_pipe[0] == -1)
+            return 0;
+
+        ssize_t nbytes = frame_reader_fill(&response_reader, monitor_to_hub_pipe[0]);
+        if (nbytes == 0)
+            return 0;
+        if (nbytes < 0 && errno != EINTR)
+        {
+            perror("Error reading from monitor pipe");
+            return 0;
+        }
+    }
 }
 
 void start_monitor()
@@ -80,9 +133,15 @@ void start_monitor()
         return;
     }
 
+    if (pipe(hub_to_monitor_pipe) == -1)
+    {
+        perror("Failed to create pipe for monitor");
+        return;
+    }
     if (pipe(monitor_to_hub_pipe) == -1)
     {
         perror("Failed to create pipe for monitor");
+        close_pipe(hub_to_monitor_pipe);
         return;
     }
 
@@ -91,158 +150,183 @@ void start_monitor()
     if (pid < 0)
     {
         perror("Failed to fork process for monitor");
-        close(monitor_to_hub_pipe[0]);
-        close(monitor_to_hub_pipe[1]);
-        monitor_to_hub_pipe[0] = -1;
-        monitor_to_hub_pipe[1] = -1;
+        close_pipe(hub_to_monitor_pipe);
+        close_pipe(monitor_to_hub_pipe);
         return;
     }
     else if (pid == 0)
     {
+        close(hub_to_monitor_pipe[1]);
         close(monitor_to_hub_pipe[0]);
-        char pipe_fd_str[16];
-        snprintf(pipe_fd_str, sizeof(pipe_fd_str), "%d", monitor_to_hub_pipe[1]);
+        char request_fd_str[16];
+        char response_fd_str[16];
+        snprintf(request_fd_str, sizeof(request_fd_str), "%d", hub_to_monitor_pipe[0]);
+        snprintf(response_fd_str, sizeof(response_fd_str), "%d", monitor_to_hub_pipe[1]);
 
-        execl("./treasure_monitor", "treasure_monitor", pipe_fd_str, (char *)NULL);
+        execl("./treasure_monitor", "treasure_monitor", request_fd_str, response_fd_str, MONITOR_SOCKET_PATH,
+              (char *)NULL);
         perror("Failed to execute treasure_monitor");
-        close(monitor_to_hub_pipe[1]);
         exit(EXIT_FAILURE);
     }
     else
     {
+        close(hub_to_monitor_pipe[0]);
+        hub_to_monitor_pipe[0] = -1;
         close(monitor_to_hub_pipe[1]);
         monitor_to_hub_pipe[1] = -1;
+        frame_reader_free(&response_reader);
         monitor_pid = pid;
         monitor_running = 1;
         printf("Monitor started with PID: %d\n", monitor_pid);
 
-        char buffer[4096];
-        ssize_t nbytes;
-        while ((nbytes = read(monitor_to_hub_pipe[0], buffer, sizeof(buffer) - 1)) > 0)
+        FrameHeader header;
+        char *payload;
+        while (read_monitor_frame(&header, &payload) && header.type != FRAME_NOTICE)
         {
-            buffer[nbytes] = '\0';
-            char *delimiter_pos = strstr(buffer, END_OF_MONITOR_OUTPUT);
-            if (delimiter_pos != NULL)
-            {
-                break;
-            }
         }
     }
 }
 
-void read_from_monitor_pipe()
+/*
+ * Attaches to a monitor another hub started in this directory. The socket
+ * stands in for both pipes; stop_monitor only disconnects, since the
+ * monitor belongs to the hub that started it.
+ */
+void connect_monitor()
+{
+    if (monitor_running)
+    {
+        printf("Monitor is already running!\n");
+        return;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, MONITOR_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("Failed to connect to monitor");
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+
+    hub_to_monitor_pipe[1] = fd;
+    monitor_to_hub_pipe[0] = dup(fd);
+    if (monitor_to_hub_pipe[0] == -1)
+    {
+        perror("Failed to connect to monitor");
+        close_pipe(hub_to_monitor_pipe);
+        return;
+    }
+    frame_reader_free(&response_reader);
+    monitor_running = 1;
+    printf("Connected to monitor on %s\n", MONITOR_SOCKET_PATH);
+}
+
+void disconnect_monitor()
+{
+    close_pipe(hub_to_monitor_pipe);
+    close_pipe(monitor_to_hub_pipe);
+    frame_reader_free(&response_reader);
+    monitor_running = 0;
+    printf("Disconnected from monitor.\n");
+}
+
+/* Response chunks go straight from the frame reader's buffer to the terminal. */
+void write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        length -= (size_t)n;
+    }
+}
+
+void await_response(uint32_t request_id)
 {
     if (monitor_to_hub_pipe[0] == -1)
     {
         printf("Error: Monitor pipe not open for reading.\n");
         return;
     }
-    char buffer[4096];
-    ssize_t nbytes;
-    int continue_reading = 1;
+
+    FrameHeader header;
+    char *payload;
+    int received = 0;
 
     printf("--- Monitor Output ---\n");
-    while (continue_reading && (nbytes = read(monitor_to_hub_pipe[0], buffer, sizeof(buffer) - 1)) > 0)
+    fflush(stdout);
+    while (!received && read_monitor_frame(&header, &payload))
     {
-        buffer[nbytes] = '\0';
-        char *delimiter_pos = strstr(buffer, END_OF_MONITOR_OUTPUT);
-        if (delimiter_pos != NULL)
+        if (header.type == FRAME_NOTICE)
+        {
+            printf("%.*s", (int)header.length, payload);
+            fflush(stdout);
+        }
+        else if (header.request_id == request_id)
         {
-            *delimiter_pos = '\0';
-            printf("%s", buffer);
-            continue_reading = 0;
+            write_all(STDOUT_FILENO, payload, header.length);
+            received = !(header.flags & FRAME_FLAG_MORE);
         }
         else
         {
-            printf("%s", buffer);
+            printf("Discarding response to request %u\n", header.request_id);
         }
     }
-    if (nbytes < 0 && errno != EINTR)
-    {
-        perror("Error reading from monitor pipe");
-    }
-    else if (nbytes == 0 && continue_reading)
+    if (!received)
     {
         printf("Monitor pipe closed unexpectedly.\n");
-        if (monitor_running)
-        {
-            monitor_running = 0;
-            monitor_pid = -1;
-            close(monitor_to_hub_pipe[0]);
-            monitor_to_hub_pipe[0] = -1;
-        }
     }
     printf("\n--- End of Monitor Output ---\n");
+    if (!received && monitor_pid == -1)
+    {
+        disconnect_monitor();
+    }
 }
 
-void send_command(const char *command, const char *args)
+/* Queues a request on the monitor's pipe; returns the request ID, or 0 on failure. */
+uint32_t send_command(FrameType type, int argc, const char *const *argv)
 {
     if (!monitor_running)
     {
         printf("Error: Monitor is not running. Use 'start_monitor' first.\n");
-        return;
+        return 0;
     }
 
     if (monitor_stopping)
     {
         printf("Error: Monitor is stopping. Please wait until it terminates.\n");
-        return;
+        return 0;
     }
 
-    int cmd_fd = open(COMMAND_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (cmd_fd == -1)
-    {
-        perror("Failed to open command file");
-        return;
-    }
-    write(cmd_fd, command, strlen(command));
-    close(cmd_fd);
-
-    if (args != NULL && strlen(args) > 0)
-    {
-        int args_fd = open(ARGS_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (args_fd == -1)
-        {
-            perror("Failed to open arguments file");
-            return;
-        }
-        write(args_fd, args, strlen(args));
-        close(args_fd);
-    }
-    else
-    {
-        int args_fd = open(ARGS_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (args_fd != -1)
-            close(args_fd);
-        else
-            perror("Failed to truncate/create args file");
-    }
+    char payload[MAX_CMD_LENGTH * 2];
+    size_t length = frame_pack_args(payload, sizeof(payload), argc, argv);
+    uint32_t request_id = next_request_id++;
 
-    if (kill(monitor_pid, SIGUSR1) == -1)
+    uint16_t flags = (uint16_t)(response_format << FRAME_FORMAT_SHIFT);
+    if (!frame_write(hub_to_monitor_pipe[1], type, flags, request_id, payload, length))
     {
-        perror("Failed to signal monitor process");
-        if (errno == ESRCH)
-        {
-            monitor_running = 0;
-            monitor_pid = -1;
-            if (monitor_to_hub_pipe[0] != -1)
-            {
-                close(monitor_to_hub_pipe[0]);
-                monitor_to_hub_pipe[0] = -1;
-            }
-        }
-        return;
+        perror("Failed to send request to monitor");
+        return 0;
     }
 
-    if (strcmp(command, "stop_monitor") != 0)
-    {
-        read_from_monitor_pipe();
-    }
+    return request_id;
 }
 
 void list_hunts()
 {
-    send_command("list_hunts", NULL);
+    uint32_t request_id = send_command(FRAME_LIST_HUNTS, 0, NULL);
+    if (request_id != 0)
+        await_response(request_id);
 }
 
 void list_treasures()
@@ -252,14 +336,18 @@ void list_treasures()
     if (fgets(hunt_id, sizeof(hunt_id), stdin) == NULL)
         return;
     hunt_id[strcspn(hunt_id, "\n")] = 0;
-    send_command("list_treasures", hunt_id);
+
+    const char *argv[] = {hunt_id};
+    uint32_t request_id = send_command(FRAME_LIST_TREASURES, 1, argv);
+    if (request_id != 0)
+        await_response(request_id);
 }
 
+/* Several space-separated treasure IDs are sent back to back and their answers collected afterwards. */
 void view_treasure()
 {
-    char input[MAX_CMD_LENGTH * 2];
     char hunt_id[MAX_CMD_LENGTH];
-    char treasure_id[MAX_CMD_LENGTH];
+    char treasure_ids[MAX_CMD_LENGTH];
 
     printf("Enter hunt ID: ");
     if (fgets(hunt_id, sizeof(hunt_id), stdin) == NULL)
@@ -267,12 +355,105 @@ void view_treasure()
     hunt_id[strcspn(hunt_id, "\n")] = 0;
 
     printf("Enter treasure ID: ");
-    if (fgets(treasure_id, sizeof(treasure_id), stdin) == NULL)
+    if (fgets(treasure_ids, sizeof(treasure_ids), stdin) == NULL)
+        return;
+    treasure_ids[strcspn(treasure_ids, "\n")] = 0;
+
+    uint32_t request_ids[MAX_PIPELINED_REQUESTS];
+    int requests = 0;
+    char *saveptr;
+    for (char *treasure_id = strtok_r(treasure_ids, " \t", &saveptr);
+         treasure_id != NULL && requests < MAX_PIPELINED_REQUESTS;
+         treasure_id = strtok_r(NULL, " \t", &saveptr))
+    {
+        const char *argv[] = {hunt_id, treasure_id};
+        uint32_t request_id = send_command(FRAME_VIEW_TREASURE, 2, argv);
+        if (request_id == 0)
+            break;
+        request_ids[requests++] = request_id;
+    }
+
+    for (int i = 0; i < requests; i++)
+    {
+        await_response(request_ids[i]);
+    }
+}
+
+/* Prompts for a hunt and a line of numbers, then sends them as one query request. */
+void spatial_query(FrameType type, const char *prompt, int fields)
+{
+    char hunt_id[MAX_CMD_LENGTH];
+    char numbers[MAX_CMD_LENGTH];
+
+    printf("Enter hunt ID: ");
+    if (fgets(hunt_id, sizeof(hunt_id), stdin) == NULL)
+        return;
+    hunt_id[strcspn(hunt_id, "\n")] = 0;
+
+    printf("%s: ", prompt);
+    if (fgets(numbers, sizeof(numbers), stdin) == NULL)
+        return;
+    numbers[strcspn(numbers, "\n")] = 0;
+
+    const char *argv[FRAME_MAX_ARGS] = {hunt_id};
+    int argc = 1;
+    char *saveptr;
+    for (char *field = strtok_r(numbers, " \t,", &saveptr); field != NULL && argc < FRAME_MAX_ARGS;
+         field = strtok_r(NULL, " \t,", &saveptr))
+    {
+        argv[argc++] = field;
+    }
+    if (argc != fields + 1)
+    {
+        printf("Error: Expected %d numbers.\n", fields);
         return;
-    treasure_id[strcspn(treasure_id, "\n")] = 0;
+    }
 
-    snprintf(input, sizeof(input), "%s %s", hunt_id, treasure_id);
-    send_command("view_treasure", input);
+    uint32_t request_id = send_command(type, argc, argv);
+    if (request_id != 0)
+        await_response(request_id);
+}
+
+/* Prompts for a hunt and a line of space-separated terms and sends them as one request. */
+void term_query(FrameType type, const char *prompt)
+{
+    char hunt_id[MAX_CMD_LENGTH];
+    char filter[MAX_CMD_LENGTH];
+
+    printf("Enter hunt ID: ");
+    if (fgets(hunt_id, sizeof(hunt_id), stdin) == NULL)
+        return;
+    hunt_id[strcspn(hunt_id, "\n")] = 0;
+
+    printf("%s: ", prompt);
+    if (fgets(filter, sizeof(filter), stdin) == NULL)
+        return;
+    filter[strcspn(filter, "\n")] = 0;
+
+    const char *argv[FRAME_MAX_ARGS] = {hunt_id};
+    int argc = 1;
+    char *saveptr;
+    for (char *term = strtok_r(filter, " \t", &saveptr); term != NULL; term = strtok_r(NULL, " \t", &saveptr))
+    {
+        if (argc == FRAME_MAX_ARGS)
+        {
+            printf("Error: Too many terms.\n");
+            return;
+        }
+        argv[argc++] = term;
+    }
+
+    uint32_t request_id = send_command(type, argc, argv);
+    if (request_id != 0)
+        await_response(request_id);
+}
+
+void monitor_stats(int reset)
+{
+    const char *argv[] = {"reset"};
+    uint32_t request_id = send_command(FRAME_MONITOR_STATS, reset ? 1 : 0, argv);
+    if (request_id != 0)
+        await_response(request_id);
 }
 
 void stop_monitor()
@@ -287,6 +468,11 @@ void stop_monitor()
         printf("Error: Monitor is already stopping\n");
         return;
     }
+    if (monitor_pid == -1)
+    {
+        disconnect_monitor();
+        return;
+    }
 
     printf("Stopping monitor... (this will take %d seconds)\n", MONITOR_STOP_DELAY);
     monitor_stopping = 1;
@@ -301,103 +487,225 @@ void stop_monitor()
     printf("Stop command sent to monitor. Please wait...\n");
 }
 
-void calculate_score()
+/* One hunt's scores; printed once it and every earlier hunt are done. */
+typedef struct
 {
-    DIR *dir;
-    struct dirent *entry;
-    char current_dir_path[MAX_PATH_LENGTH];
-
-    if (getcwd(current_dir_path, sizeof(current_dir_path)) == NULL)
+    char hunt_id[MAX_PATH_LENGTH];
+    ScoreTable table;
+    ScoreStatus status;
+    int error;
+    int done;
+} ScoreJob;
+
+typedef struct
+{
+    ScoreJob *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} ScorePool;
+
+void *score_worker(void *arg)
+{
+    ScorePool *pool = arg;
+    for (;;)
     {
-        perror("Failed to get current working directory");
-        return;
+        pthread_mutex_lock(&pool->lock);
+        int i = pool->next < pool->count ? pool->next++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (i == -1)
+        {
+            return NULL;
+        }
+
+        ScoreJob *job = &pool->jobs[i];
+        job->status = score_hunt(job->hunt_id, &job->table, &job->error);
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
     }
+}
 
-    dir = opendir(".");
-    if (dir == NULL)
+/* Returns the number of hunts found and fills *jobs_out with them, sorted by name. */
+int collect_score_jobs(ScoreJob **jobs_out)
+{
+    char (*hunts)[MAX_PATH_LENGTH];
+    int count = catalog_list_hunts(&hunts);
+    if (count < 0)
     {
         perror("Failed to open current directory to list hunts");
+        return -1;
+    }
+
+    ScoreJob *jobs = calloc(count > 0 ? count : 1, sizeof(ScoreJob));
+    if (jobs == NULL)
+    {
+        perror("Failed to allocate memory");
+        free(hunts);
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(jobs[i].hunt_id, sizeof(jobs[i].hunt_id), "%s", hunts[i]);
+        score_table_init(&jobs[i].table);
+    }
+    free(hunts);
+
+    *jobs_out = jobs;
+    return count;
+}
+
+/*
+ * Scores every hunt in-process on up to jobs threads (the CPU count when
+ * jobs is 0) and prints each hunt's scores as one block, in hunt name order.
+ */
+void calculate_score(int jobs)
+{
+    if (jobs <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+
+    ScorePool pool;
+    pool.count = collect_score_jobs(&pool.jobs);
+    if (pool.count < 0)
+    {
         return;
     }
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.finished, NULL);
 
     printf("\nCalculating scores for all hunts...\n");
-    int hunts_found = 0;
 
-    while ((entry = readdir(dir)) != NULL)
+    if (jobs > pool.count)
+        jobs = pool.count;
+    pthread_t *threads = malloc((jobs > 0 ? jobs : 1) * sizeof(pthread_t));
+    int started = 0;
+
+    /* Workers leave signal handling (SIGCHLD from the monitor) to this thread. */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    while (threads != NULL && started < jobs &&
+           pthread_create(&threads[started], NULL, score_worker, &pool) == 0)
     {
-        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
-        {
-            char treasures_dat_path[MAX_PATH_LENGTH];
-            snprintf(treasures_dat_path, sizeof(treasures_dat_path), "%s/%s", entry->d_name, TREASURE_FILE_CHECK);
-            struct stat st_check;
-            if (stat(treasures_dat_path, &st_check) == 0 && S_ISREG(st_check.st_mode))
-            {
-                hunts_found++;
-                printf("\n--- Scores for Hunt: %s ---\n", entry->d_name);
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
 
-                int score_pipe[2];
-                if (pipe(score_pipe) == -1)
-                {
-                    perror("Failed to create pipe for score calculator");
-                    continue;
-                }
+    if (started == 0)
+    {
+        score_worker(&pool);
+    }
 
-                pid_t child_pid = fork();
-                if (child_pid == -1)
-                {
-                    perror("Failed to fork for score calculator");
-                    close(score_pipe[0]);
-                    close(score_pipe[1]);
-                    continue;
-                }
+    for (int i = 0; i < pool.count; i++)
+    {
+        ScoreJob *job = &pool.jobs[i];
+        pthread_mutex_lock(&pool.lock);
+        while (!job->done)
+        {
+            pthread_cond_wait(&pool.finished, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
 
-                if (child_pid == 0)
-                {
-                    close(score_pipe[0]);
-                    dup2(score_pipe[1], STDOUT_FILENO);
-                    close(score_pipe[1]);
+        printf("\n--- Scores for Hunt: %s ---\n", job->hunt_id);
+        score_print(stdout, job->hunt_id, job->status, job->error, &job->table);
+        printf("--- End of Scores for Hunt: %s ---\n", job->hunt_id);
+        score_table_free(&job->table);
+    }
 
-                    execl(SCORE_CALCULATOR_EXEC, SCORE_CALCULATOR_EXEC, entry->d_name, (char *)NULL);
-                    perror("Failed to execute score_calculator");
-                    exit(EXIT_FAILURE);
-                }
-                else
-                {
-                    close(score_pipe[1]);
-
-                    char buffer[4096];
-                    ssize_t nbytes;
-                    while ((nbytes = read(score_pipe[0], buffer, sizeof(buffer) - 1)) > 0)
-                    {
-                        buffer[nbytes] = '\0';
-                        printf("%s", buffer);
-                    }
-                    if (nbytes < 0 && errno != EINTR)
-                    {
-                        perror("Error reading from score_calculator pipe");
-                    }
-                    close(score_pipe[0]);
-                    waitpid(child_pid, NULL, 0);
-                    printf("--- End of Scores for Hunt: %s ---\n", entry->d_name);
-                }
-            }
-        }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
     }
-    closedir(dir);
-    if (hunts_found == 0)
+    free(threads);
+    free(pool.jobs);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.finished);
+
+    if (pool.count == 0)
     {
         printf("No hunts found to calculate scores for.\n");
     }
     printf("\nScore calculation complete.\n");
 }
 
+/* Chooses how the monitor formats its answers; binary is left to non-interactive clients. */
+void set_format(const char *name)
+{
+    while (*name == ' ')
+        name++;
+    if (*name == '\0')
+    {
+        printf("Monitor output format: %s\n",
+               response_format == OUTPUT_JSON ? "json" : response_format == OUTPUT_NDJSON ? "ndjson" : "text");
+        return;
+    }
+
+    OutputFormat format;
+    if (!format_parse(name, &format) || format == OUTPUT_BINARY)
+    {
+        printf("Error: Format must be text, json or ndjson\n");
+        return;
+    }
+    response_format = format;
+    printf("Monitor output format set to %s\n", name);
+}
+
+/* Merges every hunt's per-user totals and prints the k best users overall. */
+void leaderboard(int k)
+{
+    if (k <= 0)
+    {
+        k = DEFAULT_LEADERBOARD_SIZE;
+    }
+
+    ScoreTable table;
+    UserScore *top = NULL;
+    int hunts = 0;
+    score_table_init(&table);
+
+    ScoreStatus status = score_all_hunts(&table, 0, &hunts);
+    if (status == SCORE_OPEN_FAILED)
+    {
+        perror("Failed to open current directory to list hunts");
+    }
+    else
+    {
+        if (status == SCORE_NO_MEMORY)
+        {
+            printf("Error: Out of memory, the leaderboard is incomplete.\n");
+        }
+        size_t count = (size_t)k < table.count ? (size_t)k : table.count;
+        top = malloc((count + 1) * sizeof(UserScore));
+        if (top == NULL)
+        {
+            perror("Failed to allocate memory");
+        }
+        else
+        {
+            count = score_table_top(&table, count, top);
+            printf("\n");
+            score_print_top(stdout, top, count, &table, hunts);
+        }
+    }
+
+    score_table_free(&table);
+    free(top);
+}
+
 int main()
 {
     char command[MAX_CMD_LENGTH];
     setup_signal_handlers();
 
     printf("Treasure Hub - Interactive Interface\n");
-    printf("Available commands: start_monitor, list_hunts, list_treasures, view_treasure, calculate_score, stop_monitor, exit\n");
+    printf("Available commands: start_monitor, connect_monitor, list_hunts, list_treasures, view_treasure, near_treasures, bbox_treasures, filter_treasures, treasure_stats, search_treasures, stats [reset], format [text|json|ndjson], calculate_score [jobs], leaderboard [K], stop_monitor, exit\n");
 
     while (1)
     {
@@ -408,7 +716,7 @@ int main()
         {
             if (feof(stdin))
             {
-                if (monitor_running)
+                if (monitor_running && monitor_pid != -1)
                 {
                     printf("\nMonitor running. Use 'stop_monitor'.\n> ");
                     clearerr(stdin);
@@ -437,9 +745,20 @@ int main()
         {
             start_monitor();
         }
+        else if (strcmp(command, "connect_monitor") == 0)
+        {
+            connect_monitor();
+        }
         else if (strcmp(command, "list_hunts") == 0 ||
                  strcmp(command, "list_treasures") == 0 ||
-                 strcmp(command, "view_treasure") == 0)
+                 strcmp(command, "view_treasure") == 0 ||
+                 strcmp(command, "near_treasures") == 0 ||
+                 strcmp(command, "bbox_treasures") == 0 ||
+                 strcmp(command, "filter_treasures") == 0 ||
+                 strcmp(command, "treasure_stats") == 0 ||
+                 strcmp(command, "search_treasures") == 0 ||
+                 strcmp(command, "stats") == 0 ||
+                 strcmp(command, "stats reset") == 0)
         {
             if (!monitor_running)
             {
@@ -458,10 +777,30 @@ int main()
                 list_treasures();
             else if (strcmp(command, "view_treasure") == 0)
                 view_treasure();
+            else if (strcmp(command, "near_treasures") == 0)
+                spatial_query(FRAME_NEAR_TREASURES, "Enter latitude, longitude and radius in metres", 3);
+            else if (strcmp(command, "bbox_treasures") == 0)
+                spatial_query(FRAME_BBOX_TREASURES, "Enter min latitude, min longitude, max latitude and max longitude", 4);
+            else if (strcmp(command, "filter_treasures") == 0)
+                term_query(FRAME_FILTER_TREASURES, FILTER_PROMPT);
+            else if (strcmp(command, "treasure_stats") == 0)
+                term_query(FRAME_TREASURE_STATS, FILTER_PROMPT);
+            else if (strncmp(command, "stats", 5) == 0)
+                monitor_stats(command[5] != '\0');
+            else if (strcmp(command, "search_treasures") == 0)
+                term_query(FRAME_SEARCH_TREASURES, "Enter search terms (term* matches a prefix, limit=N caps the results; hunt ID 'all' searches every hunt)");
+        }
+        else if (strncmp(command, "calculate_score", 15) == 0 && (command[15] == '\0' || command[15] == ' '))
+        {
+            calculate_score(atoi(command + 15));
         }
-        else if (strcmp(command, "calculate_score") == 0)
+        else if (strncmp(command, "leaderboard", 11) == 0 && (command[11] == '\0' || command[11] == ' '))
         {
-            calculate_score();
+            leaderboard(atoi(command + 11));
+        }
+        else if (strncmp(command, "format", 6) == 0 && (command[6] == '\0' || command[6] == ' '))
+        {
+            set_format(command + 6);
         }
         else if (strcmp(command, "stop_monitor") == 0)
         {
@@ -469,7 +808,7 @@ int main()
         }
         else if (strcmp(command, "exit") == 0)
         {
-            if (monitor_running)
+            if (monitor_running && monitor_pid != -1)
             {
                 printf("Error: Cannot exit while monitor is running. Stop monitor first.\n");
             }
@@ -493,11 +832,8 @@ int main()
         kill(monitor_pid, SIGTERM);
         waitpid(monitor_pid, NULL, 0);
     }
-    if (monitor_to_hub_pipe[0] != -1)
-        close(monitor_to_hub_pipe[0]);
-    if (monitor_to_hub_pipe[1] != -1)
-        close(monitor_to_hub_pipe[1]);
-    unlink(COMMAND_FILE);
-    unlink(ARGS_FILE);
+    close_pipe(hub_to_monitor_pipe);
+    close_pipe(monitor_to_hub_pipe);
+    frame_reader_free(&response_reader);
     return 0;
 }
@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "treasure_index.h"
+
+#define INDEX_MIN_CAPACITY 64
+
+static uint64_t hash_id(const char *id)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < MAX_ID_LENGTH && id[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)id[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static size_t image_size(uint64_t capacity)
+{
+    return sizeof(TreasureIndexHeader) + capacity * sizeof(TreasureIndexEntry);
+}
+
+/* data_size goes last: until it is stored, the -1 a writer left there keeps readers off the index. */
+static void stamp_header(TreasureIndexHeader *header, const StoreStamp *stamp)
+{
+    header->data_ino = stamp->ino;
+    header->data_mtime_sec = stamp->mtime_sec;
+    header->data_mtime_nsec = stamp->mtime_nsec;
+    SIDECAR_PUBLISH(header->data_size, stamp->size);
+}
+
+static int header_is_current(const TreasureIndexHeader *header, size_t file_size, TreasureStore *store)
+{
+    if (file_size < sizeof(TreasureIndexHeader) ||
+        header->magic != TREASURE_INDEX_MAGIC ||
+        header->version != TREASURE_INDEX_VERSION ||
+        header->capacity == 0 ||
+        (header->capacity & (header->capacity - 1)) != 0 ||
+        header->count + header->tombstones > header->capacity ||
+        file_size != image_size(header->capacity))
+    {
+        return 0;
+    }
+
+    StoreStamp now;
+    return store_stamp_now(store, &now) &&
+           SIDECAR_LOAD(header->data_size) == now.size &&
+           header->data_ino == now.ino &&
+           header->data_mtime_sec == now.mtime_sec &&
+           header->data_mtime_nsec == now.mtime_nsec;
+}
+
+static void place_entry(TreasureIndexEntry *entries, uint64_t capacity, uint64_t hash, uint64_t slot)
+{
+    uint64_t mask = capacity - 1;
+    uint64_t i = hash & mask;
+    while (entries[i].slot != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    entries[i].hash = hash;
+    SIDECAR_PUBLISH(entries[i].slot, slot + 1);
+}
+
+static long probe_table(const TreasureIndexEntry *entries, uint64_t capacity, TreasureStore *store,
+                        const char *treasure_id, uint64_t *bucket, TreasureRecord *out)
+{
+    uint64_t mask = capacity - 1;
+    uint64_t hash = hash_id(treasure_id);
+    uint64_t i = hash & mask;
+    TreasureRecord record;
+
+    uint64_t entry_slot;
+    for (uint64_t n = 0; n < capacity && (entry_slot = SIDECAR_LOAD(entries[i].slot)) != 0; n++)
+    {
+        if (entry_slot != TREASURE_INDEX_TOMBSTONE && entries[i].hash == hash)
+        {
+            long slot = (long)(entry_slot - 1);
+            if (store_read_record(store, slot, &record) && !RECORD_IS_DEAD(&record) &&
+                strncmp(record.id, treasure_id, MAX_ID_LENGTH) == 0)
+            {
+                if (bucket)
+                    *bucket = i;
+                if (out)
+                    *out = record;
+                return slot;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+static long probe(TreasureIndex *index, const char *treasure_id, uint64_t *bucket, TreasureRecord *out)
+{
+    return probe_table(index->entries, index->header->capacity, index->store, treasure_id, bucket, out);
+}
+
+static void unmap_index(TreasureIndex *index)
+{
+    if (index->header != NULL)
+    {
+        munmap(index->header, index->map_size);
+        index->header = NULL;
+        index->entries = NULL;
+        index->map_size = 0;
+    }
+    if (index->index_fd != -1)
+    {
+        close(index->index_fd);
+        index->index_fd = -1;
+    }
+}
+
+static int map_image(TreasureIndex *index, int fd, size_t size)
+{
+    int prot = index->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    index->index_fd = fd;
+    index->header = map;
+    index->entries = (TreasureIndexEntry *)((char *)map + sizeof(TreasureIndexHeader));
+    index->map_size = size;
+    return 1;
+}
+
+/* Writes a fresh image next to the live index and renames it into place. */
+static int publish_image(TreasureIndex *index, const void *image, size_t size)
+{
+    char index_path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH];
+    store_hunt_path(index_path, index->store->hunt_id, TREASURE_INDEX_FILE);
+    store_temp_path(temp_path, index->store->hunt_id, TREASURE_INDEX_FILE);
+
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    const char *p = image;
+    size_t left = size;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(temp_path);
+            return 0;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (rename(temp_path, index_path) != 0)
+    {
+        close(fd);
+        unlink(temp_path);
+        return 0;
+    }
+
+    unmap_index(index);
+    if (!map_image(index, fd, size))
+    {
+        close(fd);
+        return 0;
+    }
+    return 1;
+}
+
+/* Falls back to a private in-memory table when the hunt directory is not writable. */
+static int adopt_anonymous(TreasureIndex *index, void *image, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    memcpy(map, image, size);
+    unmap_index(index);
+    index->header = map;
+    index->entries = (TreasureIndexEntry *)((char *)map + sizeof(TreasureIndexHeader));
+    index->map_size = size;
+    return 1;
+}
+
+/* Only writers, who hold the hunt lock, replace the file; readers keep what they built to themselves. */
+static int install_image(TreasureIndex *index, void *image, size_t size)
+{
+    if ((index->writable && publish_image(index, image, size)) || adopt_anonymous(index, image, size))
+    {
+        free(image);
+        return 1;
+    }
+    free(image);
+    return 0;
+}
+
+int treasure_index_rebuild(TreasureIndex *index)
+{
+    uint64_t records = (uint64_t)store_record_count(index->store);
+    uint64_t capacity = INDEX_MIN_CAPACITY;
+    while (capacity < records * 2)
+    {
+        capacity <<= 1;
+    }
+
+    size_t size = image_size(capacity);
+    void *image = calloc(1, size);
+    if (image == NULL)
+    {
+        return 0;
+    }
+
+    TreasureIndexHeader *header = image;
+    TreasureIndexEntry *entries = (TreasureIndexEntry *)((char *)image + sizeof(TreasureIndexHeader));
+    header->magic = TREASURE_INDEX_MAGIC;
+    header->version = TREASURE_INDEX_VERSION;
+    header->capacity = capacity;
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, index->store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
+    {
+        if (probe_table(entries, capacity, index->store, record->id, NULL, NULL) != -1)
+        {
+            continue;
+        }
+        place_entry(entries, capacity, hash_id(record->id), (uint64_t)cursor.slot);
+        header->count++;
+    }
+
+    stamp_header(header, &index->store->stamp);
+    return install_image(index, image, size);
+}
+
+/* Rehashes into a new image, doubling unless dropping the tombstones frees enough room. */
+static int grow(TreasureIndex *index)
+{
+    uint64_t old_capacity = index->header->capacity;
+    uint64_t capacity = (index->header->count + 1) * 4 > old_capacity ? old_capacity * 2 : old_capacity;
+    size_t size = image_size(capacity);
+    void *image = calloc(1, size);
+    if (image == NULL)
+    {
+        return 0;
+    }
+
+    TreasureIndexHeader *header = image;
+    TreasureIndexEntry *entries = (TreasureIndexEntry *)((char *)image + sizeof(TreasureIndexHeader));
+    *header = *index->header;
+    header->capacity = capacity;
+    header->tombstones = 0;
+
+    for (uint64_t i = 0; i < old_capacity; i++)
+    {
+        if (index->entries[i].slot != 0 && index->entries[i].slot != TREASURE_INDEX_TOMBSTONE)
+        {
+            place_entry(entries, capacity, index->entries[i].hash, index->entries[i].slot - 1);
+        }
+    }
+
+    return install_image(index, image, size);
+}
+
+int treasure_index_open(TreasureIndex *index, TreasureStore *store, int writable)
+{
+    memset(index, 0, sizeof(*index));
+    index->store = store;
+    index->index_fd = -1;
+    index->writable = writable;
+
+    char index_path[MAX_PATH_LENGTH];
+    store_hunt_path(index_path, store->hunt_id, TREASURE_INDEX_FILE);
+
+    int fd = open(index_path, writable ? O_RDWR : O_RDONLY);
+    if (fd != -1)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreasureIndexHeader) &&
+            map_image(index, fd, (size_t)st.st_size))
+        {
+            if (header_is_current(index->header, (size_t)st.st_size, store))
+            {
+                store_map(store, MADV_RANDOM);
+                return 1;
+            }
+            unmap_index(index);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    if (!treasure_index_rebuild(index))
+    {
+        treasure_index_close(index);
+        return 0;
+    }
+    store_map(store, MADV_RANDOM);
+    return 1;
+}
+
+void treasure_index_close(TreasureIndex *index)
+{
+    unmap_index(index);
+}
+
+long treasure_index_find(TreasureIndex *index, const char *treasure_id, TreasureRecord *out)
+{
+    return probe(index, treasure_id, NULL, out);
+}
+
+long treasure_index_count(TreasureIndex *index)
+{
+    return (long)index->header->count;
+}
+
+int treasure_index_insert(TreasureIndex *index, const char *treasure_id, long slot)
+{
+    if ((index->header->count + index->header->tombstones + 1) * 2 > index->header->capacity && !grow(index))
+    {
+        return 0;
+    }
+
+    SIDECAR_PUBLISH(index->header->data_size, -1);
+    place_entry(index->entries, index->header->capacity, hash_id(treasure_id), (uint64_t)slot);
+    index->header->count++;
+    return 1;
+}
+
+int treasure_index_delete(TreasureIndex *index, const char *treasure_id)
+{
+    uint64_t i;
+    if (probe(index, treasure_id, &i, NULL) == -1)
+    {
+        return 0;
+    }
+
+    SIDECAR_PUBLISH(index->header->data_size, -1);
+    SIDECAR_PUBLISH(index->entries[i].slot, TREASURE_INDEX_TOMBSTONE);
+    index->header->count--;
+    index->header->tombstones++;
+    return 1;
+}
+
+/* Records the current state of treasures.hot once the caller has finished writing it. */
+void treasure_index_sync(TreasureIndex *index)
+{
+    stamp_header(index->header, &index->store->stamp);
+}
@@ -0,0 +1,59 @@
+#ifndef TREASURE_INDEX_H
+#define TREASURE_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "treasure_store.h"
+
+/*
+ * Sidecar hash index (treasures.idx) mapping a treasure ID to its record
+ * slot in treasures.hot. The header remembers the inode, size and mtime of
+ * the hot file it was built from; a mismatch means the index is stale and
+ * it is rebuilt from the store on open. Removal leaves a tombstone in the
+ * bucket rather than shifting the probe chain, so readers probing the live
+ * file never miss an entry; growing drops the tombstones.
+ */
+
+#define TREASURE_INDEX_MAGIC 0x58444954u
+#define TREASURE_INDEX_VERSION 3
+#define TREASURE_INDEX_TOMBSTONE UINT64_MAX
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t tombstones;
+    uint64_t data_ino;
+    int64_t data_size;
+    int64_t data_mtime_sec;
+    int64_t data_mtime_nsec;
+} TreasureIndexHeader;
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t slot; /* record slot + 1, 0 marks an empty bucket, TREASURE_INDEX_TOMBSTONE a removed one */
+} TreasureIndexEntry;
+
+typedef struct
+{
+    TreasureStore *store;
+    int index_fd;
+    int writable;
+    TreasureIndexHeader *header;
+    TreasureIndexEntry *entries;
+    size_t map_size;
+} TreasureIndex;
+
+int treasure_index_open(TreasureIndex *index, TreasureStore *store, int writable);
+void treasure_index_close(TreasureIndex *index);
+long treasure_index_find(TreasureIndex *index, const char *treasure_id, TreasureRecord *out);
+int treasure_index_insert(TreasureIndex *index, const char *treasure_id, long slot);
+int treasure_index_delete(TreasureIndex *index, const char *treasure_id);
+int treasure_index_rebuild(TreasureIndex *index);
+long treasure_index_count(TreasureIndex *index);
+void treasure_index_sync(TreasureIndex *index);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include "treasure.h"
+#include "treasure_log.h"
+
+#define LOG_BUFFER_SIZE 65536
+#define LOG_DEFAULT_GROUP 64
+#define LOG_MAX_ENTRY 512
+
+typedef enum
+{
+    LOG_SYNC_NONE,
+    LOG_SYNC_GROUP,
+    LOG_SYNC_ALWAYS
+} LogSync;
+
+static struct
+{
+    char hunt_id[MAX_PATH_LENGTH];
+    int fd;
+    int binary;
+    LogSync sync;
+    int group;
+    int pending;
+    int registered;
+    size_t used;
+    char buffer[LOG_BUFFER_SIZE];
+} logger = {.fd = -1};
+
+static int format_message(char *out, size_t size, const char *hunt_id, int op,
+                          const char *text, const char *extra, long count, long number)
+{
+    switch (op)
+    {
+    case LOG_OP_ADD:
+        return snprintf(out, size, "Added treasure %s by user %s", text, extra);
+    case LOG_OP_LIST:
+        return snprintf(out, size, "Listed all treasures in hunt %s", hunt_id);
+    case LOG_OP_VIEW:
+        return snprintf(out, size, "Viewed treasure %s in hunt %s", text, hunt_id);
+    case LOG_OP_REMOVE:
+        return snprintf(out, size, "Removed treasure %s from hunt %s", text, hunt_id);
+    case LOG_OP_REMOVE_HUNT:
+        return snprintf(out, size, "Removed hunt %s", hunt_id);
+    case LOG_OP_IMPORT:
+        return snprintf(out, size, "Imported batch %ld of %ld treasures into hunt %s", number, count, hunt_id);
+    case LOG_OP_COMPACT:
+        return snprintf(out, size, "Compacted hunt %s, reclaimed %ld removed treasures", hunt_id, count);
+    case LOG_OP_MIGRATE:
+        return snprintf(out, size, "Migrated hunt %s to split storage", hunt_id);
+    case LOG_OP_QUERY:
+        return snprintf(out, size, "Queried hunt %s (%s), %ld treasures matched", hunt_id, text, count);
+    case LOG_OP_ARCHIVE:
+        return snprintf(out, size, "Archived hunt %s, %ld treasures compressed", hunt_id, count);
+    default:
+        return snprintf(out, size, "Unknown operation %d in hunt %s", op, hunt_id);
+    }
+}
+
+static void format_timestamp(char *out, size_t size, time_t when)
+{
+    struct tm *t = localtime(&when);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", t);
+}
+
+/* Points logged_hunt-<hunt> at the active log, touching the link only when it is missing or wrong. */
+static void ensure_symlink(const char *hunt_id, const char *log_name)
+{
+    char log_path[MAX_PATH_LENGTH];
+    char link_path[MAX_PATH_LENGTH];
+    char target[MAX_PATH_LENGTH];
+
+    snprintf(log_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, log_name);
+    snprintf(link_path, MAX_PATH_LENGTH, "%s-%s", LOG_FILE, hunt_id);
+
+    ssize_t n = readlink(link_path, target, sizeof(target) - 1);
+    if (n >= 0)
+    {
+        target[n] = '\0';
+        if (strcmp(target, log_path) == 0)
+        {
+            return;
+        }
+        unlink(link_path);
+    }
+
+    if (symlink(log_path, link_path) != 0)
+    {
+        perror("Failed to create symlink");
+    }
+}
+
+static void configure()
+{
+    const char *sync = getenv(LOG_SYNC_ENV);
+    const char *format = getenv(LOG_FORMAT_ENV);
+    const char *group = getenv(LOG_GROUP_ENV);
+
+    logger.sync = LOG_SYNC_NONE;
+    if (sync != NULL && strcmp(sync, "group") == 0)
+        logger.sync = LOG_SYNC_GROUP;
+    else if (sync != NULL && strcmp(sync, "always") == 0)
+        logger.sync = LOG_SYNC_ALWAYS;
+
+    logger.binary = format != NULL && strcmp(format, "binary") == 0;
+
+    logger.group = LOG_DEFAULT_GROUP;
+    if (group != NULL && atoi(group) > 0)
+        logger.group = atoi(group);
+}
+
+static int open_log(const char *hunt_id)
+{
+    configure();
+
+    const char *log_name = logger.binary ? LOG_BINARY_FILE : LOG_FILE;
+    char log_path[MAX_PATH_LENGTH];
+    snprintf(log_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, log_name);
+
+    logger.fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (logger.fd == -1)
+    {
+        perror("Failed to open log file");
+        return 0;
+    }
+
+    snprintf(logger.hunt_id, sizeof(logger.hunt_id), "%s", hunt_id);
+    logger.used = 0;
+    logger.pending = 0;
+    if (!logger.registered)
+    {
+        atexit(log_close);
+        logger.registered = 1;
+    }
+
+    ensure_symlink(hunt_id, log_name);
+    return 1;
+}
+
+void log_flush()
+{
+    if (logger.fd == -1 || logger.used == 0)
+    {
+        return;
+    }
+
+    const char *p = logger.buffer;
+    size_t left = logger.used;
+    while (left > 0)
+    {
+        ssize_t n = write(logger.fd, p, left);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("Failed to write log file");
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (logger.sync != LOG_SYNC_NONE)
+    {
+        fdatasync(logger.fd);
+    }
+    logger.used = 0;
+    logger.pending = 0;
+}
+
+void log_close()
+{
+    if (logger.fd == -1)
+    {
+        return;
+    }
+    log_flush();
+    close(logger.fd);
+    logger.fd = -1;
+    logger.hunt_id[0] = '\0';
+}
+
+static size_t encode_binary(char *out, int op, const char *text, const char *extra, long count, long number)
+{
+    LogRecordHeader header;
+    size_t text_length = text ? strnlen(text, 255) : 0;
+    size_t extra_length = extra ? strnlen(extra, 255) : 0;
+
+    memset(&header, 0, sizeof(header));
+    header.size = (uint16_t)(sizeof(header) + text_length + extra_length);
+    header.op = (uint8_t)op;
+    header.text_length = (uint8_t)text_length;
+    header.extra_length = (uint8_t)extra_length;
+    header.timestamp = (int64_t)time(NULL);
+    header.count = (uint32_t)count;
+    header.number = (uint32_t)number;
+
+    memcpy(out, &header, sizeof(header));
+    if (text_length > 0)
+        memcpy(out + sizeof(header), text, text_length);
+    if (extra_length > 0)
+        memcpy(out + sizeof(header) + text_length, extra, extra_length);
+    return header.size;
+}
+
+static size_t encode_text(char *out, const char *hunt_id, int op, const char *text, const char *extra,
+                          long count, long number)
+{
+    char timestamp[32];
+    char message[LOG_MAX_ENTRY - 40];
+    format_timestamp(timestamp, sizeof(timestamp), time(NULL));
+    format_message(message, sizeof(message), hunt_id, op, text, extra, count, number);
+
+    int n = snprintf(out, LOG_MAX_ENTRY, "[%s] %s\n", timestamp, message);
+    return n < LOG_MAX_ENTRY ? (size_t)n : LOG_MAX_ENTRY - 1;
+}
+
+void log_event(const char *hunt_id, LogOp op, const char *text, const char *extra, long count, long number)
+{
+    if (logger.fd != -1 && strcmp(logger.hunt_id, hunt_id) != 0)
+    {
+        log_close();
+    }
+    if (logger.fd == -1 && !open_log(hunt_id))
+    {
+        return;
+    }
+
+    if (logger.used + LOG_MAX_ENTRY > sizeof(logger.buffer))
+    {
+        log_flush();
+    }
+
+    char *out = logger.buffer + logger.used;
+    if (logger.binary)
+        logger.used += encode_binary(out, op, text, extra, count, number);
+    else
+        logger.used += encode_text(out, hunt_id, op, text, extra, count, number);
+    logger.pending++;
+
+    if (logger.sync == LOG_SYNC_ALWAYS || logger.pending >= logger.group)
+    {
+        log_flush();
+    }
+}
+
+/* Prints logged_hunt.bin in the same layout the text log uses. */
+int log_render(const char *hunt_id, FILE *out)
+{
+    char log_path[MAX_PATH_LENGTH];
+    snprintf(log_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, LOG_BINARY_FILE);
+
+    FILE *in = fopen(log_path, "rb");
+    if (in == NULL)
+    {
+        return 0;
+    }
+
+    LogRecordHeader header;
+    char text[256], extra[256];
+    char timestamp[32], message[LOG_MAX_ENTRY];
+    while (fread(&header, sizeof(header), 1, in) == 1)
+    {
+        if (header.size != sizeof(header) + header.text_length + header.extra_length ||
+            fread(text, 1, header.text_length, in) != header.text_length ||
+            fread(extra, 1, header.extra_length, in) != header.extra_length)
+        {
+            fprintf(stderr, "Truncated or corrupt record in %s\n", log_path);
+            break;
+        }
+        text[header.text_length] = '\0';
+        extra[header.extra_length] = '\0';
+
+        format_timestamp(timestamp, sizeof(timestamp), (time_t)header.timestamp);
+        format_message(message, sizeof(message), hunt_id, header.op, text, extra,
+                       (long)header.count, (long)header.number);
+        fprintf(out, "[%s] %s\n", timestamp, message);
+    }
+
+    fclose(in);
+    return 1;
+}
@@ -0,0 +1,51 @@
+#ifndef TREASURE_LOG_H
+#define TREASURE_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Per-hunt audit log. Entries are buffered in the process and written to
+ * logged_hunt in groups; TREASURE_LOG_SYNC selects the durability policy
+ * (none, group or always) and TREASURE_LOG_FORMAT=binary switches to the
+ * compact logged_hunt.bin format, which log_render() turns back into text.
+ */
+
+#define LOG_FILE "logged_hunt"
+#define LOG_BINARY_FILE "logged_hunt.bin"
+#define LOG_SYNC_ENV "TREASURE_LOG_SYNC"
+#define LOG_FORMAT_ENV "TREASURE_LOG_FORMAT"
+#define LOG_GROUP_ENV "TREASURE_LOG_GROUP"
+
+typedef enum
+{
+    LOG_OP_ADD = 1,
+    LOG_OP_LIST,
+    LOG_OP_VIEW,
+    LOG_OP_REMOVE,
+    LOG_OP_REMOVE_HUNT,
+    LOG_OP_IMPORT,
+    LOG_OP_COMPACT,
+    LOG_OP_MIGRATE,
+    LOG_OP_QUERY,
+    LOG_OP_ARCHIVE
+} LogOp;
+
+typedef struct
+{
+    uint16_t size;
+    uint8_t op;
+    uint8_t text_length;
+    uint8_t extra_length;
+    uint8_t reserved[3];
+    int64_t timestamp;
+    uint32_t count;
+    uint32_t number;
+} LogRecordHeader;
+
+void log_event(const char *hunt_id, LogOp op, const char *text, const char *extra, long count, long number);
+void log_flush();
+void log_close();
+int log_render(const char *hunt_id, FILE *out);
+
+#endif
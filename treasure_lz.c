@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <string.h>
+#include "treasure_lz.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_RUN_MASK 15
+#define LZ_COPY_CHUNK 16
+#define LZ_TAKEN_MATCH 6
+
+static uint32_t read32(const char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned hash4(const char *p)
+{
+    return (read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static char *put_length(char *out, const char *end, size_t length)
+{
+    while (length >= 255)
+    {
+        if (out == end)
+            return NULL;
+        *out++ = (char)255;
+        length -= 255;
+    }
+    if (out == end)
+        return NULL;
+    *out++ = (char)length;
+    return out;
+}
+
+/* Writes one sequence, literals only when match_length is 0; NULL once capacity runs out. */
+static char *put_sequence(char *out, const char *end, const char *literals, size_t literal_length, size_t offset,
+                          size_t match_length)
+{
+    size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    if (out == end)
+        return NULL;
+    char *token = out++;
+    *token = (char)(((literal_length < LZ_RUN_MASK ? literal_length : LZ_RUN_MASK) << 4) |
+                    (match_code < LZ_RUN_MASK ? match_code : LZ_RUN_MASK));
+    if (literal_length >= LZ_RUN_MASK && (out = put_length(out, end, literal_length - LZ_RUN_MASK)) == NULL)
+        return NULL;
+    if ((size_t)(end - out) < literal_length + 2)
+        return NULL;
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    if (match_length == 0)
+        return out;
+
+    out[0] = (char)(offset & 0xff);
+    out[1] = (char)(offset >> 8);
+    out += 2;
+    if (match_code >= LZ_RUN_MASK && (out = put_length(out, end, match_code - LZ_RUN_MASK)) == NULL)
+        return NULL;
+    return out;
+}
+
+/* Returns the compressed size, or 0 if it does not fit in capacity (LZ_BOUND(length) always does). */
+size_t lz_compress(const char *src, size_t length, char *dst, size_t capacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    char *out = dst;
+    const char *end = dst + capacity;
+    size_t anchor = 0, pos = 0;
+    while (pos + LZ_MIN_MATCH <= length)
+    {
+        unsigned hash = hash4(src + pos);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(pos + 1);
+        if (candidate == 0 || pos + 1 - candidate > LZ_MAX_OFFSET || read32(src + candidate - 1) != read32(src + pos))
+        {
+            pos++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t match_length = LZ_MIN_MATCH;
+        while (pos + match_length < length && src[match + match_length] == src[pos + match_length])
+            match_length++;
+        if (match_length < LZ_TAKEN_MATCH)
+        {
+            pos++;
+            continue;
+        }
+        out = put_sequence(out, end, src + anchor, pos - anchor, pos - match, match_length);
+        if (out == NULL)
+            return 0;
+        pos += match_length;
+        anchor = pos;
+        /* Remember the end of the match too, so the next record's padding finds this one's. */
+        if (pos + LZ_MIN_MATCH <= length)
+            table[hash4(src + pos - 2)] = (uint32_t)(pos - 1);
+    }
+
+    out = put_sequence(out, end, src + anchor, length - anchor, 0, 0);
+    return out == NULL ? 0 : (size_t)(out - dst);
+}
+
+static int get_length(const unsigned char **in, const unsigned char *end, size_t *length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*in == end)
+            return 0;
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+/*
+ * Decodes whole sequences from src + *src_pos into dst + *dst_pos until at
+ * least want bytes of dst are written, then stores where it stopped so a
+ * later call can carry on. Returns 0 if the input ends first or is damaged,
+ * which never writes past raw_length.
+ */
+int lz_decompress_some(const char *src, size_t length, size_t *src_pos, char *dst, size_t *dst_pos,
+                       size_t raw_length, size_t want)
+{
+    const unsigned char *in = (const unsigned char *)src + *src_pos;
+    const unsigned char *in_end = (const unsigned char *)src + length;
+    char *out = dst + *dst_pos;
+    char *out_end = dst + raw_length;
+    char *out_want = dst + (want < raw_length ? want : raw_length);
+
+    /* A full buffer still reads on, so an empty last sequence is consumed and anything after it fails. */
+    while (in < in_end && (out < out_want || out == out_end))
+    {
+        unsigned token = *in++;
+        size_t literal_length = token >> 4;
+        if (literal_length == LZ_RUN_MASK && !get_length(&in, in_end, &literal_length))
+            return 0;
+        if ((size_t)(in_end - in) < literal_length || (size_t)(out_end - out) < literal_length)
+            return 0;
+        /* Short runs away from the ends take one fixed-size copy; the bytes past them are written over later. */
+        if (literal_length <= LZ_COPY_CHUNK && in_end - in >= LZ_COPY_CHUNK && out_end - out >= LZ_COPY_CHUNK)
+            memcpy(out, in, LZ_COPY_CHUNK);
+        else
+            memcpy(out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            return 0;
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t match_length = token & LZ_RUN_MASK;
+        if (match_length == LZ_RUN_MASK && !get_length(&in, in_end, &match_length))
+            return 0;
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - dst) || (size_t)(out_end - out) < match_length)
+            return 0;
+
+        /* A chunk of a match at least a chunk back only reads bytes that are already written. */
+        const char *from = out - offset;
+        if (offset >= LZ_COPY_CHUNK && (size_t)(out_end - out) >= match_length + LZ_COPY_CHUNK)
+        {
+            for (size_t i = 0; i < match_length; i += LZ_COPY_CHUNK)
+                memcpy(out + i, from + i, LZ_COPY_CHUNK);
+            out += match_length;
+            continue;
+        }
+
+        /* An overlapping match repeats its first offset bytes, so each copy can be twice the last. */
+        while (match_length > 0)
+        {
+            size_t chunk = (size_t)(out - from) < match_length ? (size_t)(out - from) : match_length;
+            memcpy(out, from, chunk);
+            out += chunk;
+            match_length -= chunk;
+        }
+    }
+    *src_pos = (size_t)(in - (const unsigned char *)src);
+    *dst_pos = (size_t)(out - dst);
+    return out >= out_want && (out < out_end || in == in_end);
+}
+
+/* Returns 1 when src decodes to exactly raw_length bytes; damaged input never writes past dst. */
+int lz_decompress(const char *src, size_t length, char *dst, size_t raw_length)
+{
+    size_t src_pos = 0, dst_pos = 0;
+    return lz_decompress_some(src, length, &src_pos, dst, &dst_pos, raw_length, raw_length);
+}
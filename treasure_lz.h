@@ -0,0 +1,33 @@
+#ifndef TREASURE_LZ_H
+#define TREASURE_LZ_H
+
+#include <stddef.h>
+
+/*
+ * Small LZ77 codec in the style of LZ4, used for archived hunt blocks. A
+ * compressed block is a run of sequences, each a token byte (literal count
+ * in the high nibble, match length - LZ_MIN_MATCH in the low one, 15
+ * meaning more length bytes follow, each added until one is below 255),
+ * the literals, then a two-byte little-endian offset back into the output
+ * and the rest of the match length. The last sequence has literals only.
+ *
+ * The encoder is greedy with a single hash table slot per 4-byte prefix
+ * and only takes matches of 6 bytes or more, since shorter ones barely
+ * pay for their sequence. The decoder copies literals and matches with
+ * memcpy, short ones a fixed 16-byte chunk at a time when not near either
+ * end, so zero padding (short matches at offset 1) decodes at copy speed
+ * rather than byte by byte. lz_decompress_some stops after the sequence
+ * that reaches a wanted length and can carry on from there later, so a
+ * reader that needs only the front of a block decodes only that much.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_BOUND(length) ((length) + (length) / 255 + 16)
+
+size_t lz_compress(const char *src, size_t length, char *dst, size_t capacity);
+int lz_decompress(const char *src, size_t length, char *dst, size_t raw_length);
+int lz_decompress_some(const char *src, size_t length, size_t *src_pos, char *dst, size_t *dst_pos,
+                       size_t raw_length, size_t want);
+
+#endif
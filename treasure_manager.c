@@ -1,51 +1,122 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
-
-#define MAX_CLUE_LENGTH 256
-#define MAX_USERNAME_LENGTH 64
-#define MAX_ID_LENGTH 32
-#define MAX_PATH_LENGTH 512
-#define TREASURE_FILE "treasures.dat"
-#define LOG_FILE "logged_hunt"
-
-typedef struct
-{
-    char id[MAX_ID_LENGTH];
-    char username[MAX_USERNAME_LENGTH];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE_LENGTH];
-    int value;
-} Treasure;
+#include <stdint.h>
+#include <stddef.h>
+#include "treasure.h"
+#include "treasure_store.h"
+#include "treasure_index.h"
+#include "treasure_agg.h"
+#include "treasure_geo.h"
+#include "treasure_columns.h"
+#include "treasure_fts.h"
+#include "treasure_catalog.h"
+#include "treasure_segment.h"
+#include "treasure_log.h"
+#include "treasure_format.h"
+
+#define IMPORT_BATCH_RECORDS 4096
+#define IMPORT_FIELDS 6
+#define COMPACT_THRESHOLD_ENV "TREASURE_COMPACT_THRESHOLD"
+#define DEFAULT_COMPACT_THRESHOLD 50
 
 void add_treasure(const char *hunt_id);
+void import_treasures(const char *hunt_id, const char *source);
 void list_treasures(const char *hunt_id);
 void view_treasure(const char *hunt_id, const char *treasure_id);
 void remove_treasure(const char *hunt_id, const char *treasure_id);
 void remove_hunt(const char *hunt_id);
-void log_operation(const char *hunt_id, const char *operation);
-void create_symlink(const char *hunt_id);
+void compact_hunt(const char *hunt_id);
+void migrate_hunt(const char *hunt_id);
+void archive_hunt(const char *hunt_id);
+void rebuild_catalog();
+int compact_threshold();
+void render_log(const char *hunt_id);
+void query_near(const char *hunt_id, const char *latitude, const char *longitude, const char *radius);
+void query_bbox(const char *hunt_id, char *const bounds[4]);
+void query_filter(const char *hunt_id, int argc, char *const *argv);
+void query_stats(const char *hunt_id, int argc, char *const *argv);
+void search_treasures(const char *target, int argc, char **terms);
 int ensure_hunt_directory(const char *hunt_id);
-int treasure_id_exists(const char *hunt_id, const char *treasure_id);
+void refresh_catalog(TreasureStore *store);
+int treasure_id_exists(TreasureIndex *index, const char *treasure_id);
+int record_scores(TreasureAgg *agg, const Treasure *treasures, size_t count);
+
+/* With --format the objects go to the real stdout and everything human-readable to stderr. */
+static OutputFormat output_format = OUTPUT_TEXT;
+static FormatWriter output_writer;
+
+static int structured()
+{
+    return output_format != OUTPUT_TEXT;
+}
+
+static int start_output()
+{
+    if (!structured())
+    {
+        return 1;
+    }
+    int out = dup(STDOUT_FILENO);
+    if (out == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+        perror("Failed to redirect output");
+        return 0;
+    }
+    format_begin_fd(&output_writer, output_format, out);
+    return 1;
+}
+
+static void print_summary(long count, const char *extra_key, long extra)
+{
+    if (structured())
+    {
+        format_object(&output_writer, "summary");
+        format_int(&output_writer, "count", count);
+        if (extra_key != NULL)
+            format_int(&output_writer, extra_key, extra);
+        format_end_object(&output_writer);
+    }
+}
 
 int main(int argc, char *argv[])
 {
+    if (!format_take_option(&argc, argv, &output_format))
+    {
+        printf("Error: --format must be text, json, ndjson or binary\n");
+        return 1;
+    }
     if (argc < 2)
     {
-        printf("Usage: treasure_manager <operation> [arguments]\n");
+        printf("Usage: treasure_manager [--format=text|json|ndjson|binary] <operation> [arguments]\n");
         printf("Operations:\n");
         printf("  --add <hunt_id>\n");
+        printf("  --import <hunt_id> [file]\n");
         printf("  --list <hunt_id>\n");
         printf("  --view <hunt_id> <treasure_id>\n");
         printf("  --remove_treasure <hunt_id> <treasure_id>\n");
         printf("  --remove_hunt <hunt_id>\n");
+        printf("  --compact <hunt_id>\n");
+        printf("  --migrate <hunt_id>\n");
+        printf("  --archive <hunt_id>   (compress a cold hunt; the next change restores it)\n");
+        printf("  --rebuild_catalog\n");
+        printf("  --render_log <hunt_id>\n");
+        printf("  --near <hunt_id> <latitude> <longitude> <radius_m>\n");
+        printf("  --bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>\n");
+        printf("  --filter <hunt_id> [value=MIN:MAX] [box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON]\n");
+        printf("  --stats <hunt_id> [value=MIN:MAX] [box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON]\n");
+        printf("  --search <hunt_id|all> <term> [term...] [limit=N]   (term* matches a prefix)\n");
+        return 1;
+    }
+    if (!start_output())
+    {
         return 1;
     }
 
@@ -58,6 +129,15 @@ int main(int argc, char *argv[])
         }
         add_treasure(argv[2]);
     }
+    else if (strcmp(argv[1], "--import") == 0)
+    {
+        if (argc != 3 && argc != 4)
+        {
+            printf("Usage: treasure_manager --import <hunt_id> [file]\n");
+            return 1;
+        }
+        import_treasures(argv[2], argc == 4 ? argv[3] : NULL);
+    }
     else if (strcmp(argv[1], "--list") == 0)
     {
         if (argc != 3)
@@ -94,17 +174,117 @@ int main(int argc, char *argv[])
         }
         remove_hunt(argv[2]);
     }
+    else if (strcmp(argv[1], "--compact") == 0)
+    {
+        if (argc != 3)
+        {
+            printf("Usage: treasure_manager --compact <hunt_id>\n");
+            return 1;
+        }
+        compact_hunt(argv[2]);
+    }
+    else if (strcmp(argv[1], "--migrate") == 0)
+    {
+        if (argc != 3)
+        {
+            printf("Usage: treasure_manager --migrate <hunt_id>\n");
+            return 1;
+        }
+        migrate_hunt(argv[2]);
+    }
+    else if (strcmp(argv[1], "--archive") == 0)
+    {
+        if (argc != 3)
+        {
+            printf("Usage: treasure_manager --archive <hunt_id>\n");
+            return 1;
+        }
+        archive_hunt(argv[2]);
+    }
+    else if (strcmp(argv[1], "--rebuild_catalog") == 0)
+    {
+        if (argc != 2)
+        {
+            printf("Usage: treasure_manager --rebuild_catalog\n");
+            return 1;
+        }
+        rebuild_catalog();
+    }
+    else if (strcmp(argv[1], "--render_log") == 0)
+    {
+        if (argc != 3)
+        {
+            printf("Usage: treasure_manager --render_log <hunt_id>\n");
+            return 1;
+        }
+        render_log(argv[2]);
+    }
+    else if (strcmp(argv[1], "--near") == 0)
+    {
+        if (argc != 6)
+        {
+            printf("Usage: treasure_manager --near <hunt_id> <latitude> <longitude> <radius_m>\n");
+            return 1;
+        }
+        query_near(argv[2], argv[3], argv[4], argv[5]);
+    }
+    else if (strcmp(argv[1], "--bbox") == 0)
+    {
+        if (argc != 7)
+        {
+            printf("Usage: treasure_manager --bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>\n");
+            return 1;
+        }
+        query_bbox(argv[2], &argv[3]);
+    }
+    else if (strcmp(argv[1], "--filter") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Usage: treasure_manager --filter <hunt_id> [value=MIN:MAX] [box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON]\n");
+            return 1;
+        }
+        query_filter(argv[2], argc - 3, &argv[3]);
+    }
+    else if (strcmp(argv[1], "--stats") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Usage: treasure_manager --stats <hunt_id> [value=MIN:MAX] [box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON]\n");
+            return 1;
+        }
+        query_stats(argv[2], argc - 3, &argv[3]);
+    }
+    else if (strcmp(argv[1], "--search") == 0)
+    {
+        if (argc < 4)
+        {
+            printf("Usage: treasure_manager --search <hunt_id|all> <term> [term...] [limit=N]\n");
+            return 1;
+        }
+        search_treasures(argv[2], argc - 3, &argv[3]);
+    }
     else
     {
         printf("Unknown operation: %s\n", argv[1]);
         return 1;
     }
 
+    if (structured())
+    {
+        format_finish(&output_writer);
+    }
     return 0;
 }
 
 int ensure_hunt_directory(const char *hunt_id)
 {
+    if (strlen(hunt_id) >= CATALOG_NAME_LENGTH)
+    {
+        printf("Error: Hunt ID '%s' is longer than %d characters\n", hunt_id, CATALOG_NAME_LENGTH - 1);
+        return 0;
+    }
+
     struct stat st = {0};
     if (stat(hunt_id, &st) == -1)
     {
@@ -117,46 +297,24 @@ int ensure_hunt_directory(const char *hunt_id)
     return 1;
 }
 
-void log_operation(const char *hunt_id, const char *operation)
+/* Writers call this while they still hold the hunt, so the catalog entry matches what they left. */
+void refresh_catalog(TreasureStore *store)
 {
-    char log_path[MAX_PATH_LENGTH];
-    snprintf(log_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, LOG_FILE);
-
-    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1)
+    if (!catalog_update(store))
     {
-        perror("Failed to open log file");
-        return;
+        printf("Warning: Could not update %s; run --rebuild_catalog\n", TREASURE_CATALOG_FILE);
     }
-
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", t);
-
-    char log_entry[512];
-    snprintf(log_entry, sizeof(log_entry), "[%s] %s\n", timestamp, operation);
-
-    write(fd, log_entry, strlen(log_entry));
-    close(fd);
-
-    create_symlink(hunt_id);
 }
 
-void create_symlink(const char *hunt_id)
+void rebuild_catalog()
 {
-    char log_path[MAX_PATH_LENGTH];
-    char link_path[MAX_PATH_LENGTH];
-
-    snprintf(log_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, LOG_FILE);
-    snprintf(link_path, MAX_PATH_LENGTH, "%s-%s", LOG_FILE, hunt_id);
-
-    unlink(link_path);
-
-    if (symlink(log_path, link_path) != 0)
+    int count = catalog_rebuild();
+    if (count < 0)
     {
-        perror("Failed to create symlink");
+        perror("Failed to rebuild the hunt catalog");
+        return;
     }
+    printf("Hunt catalog rebuilt: %d hunts.\n", count);
 }
 
 void add_treasure(const char *hunt_id)
@@ -166,10 +324,8 @@ void add_treasure(const char *hunt_id)
         return;
     }
 
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
-
     Treasure new_treasure;
+    memset(&new_treasure, 0, sizeof(new_treasure));
 
     printf("Enter treasure ID: ");
     scanf("%31s", new_treasure.id);
@@ -192,259 +348,1254 @@ void add_treasure(const char *hunt_id)
     printf("Enter value: ");
     scanf("%d", &new_treasure.value);
 
-    if (treasure_id_exists(hunt_id, new_treasure.id))
-    {
-        printf("Error: Treasure with ID '%s' already exists in hunt '%s'\n", new_treasure.id, hunt_id);
-        return;
-    }
-
-    int fd = open(treasure_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1)
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 1))
     {
         perror("Failed to open treasure file");
         return;
     }
 
-    if (write(fd, &new_treasure, sizeof(Treasure)) != sizeof(Treasure))
+    TreasureIndex index;
+    if (!treasure_index_open(&index, &store, 1))
     {
-        perror("Failed to write treasure data");
-        close(fd);
+        printf("Error: Could not open the ID index for hunt '%s'\n", hunt_id);
+        store_close(&store);
         return;
     }
 
-    close(fd);
-
-    char operation[256];
-    snprintf(operation, sizeof(operation), "Added treasure %s by user %s", new_treasure.id, new_treasure.username);
-    log_operation(hunt_id, operation);
-
-    printf("Treasure added successfully.\n");
-}
-
-void list_treasures(const char *hunt_id)
-{
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
-
-    struct stat file_stat;
-    if (stat(treasure_path, &file_stat) == -1)
+    if (treasure_id_exists(&index, new_treasure.id))
     {
-        perror("Failed to get file information");
+        printf("Error: Treasure with ID '%s' already exists in hunt '%s'\n", new_treasure.id, hunt_id);
+        treasure_index_close(&index);
+        store_close(&store);
         return;
     }
 
-    printf("Hunt: %s\n", hunt_id);
-    printf("Total file size: %ld bytes\n", (long)file_stat.st_size);
-
-    char time_str[100];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&file_stat.st_mtime));
-    printf("Last modified: %s\n\n", time_str);
+    /* Opened before the append so they still match the hot file and need no rebuild. */
+    TreasureAgg agg;
+    TreasureGeo geo;
+    TreasureFts fts;
+    int have_agg = treasure_agg_open(&agg, &store, 1);
+    int have_geo = treasure_geo_open(&geo, &store, 1);
+    int have_fts = treasure_fts_open(&fts, &store, 1);
 
-    int fd = open(treasure_path, O_RDONLY);
-    if (fd == -1)
+    long slot;
+    if (!store_append(&store, &new_treasure, 1, &slot))
     {
-        if (errno == ENOENT)
-        {
-            printf("No treasures found in hunt %s.\n", hunt_id);
-        }
-        else
-        {
-            perror("Failed to open treasure file");
-        }
+        perror("Failed to write treasure data");
+        if (have_agg)
+            treasure_agg_close(&agg);
+        if (have_geo)
+            treasure_geo_close(&geo);
+        if (have_fts)
+            treasure_fts_close(&fts);
+        treasure_index_close(&index);
+        store_close(&store);
         return;
     }
 
-    Treasure treasure;
-    int count = 0;
-
-    printf("Treasures in hunt %s:\n", hunt_id);
-    printf("-----------------------------------------\n");
-
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    treasure_index_insert(&index, new_treasure.id, slot);
+    treasure_index_sync(&index);
+    treasure_index_close(&index);
+    if (have_agg)
     {
-        printf("ID: %s\n", treasure.id);
-        printf("User: %s\n", treasure.username);
-        printf("GPS: (%.6f, %.6f)\n", treasure.latitude, treasure.longitude);
-        printf("Value: %d\n", treasure.value);
-        printf("-----------------------------------------\n");
-        count++;
+        record_scores(&agg, &new_treasure, 1);
+        treasure_agg_close(&agg);
     }
-
-    close(fd);
-
-    if (count == 0)
+    if (have_geo)
     {
-        printf("No treasures found.\n");
+        if (treasure_geo_insert(&geo, slot, new_treasure.latitude, new_treasure.longitude))
+            treasure_geo_sync(&geo);
+        treasure_geo_close(&geo);
     }
-    else
+    if (have_fts)
     {
-        printf("Total treasures: %d\n", count);
+        if (treasure_fts_insert(&fts, slot, new_treasure.clue))
+            treasure_fts_sync(&fts);
+        treasure_fts_close(&fts);
     }
+    refresh_catalog(&store);
+    store_close(&store);
 
-    char operation[100];
-    snprintf(operation, sizeof(operation), "Listed all treasures in hunt %s", hunt_id);
-    log_operation(hunt_id, operation);
+    log_event(hunt_id, LOG_OP_ADD, new_treasure.id, new_treasure.username, 0, 0);
+
+    printf("Treasure added successfully.\n");
 }
 
-void view_treasure(const char *hunt_id, const char *treasure_id)
+typedef struct
 {
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
+    char (*ids)[MAX_ID_LENGTH];
+    size_t capacity;
+    size_t count;
+} IdSet;
 
-    int fd = open(treasure_path, O_RDONLY);
-    if (fd == -1)
+static uint64_t id_set_hash(const char *id)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < MAX_ID_LENGTH && id[i] != '\0'; i++)
     {
-        perror("Failed to open treasure file");
-        return;
+        hash ^= (unsigned char)id[i];
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
 
-    Treasure treasure;
-    int found = 0;
-
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+static int id_set_grow(IdSet *set)
+{
+    size_t capacity = set->capacity ? set->capacity * 2 : 1024;
+    char (*ids)[MAX_ID_LENGTH] = calloc(capacity, MAX_ID_LENGTH);
+    if (ids == NULL)
     {
-        if (strcmp(treasure.id, treasure_id) == 0)
-        {
-            printf("Treasure Details:\n");
-            printf("ID: %s\n", treasure.id);
-            printf("User: %s\n", treasure.username);
-            printf("GPS Coordinates: (%.6f, %.6f)\n", treasure.latitude, treasure.longitude);
-            printf("Clue: %s\n", treasure.clue);
-            printf("Value: %d\n", treasure.value);
-            found = 1;
-            break;
-        }
+        return 0;
     }
 
-    close(fd);
-
-    if (!found)
+    for (size_t i = 0; i < set->capacity; i++)
     {
-        printf("Treasure %s not found in hunt %s.\n", treasure_id, hunt_id);
+        if (set->ids[i][0] == '\0')
+            continue;
+        size_t j = id_set_hash(set->ids[i]) & (capacity - 1);
+        while (ids[j][0] != '\0')
+            j = (j + 1) & (capacity - 1);
+        memcpy(ids[j], set->ids[i], MAX_ID_LENGTH);
     }
 
-    char operation[200];
-    snprintf(operation, sizeof(operation), "Viewed treasure %s in hunt %s", treasure_id, hunt_id);
-    log_operation(hunt_id, operation);
+    free(set->ids);
+    set->ids = ids;
+    set->capacity = capacity;
+    return 1;
 }
 
-void remove_treasure(const char *hunt_id, const char *treasure_id)
+/* Returns 1 if the ID was added, 0 if it was already present, -1 on allocation failure. */
+static int id_set_add(IdSet *set, const char *id)
 {
-    char treasure_path[MAX_PATH_LENGTH];
-    char temp_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
-    snprintf(temp_path, MAX_PATH_LENGTH, "%s/%s.tmp", hunt_id, TREASURE_FILE);
+    if ((set->count + 1) * 2 > set->capacity && !id_set_grow(set))
+    {
+        return -1;
+    }
 
-    int src_fd = open(treasure_path, O_RDONLY);
-    if (src_fd == -1)
+    size_t mask = set->capacity - 1;
+    size_t i = id_set_hash(id) & mask;
+    while (set->ids[i][0] != '\0')
     {
-        perror("Failed to open treasure file");
-        return;
+        if (strncmp(set->ids[i], id, MAX_ID_LENGTH) == 0)
+        {
+            return 0;
+        }
+        i = (i + 1) & mask;
     }
+    strncpy(set->ids[i], id, MAX_ID_LENGTH);
+    set->count++;
+    return 1;
+}
 
-    int dst_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (dst_fd == -1)
+static int id_set_load(IdSet *set, TreasureStore *store)
+{
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
     {
-        perror("Failed to create temporary file");
-        close(src_fd);
-        return;
+        if (id_set_add(set, record->id) == -1)
+        {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    Treasure treasure;
-    int found = 0;
+/* Splits one CSV/TSV line in place. Double-quoted CSV fields may contain delimiters and "" escapes. */
+static int split_record_line(char *line, char delimiter, char **fields, int max_fields)
+{
+    int count = 0;
+    char *p = line;
 
-    while (read(src_fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    while (count < max_fields)
     {
-        if (strcmp(treasure.id, treasure_id) == 0)
+        char *out = p;
+        fields[count++] = p;
+
+        if (delimiter == ',' && *p == '"')
         {
-            found = 1;
-            continue;
+            p++;
+            while (*p != '\0')
+            {
+                if (*p == '"' && p[1] == '"')
+                {
+                    *out++ = '"';
+                    p += 2;
+                }
+                else if (*p == '"')
+                {
+                    p++;
+                    break;
+                }
+                else
+                {
+                    *out++ = *p++;
+                }
+            }
+            while (*p != '\0' && *p != delimiter)
+                p++;
+        }
+        else
+        {
+            while (*p != '\0' && *p != delimiter)
+                *out++ = *p++;
         }
 
-        if (write(dst_fd, &treasure, sizeof(Treasure)) != sizeof(Treasure))
+        if (*p == '\0')
         {
-            perror("Failed to write to temporary file");
-            close(src_fd);
-            close(dst_fd);
-            unlink(temp_path);
-            return;
+            *out = '\0';
+            return count;
         }
+        *out = '\0';
+        p++;
     }
+    return count + 1;
+}
 
-    close(src_fd);
-    close(dst_fd);
-
-    if (!found)
+static int parse_import_record(char *line, char delimiter, Treasure *treasure)
+{
+    char *fields[IMPORT_FIELDS];
+    if (split_record_line(line, delimiter, fields, IMPORT_FIELDS) != IMPORT_FIELDS)
     {
-        printf("Treasure %s not found in hunt %s.\n", treasure_id, hunt_id);
-        unlink(temp_path);
-        return;
+        return 0;
     }
 
-    if (rename(temp_path, treasure_path) != 0)
+    size_t id_len = strlen(fields[0]);
+    size_t user_len = strlen(fields[1]);
+    if (id_len == 0 || id_len >= MAX_ID_LENGTH || user_len == 0 || user_len >= MAX_USERNAME_LENGTH)
     {
-        perror("Failed to update treasure file");
-        unlink(temp_path);
-        return;
+        return 0;
     }
 
-    char operation[200];
-    snprintf(operation, sizeof(operation), "Removed treasure %s from hunt %s", treasure_id, hunt_id);
-    log_operation(hunt_id, operation);
-
-    printf("Treasure %s removed from hunt %s.\n", treasure_id, hunt_id);
-}
+    char *end;
+    memset(treasure, 0, sizeof(*treasure));
+    memcpy(treasure->id, fields[0], id_len);
+    memcpy(treasure->username, fields[1], user_len);
 
-void remove_hunt(const char *hunt_id)
-{
-    char treasure_path[MAX_PATH_LENGTH];
-    char log_path[MAX_PATH_LENGTH];
-    char link_path[MAX_PATH_LENGTH];
+    treasure->latitude = strtod(fields[2], &end);
+    if (end == fields[2] || *end != '\0')
+        return 0;
+    treasure->longitude = strtod(fields[3], &end);
+    if (end == fields[3] || *end != '\0')
+        return 0;
 
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
-    snprintf(log_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, LOG_FILE);
-    snprintf(link_path, MAX_PATH_LENGTH, "%s-%s", LOG_FILE, hunt_id);
+    strncpy(treasure->clue, fields[4], MAX_CLUE_LENGTH - 1);
 
-    char operation[100];
-    snprintf(operation, sizeof(operation), "Removed hunt %s", hunt_id);
-    log_operation(hunt_id, operation);
+    long value = strtol(fields[5], &end, 10);
+    if (end == fields[5] || *end != '\0')
+        return 0;
+    treasure->value = (int)value;
+    return 1;
+}
 
-    unlink(treasure_path);
-    unlink(log_path);
+/* A header row names the columns, so none of latitude, longitude and value reads as a number. */
+static int is_header_line(const char *line, char delimiter)
+{
+    char *copy = strdup(line);
+    char *fields[IMPORT_FIELDS];
+    if (copy == NULL)
+        return 0;
 
-    if (rmdir(hunt_id) != 0)
-    {
-        perror("Failed to remove hunt directory");
-    }
-    else
+    int header = split_record_line(copy, delimiter, fields, IMPORT_FIELDS) == IMPORT_FIELDS;
+    int numeric[] = {2, 3, 5};
+    for (int i = 0; header && i < 3; i++)
     {
-        printf("Hunt %s successfully removed.\n", hunt_id);
+        char *end;
+        strtod(fields[numeric[i]], &end);
+        header = end == fields[numeric[i]] || *end != '\0';
     }
-
-    unlink(link_path);
+    free(copy);
+    return header;
 }
 
-int treasure_id_exists(const char *hunt_id, const char *treasure_id)
+static int flush_import_batch(TreasureStore *store, TreasureIndex *index, TreasureAgg *agg, TreasureGeo *geo,
+                              TreasureFts *fts, const Treasure *batch, size_t count)
 {
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, MAX_PATH_LENGTH, "%s/%s", hunt_id, TREASURE_FILE);
-
-    int fd = open(treasure_path, O_RDONLY);
-    if (fd == -1)
+    long first_slot;
+    if (!store_append(store, batch, count, &first_slot))
     {
+        perror("Failed to write treasure data");
         return 0;
     }
 
-    Treasure treasure;
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    for (size_t i = 0; i < count; i++)
     {
-        if (strcmp(treasure.id, treasure_id) == 0)
-        {
-            close(fd);
-            return 1;
-        }
+        treasure_index_insert(index, batch[i].id, first_slot + (long)i);
     }
-
-    close(fd);
-    return 0;
+    treasure_index_sync(index);
+    if (agg != NULL)
+    {
+        record_scores(agg, batch, count);
+    }
+    if (geo != NULL)
+    {
+        size_t placed = 0;
+        while (placed < count &&
+               treasure_geo_insert(geo, first_slot + (long)placed, batch[placed].latitude, batch[placed].longitude))
+            placed++;
+        if (placed == count)
+            treasure_geo_sync(geo);
+    }
+    if (fts != NULL)
+    {
+        size_t placed = 0;
+        while (placed < count && treasure_fts_insert(fts, first_slot + (long)placed, batch[placed].clue))
+            placed++;
+        if (placed == count)
+            treasure_fts_sync(fts);
+    }
+    return 1;
+}
+
+void import_treasures(const char *hunt_id, const char *source)
+{
+    FILE *in = stdin;
+    if (source != NULL && strcmp(source, "-") != 0)
+    {
+        in = fopen(source, "r");
+        if (in == NULL)
+        {
+            perror("Failed to open import file");
+            return;
+        }
+    }
+
+    if (!ensure_hunt_directory(hunt_id))
+    {
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 1))
+    {
+        perror("Failed to open treasure file");
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    IdSet seen = {0};
+    TreasureIndex index;
+    Treasure *batch = malloc(IMPORT_BATCH_RECORDS * sizeof(Treasure));
+    if (batch == NULL || !id_set_load(&seen, &store))
+    {
+        printf("Error: Not enough memory to import into hunt '%s'\n", hunt_id);
+        free(batch);
+        free(seen.ids);
+        store_close(&store);
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    if (!treasure_index_open(&index, &store, 1))
+    {
+        printf("Error: Could not open the ID index for hunt '%s'\n", hunt_id);
+        free(batch);
+        free(seen.ids);
+        store_close(&store);
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    TreasureAgg agg;
+    TreasureGeo geo;
+    TreasureFts fts;
+    int have_agg = treasure_agg_open(&agg, &store, 1);
+    int have_geo = treasure_geo_open(&geo, &store, 1);
+    int have_fts = treasure_fts_open(&fts, &store, 1);
+
+    size_t pending = 0;
+    long imported = 0, duplicates = 0, invalid = 0, line_number = 0;
+    int batches = 0, failed = 0;
+    char delimiter = '\0';
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+
+    while (!failed && (line_len = getline(&line, &line_cap, in)) != -1)
+    {
+        line_number++;
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+            line[--line_len] = '\0';
+        if (line_len == 0)
+            continue;
+
+        if (delimiter == '\0')
+        {
+            delimiter = strchr(line, '\t') != NULL ? '\t' : ',';
+            if (is_header_line(line, delimiter))
+                continue;
+        }
+
+        Treasure *treasure = &batch[pending];
+        if (!parse_import_record(line, delimiter, treasure))
+        {
+            fprintf(stderr, "Skipping malformed record on line %ld\n", line_number);
+            invalid++;
+            continue;
+        }
+
+        int added = id_set_add(&seen, treasure->id);
+        if (added == -1)
+        {
+            printf("Error: Not enough memory to import into hunt '%s'\n", hunt_id);
+            break;
+        }
+        if (added == 0)
+        {
+            duplicates++;
+            continue;
+        }
+
+        if (++pending == IMPORT_BATCH_RECORDS)
+        {
+            failed = !flush_import_batch(&store, &index, have_agg ? &agg : NULL, have_geo ? &geo : NULL,
+                                         have_fts ? &fts : NULL, batch, pending);
+            if (!failed)
+            {
+                imported += (long)pending;
+                batches++;
+                log_event(hunt_id, LOG_OP_IMPORT, NULL, NULL, (long)pending, batches);
+            }
+            pending = 0;
+        }
+    }
+
+    if (!failed && pending > 0 &&
+        flush_import_batch(&store, &index, have_agg ? &agg : NULL, have_geo ? &geo : NULL, have_fts ? &fts : NULL,
+                           batch, pending))
+    {
+        imported += (long)pending;
+        batches++;
+        log_event(hunt_id, LOG_OP_IMPORT, NULL, NULL, (long)pending, batches);
+    }
+
+    free(line);
+    treasure_index_close(&index);
+    if (have_agg)
+        treasure_agg_close(&agg);
+    if (have_geo)
+        treasure_geo_close(&geo);
+    if (have_fts)
+        treasure_fts_close(&fts);
+    refresh_catalog(&store);
+    store_close(&store);
+    free(batch);
+    free(seen.ids);
+    if (in != stdin)
+        fclose(in);
+
+    printf("Imported %ld treasures into hunt %s (%ld duplicates skipped, %ld invalid lines).\n",
+           imported, hunt_id, duplicates, invalid);
+}
+
+void list_treasures(const char *hunt_id)
+{
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        if (errno == ENOENT)
+        {
+            printf("No treasures found in hunt %s.\n", hunt_id);
+        }
+        else
+        {
+            perror("Failed to open treasure file");
+        }
+        return;
+    }
+
+    struct stat hot_stat;
+    if (!store_data_stat(&store, &hot_stat))
+    {
+        perror("Failed to get file information");
+        store_close(&store);
+        return;
+    }
+
+    printf("Hunt: %s\n", hunt_id);
+    printf("Total file size: %ld bytes\n", (long)store_disk_bytes(&store));
+    if (structured())
+    {
+        format_object(&output_writer, "hunt");
+        format_string(&output_writer, "name", hunt_id, MAX_PATH_LENGTH);
+        format_int(&output_writer, "bytes", store_disk_bytes(&store));
+        format_int(&output_writer, "modified", (long long)hot_stat.st_mtime);
+        format_end_object(&output_writer);
+    }
+
+    char time_str[100];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&hot_stat.st_mtime));
+    printf("Last modified: %s\n\n", time_str);
+
+    if (!store_load_users(&store))
+    {
+        printf("Error: Not enough memory to list hunt '%s'\n", hunt_id);
+        store_close(&store);
+        return;
+    }
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    int count = 0;
+
+    printf("Treasures in hunt %s:\n", hunt_id);
+    printf("-----------------------------------------\n");
+
+    store_cursor_open(&cursor, &store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
+    {
+        if (structured())
+        {
+            format_treasure(&output_writer, record->id, store_username(&store, record->user), record->latitude,
+                            record->longitude, record->value, NULL);
+            count++;
+            continue;
+        }
+        printf("ID: %s\n", record->id);
+        printf("User: %s\n", store_username(&store, record->user));
+        printf("GPS: (%.6f, %.6f)\n", record->latitude, record->longitude);
+        printf("Value: %d\n", record->value);
+        printf("-----------------------------------------\n");
+        count++;
+    }
+
+    store_close(&store);
+
+    if (count == 0)
+    {
+        printf("No treasures found.\n");
+    }
+    else
+    {
+        printf("Total treasures: %d\n", count);
+    }
+    if (structured())
+    {
+        print_summary(count, NULL, 0);
+    }
+
+    log_event(hunt_id, LOG_OP_LIST, NULL, NULL, 0, 0);
+}
+
+void view_treasure(const char *hunt_id, const char *treasure_id)
+{
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        perror("Failed to open treasure file");
+        return;
+    }
+
+    TreasureIndex index;
+    if (!treasure_index_open(&index, &store, 0))
+    {
+        printf("Error: Could not open the ID index for hunt '%s'\n", hunt_id);
+        store_close(&store);
+        return;
+    }
+
+    Treasure treasure;
+    long slot = treasure_index_find(&index, treasure_id, NULL);
+    int found = slot != -1 && store_read_treasure(&store, slot, &treasure);
+    treasure_index_close(&index);
+    store_close(&store);
+
+    if (found && structured())
+    {
+        format_treasure(&output_writer, treasure.id, treasure.username, treasure.latitude, treasure.longitude,
+                        treasure.value, treasure.clue);
+    }
+    else if (found)
+    {
+        printf("Treasure Details:\n");
+        printf("ID: %s\n", treasure.id);
+        printf("User: %s\n", treasure.username);
+        printf("GPS Coordinates: (%.6f, %.6f)\n", treasure.latitude, treasure.longitude);
+        printf("Clue: %s\n", treasure.clue);
+        printf("Value: %d\n", treasure.value);
+    }
+    else
+    {
+        printf("Treasure %s not found in hunt %s.\n", treasure_id, hunt_id);
+    }
+
+    log_event(hunt_id, LOG_OP_VIEW, treasure_id, NULL, 0, 0);
+}
+
+void remove_treasure(const char *hunt_id, const char *treasure_id)
+{
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 1))
+    {
+        perror("Failed to open treasure file");
+        return;
+    }
+
+    TreasureIndex index;
+    if (!treasure_index_open(&index, &store, 1))
+    {
+        printf("Error: Could not open the ID index for hunt '%s'\n", hunt_id);
+        store_close(&store);
+        return;
+    }
+
+    TreasureRecord record;
+    long slot = treasure_index_find(&index, treasure_id, &record);
+    if (slot == -1)
+    {
+        printf("Treasure %s not found in hunt %s.\n", treasure_id, hunt_id);
+        treasure_index_close(&index);
+        store_close(&store);
+        return;
+    }
+
+    TreasureAgg agg;
+    TreasureGeo geo;
+    TreasureFts fts;
+    int have_agg = treasure_agg_open(&agg, &store, 1);
+    int have_geo = treasure_geo_open(&geo, &store, 1);
+    int have_fts = treasure_fts_open(&fts, &store, 1);
+
+    treasure_index_delete(&index, treasure_id);
+
+    if (!store_mark_dead(&store, slot))
+    {
+        perror("Failed to update treasure file");
+        if (have_agg)
+            treasure_agg_close(&agg);
+        if (have_geo)
+            treasure_geo_close(&geo);
+        if (have_fts)
+            treasure_fts_close(&fts);
+        treasure_index_close(&index);
+        store_close(&store);
+        return;
+    }
+
+    treasure_index_sync(&index);
+    if (have_agg)
+    {
+        if (treasure_agg_update(&agg, record.user, -(long)record.value, -1))
+            treasure_agg_sync(&agg);
+        treasure_agg_close(&agg);
+    }
+    if (have_geo)
+    {
+        /* The grid keeps the dead slot; queries skip it until compaction rebuilds the grid. */
+        treasure_geo_sync(&geo);
+        treasure_geo_close(&geo);
+    }
+    if (have_fts)
+    {
+        treasure_fts_sync(&fts);
+        treasure_fts_close(&fts);
+    }
+
+    long live = treasure_index_count(&index);
+    long records = store_record_count(&store);
+    treasure_index_close(&index);
+    refresh_catalog(&store);
+    store_close(&store);
+
+    log_event(hunt_id, LOG_OP_REMOVE, treasure_id, NULL, 0, 0);
+
+    printf("Treasure %s removed from hunt %s.\n", treasure_id, hunt_id);
+
+    if (records > 0 && (records - live) * 100 >= (long)compact_threshold() * records)
+    {
+        compact_hunt(hunt_id);
+    }
+}
+
+int compact_threshold()
+{
+    const char *env = getenv(COMPACT_THRESHOLD_ENV);
+    if (env != NULL && *env != '\0')
+    {
+        char *end;
+        long percent = strtol(env, &end, 10);
+        if (*end == '\0' && percent > 0 && percent <= 100)
+        {
+            return (int)percent;
+        }
+    }
+    return DEFAULT_COMPACT_THRESHOLD;
+}
+
+/*
+ * Opens every sidecar for writing, which rebuilds and publishes the stale
+ * ones. Readers only rebuild private copies, so a writer that changes the
+ * hot file behind the sidecars' back has to do this before it lets go.
+ */
+static void rebuild_sidecars(TreasureStore *store)
+{
+    TreasureIndex index;
+    if (treasure_index_open(&index, store, 1))
+    {
+        treasure_index_close(&index);
+    }
+    TreasureAgg agg;
+    if (treasure_agg_open(&agg, store, 1))
+    {
+        treasure_agg_close(&agg);
+    }
+    TreasureGeo geo;
+    if (treasure_geo_open(&geo, store, 1))
+    {
+        treasure_geo_close(&geo);
+    }
+    TreasureFts fts;
+    if (treasure_fts_open(&fts, store, 1))
+    {
+        treasure_fts_close(&fts);
+    }
+}
+
+void compact_hunt(const char *hunt_id)
+{
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 1))
+    {
+        perror("Failed to open treasure file");
+        return;
+    }
+
+    long total = store_record_count(&store);
+    long reclaimed = store_compact(&store);
+    if (reclaimed < 0)
+    {
+        perror("Failed to compact treasure file");
+        store_close(&store);
+        return;
+    }
+
+    /* The compacted file has a new inode, so opening the sidecar files rebuilds them. */
+    rebuild_sidecars(&store);
+    refresh_catalog(&store);
+    store_close(&store);
+
+    if (reclaimed == 0)
+    {
+        printf("Hunt %s has no removed treasures to reclaim.\n", hunt_id);
+        return;
+    }
+
+    log_event(hunt_id, LOG_OP_COMPACT, NULL, NULL, reclaimed, 0);
+
+    printf("Hunt %s compacted: %ld treasures kept, %ld removed treasures reclaimed.\n", hunt_id, total - reclaimed, reclaimed);
+}
+
+void migrate_hunt(const char *hunt_id)
+{
+    char treasure_path[MAX_PATH_LENGTH];
+    if (strlen(hunt_id) > STORE_MAX_HUNT_ID || !store_hunt_path(treasure_path, hunt_id, TREASURE_FILE))
+    {
+        printf("Error: Hunt ID is too long\n");
+        return;
+    }
+
+    if (access(treasure_path, F_OK) == -1)
+    {
+        if (store_hunt_exists(hunt_id))
+        {
+            printf("Hunt %s already uses the split storage layout.\n", hunt_id);
+        }
+        else
+        {
+            perror("Failed to open treasure file");
+        }
+        return;
+    }
+
+    if (!store_migrate(hunt_id))
+    {
+        perror("Failed to migrate treasure file");
+        return;
+    }
+
+    TreasureStore store;
+    if (store_open(&store, hunt_id, 1))
+    {
+        rebuild_sidecars(&store);
+        refresh_catalog(&store);
+        store_close(&store);
+    }
+
+    log_event(hunt_id, LOG_OP_MIGRATE, NULL, NULL, 0, 0);
+
+    printf("Hunt %s migrated to split storage.\n", hunt_id);
+}
+
+void archive_hunt(const char *hunt_id)
+{
+    if (segment_exists(hunt_id))
+    {
+        printf("Hunt %s is already archived.\n", hunt_id);
+        return;
+    }
+
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 1))
+    {
+        perror("Failed to open treasure file");
+        return;
+    }
+    long long before = store_disk_bytes(&store);
+    long size = segment_archive(&store);
+    if (size < 0)
+    {
+        perror("Failed to archive treasure file");
+        store_close(&store);
+        return;
+    }
+
+    /* The sidecars are rebuilt against the segment's slots while the lock is held, so no query has to. */
+    long records = 0;
+    long long after = size;
+    TreasureStore archived;
+    if (store_open_archived(&archived, hunt_id))
+    {
+        rebuild_sidecars(&archived);
+        refresh_catalog(&archived);
+        records = store_record_count(&archived);
+        after = store_disk_bytes(&archived);
+        store_close(&archived);
+    }
+    store_close(&store);
+
+    log_event(hunt_id, LOG_OP_ARCHIVE, NULL, NULL, records, 0);
+
+    printf("Hunt %s archived: %ld treasures, %lld bytes compressed to %lld bytes.\n", hunt_id, records, before, after);
+}
+
+void remove_hunt(const char *hunt_id)
+{
+    const char *data_files[] = {TREASURE_FILE, TREASURE_BACKUP_FILE, TREASURE_HOT_FILE, TREASURE_CLUE_FILE,
+                                TREASURE_SEGMENT_FILE, TREASURE_USER_FILE, TREASURE_INDEX_FILE, TREASURE_AGG_FILE,
+                                TREASURE_GEO_FILE, TREASURE_FTS_FILE, LOG_BINARY_FILE, TREASURE_LOCK_FILE};
+    char data_path[MAX_PATH_LENGTH];
+    char log_path[MAX_PATH_LENGTH];
+    char link_path[MAX_PATH_LENGTH];
+
+    if (strlen(hunt_id) > STORE_MAX_HUNT_ID)
+    {
+        printf("Error: Hunt ID is too long\n");
+        return;
+    }
+
+    /* Wait for any writer to finish; readers that still have the files open keep their snapshot. */
+    int lock_fd = store_lock_hunt(hunt_id);
+
+    store_hunt_path(log_path, hunt_id, LOG_FILE);
+    snprintf(link_path, MAX_PATH_LENGTH, "%s-%s", LOG_FILE, hunt_id);
+
+    log_event(hunt_id, LOG_OP_REMOVE_HUNT, NULL, NULL, 0, 0);
+    log_close();
+
+    for (size_t i = 0; i < sizeof(data_files) / sizeof(data_files[0]); i++)
+    {
+        store_hunt_path(data_path, hunt_id, data_files[i]);
+        unlink(data_path);
+    }
+    unlink(log_path);
+
+    if (rmdir(hunt_id) != 0)
+    {
+        perror("Failed to remove hunt directory");
+    }
+    else
+    {
+        printf("Hunt %s successfully removed.\n", hunt_id);
+    }
+    if (!catalog_remove(hunt_id))
+    {
+        printf("Warning: Could not update %s; run --rebuild_catalog\n", TREASURE_CATALOG_FILE);
+    }
+    if (lock_fd != -1)
+        close(lock_fd);
+
+    unlink(link_path);
+}
+
+int treasure_id_exists(TreasureIndex *index, const char *treasure_id)
+{
+    return treasure_index_find(index, treasure_id, NULL) != -1;
+}
+
+/* Folds freshly appended treasures into the aggregates; on failure they stay marked stale and are rebuilt later. */
+int record_scores(TreasureAgg *agg, const Treasure *treasures, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t user;
+        if (!store_intern_user(agg->store, treasures[i].username, &user) ||
+            !treasure_agg_update(agg, user, treasures[i].value, 1))
+        {
+            return 0;
+        }
+    }
+    treasure_agg_sync(agg);
+    return 1;
+}
+
+void render_log(const char *hunt_id)
+{
+    if (!log_render(hunt_id, stdout))
+    {
+        perror("Failed to open binary log file");
+    }
+}
+
+static int print_match(const TreasureRecord *record, long slot, void *context)
+{
+    TreasureStore *store = context;
+    (void)slot;
+    if (structured())
+    {
+        format_treasure(&output_writer, record->id, store_username(store, record->user), record->latitude,
+                        record->longitude, record->value, NULL);
+        return 1;
+    }
+    printf("ID: %s\n", record->id);
+    printf("User: %s\n", store_username(store, record->user));
+    printf("GPS: (%.6f, %.6f)\n", record->latitude, record->longitude);
+    printf("Value: %d\n", record->value);
+    printf("-----------------------------------------\n");
+    return 1;
+}
+
+static int parse_coordinate(const char *text, double min, double max, double *out)
+{
+    char *end;
+    *out = strtod(text, &end);
+    return end != text && *end == '\0' && *out >= min && *out <= max;
+}
+
+/* Opens hunt_id's store and spatial grid for a query; prints the reason and returns 0 on failure. */
+static int open_spatial(const char *hunt_id, TreasureStore *store, TreasureGeo *geo)
+{
+    if (!store_open(store, hunt_id, 0))
+    {
+        perror("Failed to open treasure file");
+        return 0;
+    }
+    if (!store_load_users(store) || !treasure_geo_open(geo, store, 0))
+    {
+        printf("Error: Could not open the spatial index for hunt '%s'\n", hunt_id);
+        store_close(store);
+        return 0;
+    }
+    printf("-----------------------------------------\n");
+    return 1;
+}
+
+void query_near(const char *hunt_id, const char *latitude, const char *longitude, const char *radius)
+{
+    double lat, lon, radius_m;
+    if (!parse_coordinate(latitude, -90.0, 90.0, &lat) || !parse_coordinate(longitude, -180.0, 180.0, &lon) ||
+        !parse_coordinate(radius, 0.0, 1e8, &radius_m))
+    {
+        printf("Error: Invalid latitude, longitude or radius\n");
+        return;
+    }
+
+    TreasureStore store;
+    TreasureGeo geo;
+    if (!open_spatial(hunt_id, &store, &geo))
+    {
+        return;
+    }
+
+    long matches = treasure_geo_near(&geo, lat, lon, radius_m, print_match, &store);
+    treasure_geo_close(&geo);
+    store_close(&store);
+    printf("Treasures within %.0f m of (%.6f, %.6f): %ld\n", radius_m, lat, lon, matches);
+    print_summary(matches, NULL, 0);
+
+    char description[128];
+    snprintf(description, sizeof(description), "near %.6f,%.6f within %.0f m", lat, lon, radius_m);
+    log_event(hunt_id, LOG_OP_QUERY, description, NULL, matches, 0);
+}
+
+void query_bbox(const char *hunt_id, char *const bounds[4])
+{
+    double min_lat, min_lon, max_lat, max_lon;
+    if (!parse_coordinate(bounds[0], -90.0, 90.0, &min_lat) || !parse_coordinate(bounds[1], -180.0, 180.0, &min_lon) ||
+        !parse_coordinate(bounds[2], -90.0, 90.0, &max_lat) || !parse_coordinate(bounds[3], -180.0, 180.0, &max_lon) ||
+        min_lat > max_lat)
+    {
+        printf("Error: Invalid bounding box\n");
+        return;
+    }
+
+    TreasureStore store;
+    TreasureGeo geo;
+    if (!open_spatial(hunt_id, &store, &geo))
+    {
+        return;
+    }
+
+    long matches = treasure_geo_bbox(&geo, min_lat, min_lon, max_lat, max_lon, print_match, &store);
+    treasure_geo_close(&geo);
+    store_close(&store);
+    printf("Treasures in box (%.6f, %.6f) - (%.6f, %.6f): %ld\n", min_lat, min_lon, max_lat, max_lon, matches);
+    print_summary(matches, NULL, 0);
+
+    char description[128];
+    snprintf(description, sizeof(description), "box %.6f,%.6f %.6f,%.6f", min_lat, min_lon, max_lat, max_lon);
+    log_event(hunt_id, LOG_OP_QUERY, description, NULL, matches, 0);
+}
+
+/* Parses the predicate and loads hunt_id's columns; prints the reason and returns 0 on failure. */
+static int open_columns(const char *hunt_id, int argc, char *const *argv, ColumnPredicate *predicate,
+                        TreasureStore *store, TreasureColumns *columns)
+{
+    if (!columns_parse_predicate(predicate, argc, argv))
+    {
+        printf("Error: Invalid filter, expected value=MIN:MAX and/or box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON\n");
+        return 0;
+    }
+    if (!store_open(store, hunt_id, 0))
+    {
+        perror("Failed to open treasure file");
+        return 0;
+    }
+    if (!store_load_users(store) || !columns_load(columns, store))
+    {
+        printf("Error: Could not load treasures for hunt '%s'\n", hunt_id);
+        store_close(store);
+        return 0;
+    }
+    return 1;
+}
+
+/* Joins a query's arguments for the log, "all" when there are none. */
+static void describe_query(const char *kind, int argc, char *const *argv, char *out, size_t size)
+{
+    size_t used = (size_t)snprintf(out, size, "%s%s", kind, argc == 0 ? " all" : "");
+    for (int i = 0; i < argc && used < size; i++)
+    {
+        used += (size_t)snprintf(out + used, size - used, " %s", argv[i]);
+    }
+}
+
+void query_filter(const char *hunt_id, int argc, char *const *argv)
+{
+    ColumnPredicate predicate;
+    TreasureStore store;
+    TreasureColumns columns;
+    if (!open_columns(hunt_id, argc, argv, &predicate, &store, &columns))
+    {
+        return;
+    }
+
+    uint32_t *rows = malloc((columns.count + 1) * sizeof(uint32_t));
+    if (rows == NULL)
+    {
+        perror("Failed to allocate memory");
+        columns_free(&columns);
+        store_close(&store);
+        return;
+    }
+
+    size_t matches = columns_filter(&columns, &predicate, rows);
+    printf("-----------------------------------------\n");
+    for (size_t i = 0; i < matches; i++)
+    {
+        TreasureRecord record;
+        long slot = columns.slot[rows[i]];
+        if (store_read_record(&store, slot, &record))
+        {
+            print_match(&record, slot, &store);
+        }
+    }
+    printf("Treasures matching filter: %zu of %zu (%s kernel)\n", matches, columns.count, columns_kernel_name());
+    print_summary((long)matches, "total", (long)columns.count);
+
+    free(rows);
+    columns_free(&columns);
+    store_close(&store);
+
+    char description[128];
+    describe_query("filter", argc, argv, description, sizeof(description));
+    log_event(hunt_id, LOG_OP_QUERY, description, NULL, (long)matches, 0);
+}
+
+void query_stats(const char *hunt_id, int argc, char *const *argv)
+{
+    ColumnPredicate predicate;
+    TreasureStore store;
+    TreasureColumns columns;
+    if (!open_columns(hunt_id, argc, argv, &predicate, &store, &columns))
+    {
+        return;
+    }
+
+    ColumnStats stats;
+    columns_stats(&columns, &predicate, &stats);
+    printf("Hunt: %s (%s kernel)\n", hunt_id, columns_kernel_name());
+    printf("Matched: %ld of %zu\n", stats.count, columns.count);
+    if (stats.count > 0)
+    {
+        printf("Sum: %lld\n", (long long)stats.sum);
+        printf("Min: %d\n", stats.min);
+        printf("Max: %d\n", stats.max);
+        printf("Average: %.2f\n", (double)stats.sum / (double)stats.count);
+    }
+    if (structured())
+    {
+        format_object(&output_writer, "stats");
+        format_string(&output_writer, "hunt", hunt_id, MAX_PATH_LENGTH);
+        format_int(&output_writer, "matched", stats.count);
+        format_int(&output_writer, "total", (long long)columns.count);
+        if (stats.count > 0)
+        {
+            format_int(&output_writer, "sum", stats.sum);
+            format_int(&output_writer, "min", stats.min);
+            format_int(&output_writer, "max", stats.max);
+            format_double(&output_writer, "average", (double)stats.sum / (double)stats.count);
+        }
+        format_end_object(&output_writer);
+    }
+
+    columns_free(&columns);
+    store_close(&store);
+
+    char description[128];
+    describe_query("stats", argc, argv, description, sizeof(description));
+    log_event(hunt_id, LOG_OP_QUERY, description, NULL, stats.count, 0);
+}
+
+/*
+ * Prints the treasures of one hunt whose clue holds every term, best match
+ * first, at most *room of them (which is reduced by the number printed).
+ * Returns the number of matches, or -1 if the hunt cannot be searched.
+ */
+static long search_hunt(const char *hunt_id, int argc, char *const *terms, long *room)
+{
+    TreasureStore store;
+    TreasureFts fts;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    if (!store_load_users(&store) || !treasure_fts_open(&fts, &store, 0))
+    {
+        printf("Error: Could not open the clue index for hunt '%s'\n", hunt_id);
+        store_close(&store);
+        return -1;
+    }
+
+    FtsMatch *matches;
+    long count = treasure_fts_search(&fts, argc, terms, &matches);
+    if (count < 0)
+    {
+        printf("Error: Not enough memory to search hunt '%s'\n", hunt_id);
+    }
+    for (long i = 0; i < count && *room > 0; i++)
+    {
+        Treasure treasure;
+        if (!store_read_treasure(&store, matches[i].slot, &treasure))
+        {
+            continue;
+        }
+        (*room)--;
+        if (structured())
+        {
+            format_object(&output_writer, "treasure");
+            format_string(&output_writer, "hunt", hunt_id, MAX_PATH_LENGTH);
+            format_string(&output_writer, "id", treasure.id, MAX_ID_LENGTH);
+            format_string(&output_writer, "user", treasure.username, MAX_USERNAME_LENGTH);
+            format_int(&output_writer, "value", treasure.value);
+            format_int(&output_writer, "matches", matches[i].score);
+            format_string(&output_writer, "clue", treasure.clue, MAX_CLUE_LENGTH);
+            format_end_object(&output_writer);
+        }
+        else
+        {
+            printf("Hunt: %s\n", hunt_id);
+            printf("ID: %s\n", treasure.id);
+            printf("User: %s\n", treasure.username);
+            printf("Clue: %s\n", treasure.clue);
+            printf("Value: %d\n", treasure.value);
+            printf("Term matches: %u\n", matches[i].score);
+            printf("-----------------------------------------\n");
+        }
+    }
+    free(matches);
+    treasure_fts_close(&fts);
+    store_close(&store);
+
+    char description[128];
+    describe_query("search", argc, terms, description, sizeof(description));
+    log_event(hunt_id, LOG_OP_QUERY, description, NULL, count < 0 ? 0 : count, 0);
+    return count;
+}
+
+/* Reports how many treasures matched and, when the limit cut the listing short, how many were printed. */
+static void print_search_summary(long total, long shown, int hunt_count)
+{
+    if (shown < total)
+        printf("Showing %ld of them (use limit=N to see more)\n", shown);
+    if (structured())
+    {
+        format_object(&output_writer, "summary");
+        format_int(&output_writer, "count", total);
+        format_int(&output_writer, "shown", shown);
+        if (hunt_count >= 0)
+            format_int(&output_writer, "hunts", hunt_count);
+        format_end_object(&output_writer);
+    }
+}
+
+/* Searches one hunt, or every hunt for "all", where at most FTS_ALL_LIMIT matches are printed unless limit=N says otherwise. */
+void search_treasures(const char *target, int argc, char **terms)
+{
+    int all = strcmp(target, "all") == 0;
+    long limit = all ? FTS_ALL_LIMIT : LONG_MAX;
+    if (!fts_take_limit(&argc, terms, &limit) || argc == 0)
+    {
+        printf("Usage: treasure_manager --search <hunt_id|all> <term> [term...] [limit=N]\n");
+        return;
+    }
+
+    printf("-----------------------------------------\n");
+    long room = limit;
+    if (!all)
+    {
+        long count = search_hunt(target, argc, terms, &room);
+        if (count >= 0)
+        {
+            printf("Treasures matching search: %ld\n", count);
+            print_search_summary(count, limit - room, -1);
+        }
+        return;
+    }
+
+    char (*hunts)[MAX_PATH_LENGTH];
+    int hunt_count = catalog_list_hunts(&hunts);
+    if (hunt_count < 0)
+    {
+        perror("Failed to open current directory to list hunts");
+        return;
+    }
+
+    long total = 0;
+    for (int i = 0; i < hunt_count; i++)
+    {
+        long count = search_hunt(hunts[i], argc, terms, &room);
+        if (count > 0)
+            total += count;
+    }
+    free(hunts);
+    printf("Treasures matching search: %ld in %d hunts\n", total, hunt_count);
+    print_search_summary(total, limit - room, hunt_count);
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include <string.h>
+#include "treasure_metrics.h"
+
+static unsigned bucket_index(uint64_t value)
+{
+    if (value < METRICS_SUB_BUCKETS)
+        return (unsigned)value;
+    unsigned shift = 63 - (unsigned)__builtin_clzll(value) - METRICS_SUB_BUCKET_BITS;
+    return (shift + 1) * METRICS_SUB_BUCKETS + (unsigned)((value >> shift) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/* Largest value that lands in bucket index. */
+static uint64_t bucket_limit(unsigned index)
+{
+    if (index < METRICS_SUB_BUCKETS)
+        return index;
+    unsigned shift = index / METRICS_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(METRICS_SUB_BUCKETS + index % METRICS_SUB_BUCKETS) << shift;
+    return lower + (((uint64_t)1 << shift) - 1);
+}
+
+void histogram_reset(LatencyHistogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+void histogram_record(LatencyHistogram *histogram, uint64_t value)
+{
+    histogram->buckets[bucket_index(value)]++;
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max)
+        histogram->max = value;
+}
+
+/* Returns the value below which percentile (0-100) of the recorded values fall. */
+uint64_t histogram_percentile(const LatencyHistogram *histogram, double percentile)
+{
+    if (histogram->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < METRICS_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t limit = bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
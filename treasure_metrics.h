@@ -0,0 +1,30 @@
+#ifndef TREASURE_METRICS_H
+#define TREASURE_METRICS_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram: values below
+ * METRICS_SUB_BUCKETS get a bucket each, and every power of two above that
+ * is split into METRICS_SUB_BUCKETS equal buckets, so any recorded value is
+ * reported within 1/16 of its true size. Recording is a count-leading-zeros
+ * and an increment.
+ */
+
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[METRICS_BUCKETS];
+} LatencyHistogram;
+
+void histogram_reset(LatencyHistogram *histogram);
+void histogram_record(LatencyHistogram *histogram, uint64_t value);
+uint64_t histogram_percentile(const LatencyHistogram *histogram, double percentile);
+
+#endif
@@ -1,333 +1,1475 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
-#include <dirent.h>
 #include <errno.h>
+#include <time.h>
+#include <math.h>
+#include "treasure.h"
+#include "treasure_store.h"
+#include "treasure_index.h"
+#include "treasure_geo.h"
+#include "treasure_columns.h"
+#include "treasure_fts.h"
+#include "treasure_catalog.h"
+#include "treasure_format.h"
+#include "treasure_protocol.h"
+#include "treasure_metrics.h"
 
-#define MAX_CMD_LENGTH 256
-#define MAX_PATH_LENGTH 512
-#define COMMAND_FILE "command.tmp"
-#define ARGS_FILE "args.tmp"
-#define TREASURE_FILE "treasures.dat"
-#define END_OF_MONITOR_OUTPUT "---END_OF_MONITOR_OUTPUT---"
 #define MONITOR_STOP_DELAY 10
+#define MONITOR_MAX_EVENTS 16
+#define MONITOR_COMMAND_SLOTS 16
+#define MONITOR_WORKERS 4
+#define MONITOR_MAX_CLIENTS 64
+#define RESPONSE_BATCH_CHUNKS 16
+#define RESPONSE_LINE_RESERVE 1024
+#define RECORDS_PER_CHUNK (FRAME_CHUNK_SIZE / sizeof(TreasureRecord))
 
-volatile sig_atomic_t should_stop = 0;
-volatile sig_atomic_t command_received = 0;
-int output_pipe_fd = -1;
+/*
+ * The main thread only multiplexes: it accepts hubs on the monitor socket,
+ * reads request frames and queues them on their client. A client with
+ * pending requests sits on the ready queue until a worker takes it, runs
+ * its oldest request and puts it back at the tail if more are waiting. So
+ * each hub gets its answers in order on its own stream, while a long
+ * listing for one hub occupies one worker and the others keep serving.
+ */
+typedef struct PendingRequest
+{
+    struct PendingRequest *next;
+    FrameHeader header;
+    char payload[];
+} PendingRequest;
+
+/* One request/response channel: the hub's pipe pair or an accepted socket. */
+typedef struct MonitorClient
+{
+    int in_fd;
+    int out_fd;
+    FrameReader reader;
+    PendingRequest *pending_head;
+    PendingRequest *pending_tail;
+    int busy;   /* queued for or held by a worker */
+    int closed; /* hung up; freed by whoever drops it last */
+    pthread_mutex_t write_lock;
+    struct MonitorClient *next_ready;
+} MonitorClient;
+
+int should_stop = 0;
+int epoll_fd = -1;
+int signal_fd = -1;
+int stop_timer_fd = -1;
+int listen_fd = -1;
+const char *socket_path = NULL;
+
+MonitorClient *hub_client = NULL;
+MonitorClient *clients[MONITOR_MAX_CLIENTS];
+int client_count = 0;
+
+pthread_t workers[MONITOR_WORKERS];
+int worker_count = 0;
+int workers_stopping = 0;
+pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+MonitorClient *ready_head = NULL;
+MonitorClient *ready_tail = NULL;
+
+/*
+ * Response state belongs to the worker running the request. Output is
+ * formatted into a batch of chunk buffers and the whole batch goes out as
+ * one writev() of frames once it fills or the response ends.
+ */
+__thread MonitorClient *current_client = NULL;
+__thread uint32_t current_request_id = 0;
+__thread char response_chunks[RESPONSE_BATCH_CHUNKS][FRAME_CHUNK_SIZE];
+__thread size_t response_lengths[RESPONSE_BATCH_CHUNKS];
+__thread int response_chunk = 0;
+__thread size_t response_used = 0;
+
+/* Requests that ask for json, ndjson or binary get objects from this writer; plain text is left out. */
+__thread OutputFormat response_format = OUTPUT_TEXT;
+__thread FormatWriter response_writer;
+
+/* Per request type counters behind the stats command; indexed by FrameType. */
+typedef struct
+{
+    uint64_t bytes_out;
+    uint64_t file_bytes;
+    LatencyHistogram latency_ns;
+} CommandStats;
+
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+CommandStats command_stats[MONITOR_COMMAND_SLOTS];
+time_t stats_since = 0;
+__thread uint64_t bytes_sent = 0;
+__thread uint64_t file_bytes_read = 0;
+
+const char *command_names[MONITOR_COMMAND_SLOTS] = {
+    [FRAME_LIST_HUNTS] = "list_hunts",
+    [FRAME_LIST_TREASURES] = "list_treasures",
+    [FRAME_VIEW_TREASURE] = "view_treasure",
+    [FRAME_NEAR_TREASURES] = "near_treasures",
+    [FRAME_BBOX_TREASURES] = "bbox_treasures",
+    [FRAME_FILTER_TREASURES] = "filter_treasures",
+    [FRAME_TREASURE_STATS] = "treasure_stats",
+    [FRAME_SEARCH_TREASURES] = "search_treasures",
+    [FRAME_MONITOR_STATS] = "stats",
+    [FRAME_LIST_RECORDS] = "list_records",
+};
+
+int watch_fd(int fd)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        perror("Failed to watch descriptor");
+        return 0;
+    }
+    return 1;
+}
 
-void command_handler(int sig)
+/* Routes the monitor's signals through a descriptor so none can slip in between loop iterations. */
+int setup_signal_fd()
 {
-    command_received = 1;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+    {
+        perror("Failed to block monitor signals");
+        return 0;
+    }
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1)
+    {
+        perror("Failed to create signalfd");
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return watch_fd(signal_fd);
 }
 
-void stop_handler(int sig)
+MonitorClient *new_client(int in_fd, int out_fd)
 {
-    char stop_msg[256];
-    snprintf(stop_msg, sizeof(stop_msg),
-             "Monitor received stop signal, delaying exit for %d seconds...\n",
-             MONITOR_STOP_DELAY);
-    write(output_pipe_fd, stop_msg, strlen(stop_msg));
-    write(output_pipe_fd, END_OF_MONITOR_OUTPUT, strlen(END_OF_MONITOR_OUTPUT));
+    MonitorClient *client = calloc(1, sizeof(MonitorClient));
+    if (client == NULL)
+    {
+        return NULL;
+    }
+    client->in_fd = in_fd;
+    client->out_fd = out_fd;
+    frame_reader_init(&client->reader);
+    pthread_mutex_init(&client->write_lock, NULL);
+    return client;
+}
+
+void free_client(MonitorClient *client)
+{
+    while (client->pending_head != NULL)
+    {
+        PendingRequest *request = client->pending_head;
+        client->pending_head = request->next;
+        free(request);
+    }
+    if (client->out_fd != client->in_fd)
+        close(client->out_fd);
+    close(client->in_fd);
+    frame_reader_free(&client->reader);
+    pthread_mutex_destroy(&client->write_lock);
+    free(client);
+}
+
+/* Whole frames only: workers and notices may write to the same client. */
+int client_write(MonitorClient *client, uint16_t type, uint16_t flags, uint32_t request_id, const void *data,
+                 size_t length)
+{
+    pthread_mutex_lock(&client->write_lock);
+    int ok = frame_write(client->out_fd, type, flags, request_id, data, length);
+    pthread_mutex_unlock(&client->write_lock);
+    return ok;
+}
+
+/* Sends every chunk of the batch; all but the last carry FRAME_FLAG_MORE and the last carries flags. */
+void flush_response(uint16_t flags)
+{
+    response_lengths[response_chunk] = response_used;
+    int count = response_chunk + 1;
+    if (current_client != NULL)
+    {
+        FrameHeader headers[RESPONSE_BATCH_CHUNKS];
+        struct iovec iov[RESPONSE_BATCH_CHUNKS * 2];
+        int iovcnt = 0;
+        for (int i = 0; i < count; i++)
+        {
+            headers[i].length = (uint32_t)response_lengths[i];
+            headers[i].request_id = current_request_id;
+            headers[i].type = FRAME_RESPONSE;
+            headers[i].flags = i + 1 < count ? FRAME_FLAG_MORE : flags;
+            iov[iovcnt].iov_base = &headers[i];
+            iov[iovcnt++].iov_len = sizeof(FrameHeader);
+            if (response_lengths[i] > 0)
+            {
+                iov[iovcnt].iov_base = response_chunks[i];
+                iov[iovcnt++].iov_len = response_lengths[i];
+            }
+            bytes_sent += sizeof(FrameHeader) + response_lengths[i];
+        }
+
+        pthread_mutex_lock(&current_client->write_lock);
+        frame_writev(current_client->out_fd, iov, iovcnt);
+        pthread_mutex_unlock(&current_client->write_lock);
+    }
+    response_chunk = 0;
+    response_used = 0;
+}
+
+/* Closes the current chunk and moves on to the next, sending the batch when it is full. */
+void next_chunk()
+{
+    if (response_chunk + 1 == RESPONSE_BATCH_CHUNKS)
+    {
+        flush_response(FRAME_FLAG_MORE);
+        return;
+    }
+    response_lengths[response_chunk++] = response_used;
+    response_used = 0;
+}
 
-    sleep(MONITOR_STOP_DELAY);
-    should_stop = 1;
+/* Room for at least size bytes at the end of the current chunk (size must not exceed a chunk). */
+char *reserve_output(size_t size)
+{
+    if (FRAME_CHUNK_SIZE - response_used < size)
+    {
+        next_chunk();
+    }
+    return response_chunks[response_chunk] + response_used;
 }
 
-void setup_signal_handlers()
+static int structured()
 {
-    struct sigaction sa_cmd, sa_stop;
+    return response_format != OUTPUT_TEXT;
+}
 
-    memset(&sa_cmd, 0, sizeof(sa_cmd));
-    sa_cmd.sa_handler = command_handler;
-    sa_cmd.sa_flags = SA_RESTART;
-    sigaction(SIGUSR1, &sa_cmd, NULL);
+void append_output(const char *message, size_t len)
+{
+    while (len > 0)
+    {
+        if (response_used == FRAME_CHUNK_SIZE)
+        {
+            next_chunk();
+        }
+        size_t n = FRAME_CHUNK_SIZE - response_used;
+        if (n > len)
+            n = len;
+        memcpy(response_chunks[response_chunk] + response_used, message, n);
+        response_used += n;
+        message += n;
+        len -= n;
+    }
+}
 
-    memset(&sa_stop, 0, sizeof(sa_stop));
-    sa_stop.sa_handler = stop_handler;
-    sa_stop.sa_flags = 0;
-    sigaction(SIGUSR2, &sa_stop, NULL);
+static void writer_sink(void *context, const char *data, size_t length)
+{
+    (void)context;
+    append_output(data, length);
 }
 
 void send_output(const char *message)
 {
-    if (output_pipe_fd != -1)
+    if (!structured())
+        append_output(message, strlen(message));
+}
+
+/* Formats straight into the response chunk, starting a new chunk when the line does not fit. */
+void send_format(const char *format, ...)
+{
+    if (structured())
+    {
+        return;
+    }
+
+    va_list args;
+    for (int attempt = 0; attempt < 2; attempt++)
     {
-        write(output_pipe_fd, message, strlen(message));
+        size_t room = FRAME_CHUNK_SIZE - response_used;
+        va_start(args, format);
+        int n = vsnprintf(response_chunks[response_chunk] + response_used, room, format, args);
+        va_end(args);
+        if (n < 0)
+        {
+            return;
+        }
+        if ((size_t)n < room)
+        {
+            response_used += (size_t)n;
+            return;
+        }
+        if (response_used == 0)
+        {
+            response_used = room - 1;
+            return;
+        }
+        next_chunk();
     }
 }
 
-void send_end_marker()
+/* Text as is, or an error object in the structured formats. */
+void send_error(const char *format, ...)
 {
-    if (output_pipe_fd != -1)
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (!structured())
     {
-        write(output_pipe_fd, END_OF_MONITOR_OUTPUT, strlen(END_OF_MONITOR_OUTPUT));
+        append_output(message, strlen(message));
+        return;
     }
+    message[strcspn(message, "\n")] = '\0';
+    format_error(&response_writer, strncmp(message, "Error: ", 7) == 0 ? message + 7 : message);
 }
 
-void list_hunts()
+/* The closing count of a listing; extra_key names an optional second number. */
+void send_summary(long count, const char *extra_key, long extra)
+{
+    if (structured())
+    {
+        format_object(&response_writer, "summary");
+        format_int(&response_writer, "count", count);
+        if (extra_key != NULL)
+            format_int(&response_writer, extra_key, extra);
+        format_end_object(&response_writer);
+    }
+}
+
+void finish_response()
 {
-    DIR *dir;
-    struct dirent *entry;
-    char output[4096];
-    int hunt_count = 0;
+    if (structured())
+    {
+        format_finish(&response_writer);
+    }
+    flush_response(0);
+}
+
+static char *put_text(char *out, const char *text, size_t max)
+{
+    size_t len = strnlen(text, max);
+    memcpy(out, text, len);
+    return out + len;
+}
 
-    dir = opendir(".");
-    if (dir == NULL)
+/*
+ * Writes one "ID: ..., User: ..., Location: (...), Value: ..." line for a
+ * record, followed by its clue when clue is not NULL. This is the listing
+ * hot path, so it avoids printf unless a coordinate is out of range.
+ */
+void send_record(TreasureStore *store, const TreasureRecord *record, const char *clue)
+{
+    const char *user = store_username(store, record->user);
+    if (structured())
     {
-        send_output("Error: Could not open current directory\n");
-        send_end_marker();
+        format_treasure(&response_writer, record->id, user, record->latitude, record->longitude, record->value, clue);
+        return;
+    }
+    if (!(fabs(record->latitude) < 1e6 && fabs(record->longitude) < 1e6))
+    {
+        if (clue != NULL)
+            send_format("ID: %.*s, User: %s, Location: (%.6f, %.6f), Value: %d, Clue: %s\n", MAX_ID_LENGTH,
+                        record->id, user, record->latitude, record->longitude, record->value, clue);
+        else
+            send_format("ID: %.*s, User: %s, Location: (%.6f, %.6f), Value: %d\n", MAX_ID_LENGTH, record->id, user,
+                        record->latitude, record->longitude, record->value);
         return;
     }
 
-    send_output("Available hunts:\n");
+    char *start = reserve_output(RESPONSE_LINE_RESERVE);
+    char *out = start;
+    out = put_text(out, "ID: ", 4);
+    out = put_text(out, record->id, MAX_ID_LENGTH);
+    out = put_text(out, ", User: ", 8);
+    out = put_text(out, user, MAX_USERNAME_LENGTH);
+    out = put_text(out, ", Location: (", 13);
+    out = format_put_fixed6(out, record->latitude);
+    out = put_text(out, ", ", 2);
+    out = format_put_fixed6(out, record->longitude);
+    out = put_text(out, "), Value: ", 10);
+    out = format_put_int(out, record->value);
+    if (clue != NULL)
+    {
+        out = put_text(out, ", Clue: ", 8);
+        out = put_text(out, clue, MAX_CLUE_LENGTH);
+    }
+    *out++ = '\n';
+    response_used += (size_t)(out - start);
+}
 
-    while ((entry = readdir(dir)) != NULL)
+/* Notices go to every connected hub; only the main thread sends them. */
+void send_notice(const char *message)
+{
+    for (int i = 0; i < client_count; i++)
     {
-        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
-        {
-            char treasure_path[MAX_PATH_LENGTH];
-            snprintf(treasure_path, sizeof(treasure_path), "%s/%s", entry->d_name, TREASURE_FILE);
+        client_write(clients[i], FRAME_NOTICE, 0, 0, message, strlen(message));
+    }
+}
 
-            if (access(treasure_path, F_OK) == 0)
-            {
-                int fd = open(treasure_path, O_RDONLY);
-                int treasure_count = 0;
-                if (fd != -1)
-                {
-                    struct stat st;
-                    if (fstat(fd, &st) == 0)
-                    {
-                        treasure_count = st.st_size / sizeof(struct {
-                                             char id[32];
-                                             char username[64];
-                                             double latitude;
-                                             double longitude;
-                                             char clue[256];
-                                             int value;
-                                         });
-                    }
-                    close(fd);
-                }
+/* Closes a store after adding what was read through it to the stats. */
+void close_store(TreasureStore *store)
+{
+    file_bytes_read += store->bytes_read;
+    store_close(store);
+}
 
-                snprintf(output, sizeof(output), "Hunt: %s (Treasures: %d)\n",
-                         entry->d_name, treasure_count);
-                send_output(output);
-                hunt_count++;
-            }
+void list_hunts()
+{
+    CatalogEntry *entries;
+    int hunt_count = catalog_load(&entries);
+    if (hunt_count < 0)
+    {
+        send_error("Error: Could not open current directory\n");
+        finish_response();
+        return;
+    }
+
+    send_output("Available hunts:\n");
+    for (int i = 0; i < hunt_count; i++)
+    {
+        if (structured())
+        {
+            format_object(&response_writer, "hunt");
+            format_string(&response_writer, "name", entries[i].name, CATALOG_NAME_LENGTH);
+            format_int(&response_writer, "treasures", (long long)entries[i].records);
+            format_int(&response_writer, "total_value", entries[i].total_value);
+            format_int(&response_writer, "bytes", (long long)entries[i].bytes);
+            format_int(&response_writer, "modified", entries[i].mtime_sec);
+            format_end_object(&response_writer);
         }
+        send_format("Hunt: %s (Treasures: %d)\n", entries[i].name, (int)entries[i].records);
     }
-    closedir(dir);
+    free(entries);
 
     if (hunt_count == 0)
     {
         send_output("No hunts found.\n");
     }
 
-    send_end_marker();
+    finish_response();
 }
 
 void list_treasures(const char *hunt_id)
 {
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, sizeof(treasure_path), "%s/%s", hunt_id, TREASURE_FILE);
-
-    int fd = open(treasure_path, O_RDONLY);
-    if (fd == -1)
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 0))
     {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "Error: Could not open treasure file for hunt '%s'\n", hunt_id);
-        send_output(error_msg);
-        send_end_marker();
+        send_error("Error: Could not open treasure file for hunt '%s'\n", hunt_id);
+        finish_response();
         return;
     }
 
-    typedef struct
-    {
-        char id[32];
-        char username[64];
-        double latitude;
-        double longitude;
-        char clue[256];
-        int value;
-    } Treasure;
-
-    Treasure treasure;
-    char output[1024];
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    char clue[MAX_CLUE_LENGTH];
     int treasure_count = 0;
 
-    snprintf(output, sizeof(output), "Treasures in hunt '%s':\n", hunt_id);
-    send_output(output);
+    send_format("Treasures in hunt '%s':\n", hunt_id);
 
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    store_load_users(&store);
+    store_cursor_open(&cursor, &store);
+    while ((record = store_cursor_next(&cursor)) != NULL)
     {
-        snprintf(output, sizeof(output),
-                 "ID: %s, User: %s, Location: (%.6f, %.6f), Value: %d, Clue: %s\n",
-                 treasure.id, treasure.username, treasure.latitude, treasure.longitude,
-                 treasure.value, treasure.clue);
-        send_output(output);
+        store_read_clue(&store, record, clue);
+        send_record(&store, record, clue);
         treasure_count++;
     }
 
-    close(fd);
+    close_store(&store);
 
     if (treasure_count == 0)
     {
         send_output("No treasures found in this hunt.\n");
     }
+    send_summary(treasure_count, NULL, 0);
 
-    send_end_marker();
+    finish_response();
 }
 
-void view_treasure(const char *hunt_id, const char *treasure_id)
+static int parse_slot(const char *text, long *out)
 {
-    char treasure_path[MAX_PATH_LENGTH];
-    snprintf(treasure_path, sizeof(treasure_path), "%s/%s", hunt_id, TREASURE_FILE);
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || value < 0)
+    {
+        return 0;
+    }
+    *out = value;
+    return 1;
+}
 
-    int fd = open(treasure_path, O_RDONLY);
-    if (fd == -1)
+/*
+ * Streams record slots [first, first + count) of the hunt's snapshot as raw
+ * TreasureRecords; the range is clipped to the snapshot and defaults to all
+ * of it. Records go from treasures.hot to the client with sendfile(), one
+ * frame of whole records at a time, so nothing is formatted or copied here.
+ */
+void list_records(const char *hunt_id, int argc, char **range)
+{
+    long first = 0, count = -1;
+    if ((argc >= 1 && !parse_slot(range[0], &first)) || (argc >= 2 && !parse_slot(range[1], &count)))
     {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "Error: Could not open treasure file for hunt '%s'\n", hunt_id);
-        send_output(error_msg);
-        send_end_marker();
+        send_error("Error: Invalid record range\n");
+        finish_response();
         return;
     }
 
-    typedef struct
+    TreasureStore store;
+    if (!store_open(&store, hunt_id, 0))
     {
-        char id[32];
-        char username[64];
-        double latitude;
-        double longitude;
-        char clue[256];
-        int value;
-    } Treasure;
+        send_error("Error: Could not open treasure file for hunt '%s'\n", hunt_id);
+        finish_response();
+        return;
+    }
 
-    Treasure treasure;
-    char output[1024];
-    int found = 0;
+    long records = store_record_count(&store);
+    if (first > records)
+        first = records;
+    if (count < 0 || count > records - first)
+        count = records - first;
+
+    RecordRangeHeader range_header;
+    memset(&range_header, 0, sizeof(range_header));
+    range_header.magic = RECORD_RANGE_MAGIC;
+    range_header.record_size = sizeof(TreasureRecord);
+    range_header.first_slot = (uint64_t)first;
+    range_header.record_count = (uint64_t)count;
+    range_header.generation = store.generation;
+    memcpy(reserve_output(sizeof(range_header)), &range_header, sizeof(range_header));
+    response_used += sizeof(range_header);
+    flush_response(count > 0 ? FRAME_FLAG_MORE : 0);
 
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    long slot = first, end = first + count;
+    if (store.segment != NULL && count > 0)
     {
-        if (strcmp(treasure.id, treasure_id) == 0)
+        /* An archived hunt has no file of raw records to send from, so its decoded blocks are copied out. */
+        while (slot < end)
         {
-            snprintf(output, sizeof(output),
-                     "Treasure Details:\nID: %s\nUser: %s\nLocation: (%.6f, %.6f)\nValue: %d\nClue: %s\n",
-                     treasure.id, treasure.username, treasure.latitude, treasure.longitude,
-                     treasure.value, treasure.clue);
-            send_output(output);
-            found = 1;
+            long batch = end - slot < (long)RECORDS_PER_CHUNK ? end - slot : (long)RECORDS_PER_CHUNK;
+            char *out = reserve_output((size_t)batch * sizeof(TreasureRecord));
+            long copied = 0;
+            TreasureRecord record;
+            while (copied < batch && store_read_record(&store, slot + copied, &record))
+            {
+                memcpy(out + copied * sizeof(TreasureRecord), &record, sizeof(record));
+                copied++;
+            }
+            response_used += (size_t)copied * sizeof(TreasureRecord);
+            slot += copied;
+            if (copied < batch)
+                break;
+        }
+        flush_response(0);
+        slot = end;
+    }
+    while (slot < end && current_client != NULL)
+    {
+        long batch = end - slot < (long)RECORDS_PER_CHUNK ? end - slot : (long)RECORDS_PER_CHUNK;
+        size_t length = (size_t)batch * sizeof(TreasureRecord);
+        pthread_mutex_lock(&current_client->write_lock);
+        int ok = frame_send_file(current_client->out_fd, FRAME_RESPONSE, slot + batch < end ? FRAME_FLAG_MORE : 0,
+                                 current_request_id, store.hot_fd, (off_t)store_record_offset(slot), length);
+        pthread_mutex_unlock(&current_client->write_lock);
+        if (!ok)
             break;
+        bytes_sent += sizeof(FrameHeader) + length;
+        store.bytes_read += length;
+        slot += batch;
+    }
+
+    close_store(&store);
+}
+
+void view_treasure(const char *hunt_id, const char *treasure_id)
+{
+    TreasureStore store;
+    TreasureIndex index;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        send_error("Error: Could not open treasure file for hunt '%s'\n", hunt_id);
+        finish_response();
+        return;
+    }
+    if (!treasure_index_open(&index, &store, 0))
+    {
+        send_error("Error: Could not open the ID index for hunt '%s'\n", hunt_id);
+        finish_response();
+        close_store(&store);
+        return;
+    }
+
+    Treasure treasure;
+    long slot = treasure_index_find(&index, treasure_id, NULL);
+    int found = slot != -1 && store_read_treasure(&store, slot, &treasure);
+    treasure_index_close(&index);
+    close_store(&store);
+
+    if (found && structured())
+    {
+        format_treasure(&response_writer, treasure.id, treasure.username, treasure.latitude, treasure.longitude,
+                        treasure.value, treasure.clue);
+    }
+    else if (found)
+    {
+        send_format("Treasure Details:\nID: %s\nUser: %s\nLocation: (%.6f, %.6f)\nValue: %d\nClue: %s\n",
+                    treasure.id, treasure.username, treasure.latitude, treasure.longitude,
+                    treasure.value, treasure.clue);
+    }
+    else
+    {
+        send_error("Treasure with ID '%s' not found in hunt '%s'\n", treasure_id, hunt_id);
+    }
+
+    finish_response();
+}
+
+int send_match(const TreasureRecord *record, long slot, void *context)
+{
+    (void)slot;
+    send_record(context, record, NULL);
+    return 1;
+}
+
+/* Answers near (lat, lon, radius) and bbox (min lat/lon, max lat/lon) queries from the hunt's spatial grid. */
+void spatial_query(const char *hunt_id, int near, char **numbers)
+{
+    double values[4];
+    int fields = near ? 3 : 4;
+    for (int i = 0; i < fields; i++)
+    {
+        char *end;
+        values[i] = strtod(numbers[i], &end);
+        if (end == numbers[i] || *end != '\0')
+        {
+            send_error("Error: Invalid number '%s'\n", numbers[i]);
+            finish_response();
+            return;
         }
     }
 
-    close(fd);
+    TreasureStore store;
+    TreasureGeo geo;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        send_error("Error: Could not open treasure file for hunt '%s'\n", hunt_id);
+        finish_response();
+        return;
+    }
+    if (!store_load_users(&store))
+    {
+        send_error("Error: Could not load treasures for hunt '%s'\n", hunt_id);
+        finish_response();
+        close_store(&store);
+        return;
+    }
+    if (!treasure_geo_open(&geo, &store, 0))
+    {
+        send_error("Error: Could not open the spatial index for hunt '%s'\n", hunt_id);
+        finish_response();
+        close_store(&store);
+        return;
+    }
 
-    if (!found)
+    long matches;
+    if (near)
     {
-        snprintf(output, sizeof(output), "Treasure with ID '%s' not found in hunt '%s'\n", treasure_id, hunt_id);
-        send_output(output);
+        send_format("Treasures in hunt '%s' within %.0f m of (%.6f, %.6f):\n", hunt_id, values[2], values[0], values[1]);
+        matches = treasure_geo_near(&geo, values[0], values[1], values[2], send_match, &store);
     }
+    else
+    {
+        send_format("Treasures in hunt '%s' inside (%.6f, %.6f) - (%.6f, %.6f):\n",
+                    hunt_id, values[0], values[1], values[2], values[3]);
+        matches = treasure_geo_bbox(&geo, values[0], values[1], values[2], values[3], send_match, &store);
+    }
+    treasure_geo_close(&geo);
+    close_store(&store);
 
-    send_end_marker();
+    send_format("%ld treasures matched.\n", matches);
+    send_summary(matches, NULL, 0);
+    finish_response();
 }
 
-void process_command()
+/* Answers filter and stats requests with a column scan of the hunt; args are columns_parse_predicate() tokens. */
+void column_query(const char *hunt_id, int stats_only, int argc, char **args)
 {
-    char command[MAX_CMD_LENGTH] = {0};
-    char args[MAX_CMD_LENGTH * 2] = {0};
+    ColumnPredicate predicate;
+    if (!columns_parse_predicate(&predicate, argc, args))
+    {
+        send_error("Error: Invalid filter, expected value=MIN:MAX and/or box=MIN_LAT,MIN_LON,MAX_LAT,MAX_LON\n");
+        finish_response();
+        return;
+    }
 
-    int cmd_fd = open(COMMAND_FILE, O_RDONLY);
-    if (cmd_fd != -1)
+    TreasureStore store;
+    TreasureColumns columns;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        send_error("Error: Could not open treasure file for hunt '%s'\n", hunt_id);
+        finish_response();
+        return;
+    }
+    if (!store_load_users(&store))
+    {
+        send_error("Error: Could not load treasures for hunt '%s'\n", hunt_id);
+        finish_response();
+        close_store(&store);
+        return;
+    }
+    if (!columns_load(&columns, &store))
     {
-        read(cmd_fd, command, sizeof(command) - 1);
-        close(cmd_fd);
+        send_error("Error: Could not load treasures for hunt '%s'\n", hunt_id);
+        finish_response();
+        close_store(&store);
+        return;
     }
 
-    int args_fd = open(ARGS_FILE, O_RDONLY);
-    if (args_fd != -1)
+    if (stats_only)
     {
-        read(args_fd, args, sizeof(args) - 1);
-        close(args_fd);
+        ColumnStats stats;
+        columns_stats(&columns, &predicate, &stats);
+        if (structured())
+        {
+            format_object(&response_writer, "stats");
+            format_string(&response_writer, "hunt", hunt_id, MAX_PATH_LENGTH);
+            format_int(&response_writer, "matched", stats.count);
+            format_int(&response_writer, "total", (long long)columns.count);
+            if (stats.count > 0)
+            {
+                format_int(&response_writer, "sum", stats.sum);
+                format_int(&response_writer, "min", stats.min);
+                format_int(&response_writer, "max", stats.max);
+                format_double(&response_writer, "average", (double)stats.sum / (double)stats.count);
+            }
+            format_end_object(&response_writer);
+        }
+        send_format("Hunt '%s': %ld of %zu treasures matched", hunt_id, stats.count, columns.count);
+        if (stats.count > 0)
+        {
+            send_format(", sum %lld, min %d, max %d, average %.2f", (long long)stats.sum, stats.min, stats.max,
+                        (double)stats.sum / (double)stats.count);
+        }
+        send_format(".\n");
+    }
+    else
+    {
+        uint32_t *rows = malloc((columns.count + 1) * sizeof(uint32_t));
+        if (rows == NULL)
+        {
+            send_error("Error: Out of memory\n");
+        }
+        else
+        {
+            size_t matches = columns_filter(&columns, &predicate, rows);
+            send_format("Treasures in hunt '%s' matching the filter:\n", hunt_id);
+            for (size_t i = 0; i < matches; i++)
+            {
+                TreasureRecord record;
+                long slot = columns.slot[rows[i]];
+                if (store_read_record(&store, slot, &record))
+                    send_match(&record, slot, &store);
+            }
+            send_format("%zu treasures matched.\n", matches);
+            send_summary((long)matches, "total", (long)columns.count);
+            free(rows);
+        }
     }
 
-    if (strcmp(command, "list_hunts") == 0)
+    columns_free(&columns);
+    close_store(&store);
+    finish_response();
+}
+
+/* Sends one hunt's clue search results, best match first and at most *room of them; returns the number of matches. */
+long search_hunt(const char *hunt_id, int argc, char **terms, long *room)
+{
+    TreasureStore store;
+    TreasureFts fts;
+    if (!store_open(&store, hunt_id, 0))
+    {
+        send_error("Error: Could not open treasure file for hunt '%s'\n", hunt_id);
+        return 0;
+    }
+    if (!store_load_users(&store))
+    {
+        send_error("Error: Could not load treasures for hunt '%s'\n", hunt_id);
+        close_store(&store);
+        return 0;
+    }
+    if (!treasure_fts_open(&fts, &store, 0))
+    {
+        send_error("Error: Could not open the clue index for hunt '%s'\n", hunt_id);
+        close_store(&store);
+        return 0;
+    }
+
+    FtsMatch *matches;
+    long count = treasure_fts_search(&fts, argc, terms, &matches);
+    if (count < 0)
+    {
+        send_error("Error: Out of memory searching hunt '%s'\n", hunt_id);
+    }
+    for (long i = 0; i < count && *room > 0; i++)
+    {
+        Treasure treasure;
+        if (!store_read_treasure(&store, matches[i].slot, &treasure))
+        {
+            continue;
+        }
+        (*room)--;
+        if (structured())
+        {
+            format_object(&response_writer, "treasure");
+            format_string(&response_writer, "hunt", hunt_id, MAX_PATH_LENGTH);
+            format_string(&response_writer, "id", treasure.id, MAX_ID_LENGTH);
+            format_string(&response_writer, "user", treasure.username, MAX_USERNAME_LENGTH);
+            format_int(&response_writer, "value", treasure.value);
+            format_int(&response_writer, "matches", matches[i].score);
+            format_string(&response_writer, "clue", treasure.clue, MAX_CLUE_LENGTH);
+            format_end_object(&response_writer);
+        }
+        send_format("Hunt: %s, ID: %s, User: %s, Value: %d, Matches: %u, Clue: %s\n", hunt_id, treasure.id,
+                    treasure.username, treasure.value, matches[i].score, treasure.clue);
+    }
+    free(matches);
+    treasure_fts_close(&fts);
+    close_store(&store);
+    return count < 0 ? 0 : count;
+}
+
+/* Reports the match count and, when the limit cut the results short, how many were sent. */
+void send_search_summary(long total, long shown, int hunt_count)
+{
+    if (shown < total)
+        send_format("Showing %ld of them (add limit=N to see more).\n", shown);
+    if (structured())
+    {
+        format_object(&response_writer, "summary");
+        format_int(&response_writer, "count", total);
+        format_int(&response_writer, "shown", shown);
+        if (hunt_count >= 0)
+            format_int(&response_writer, "hunts", hunt_count);
+        format_end_object(&response_writer);
+    }
+}
+
+/* Answers a clue search in one hunt, or in every hunt when the target is "all", where FTS_ALL_LIMIT results are sent unless limit=N says otherwise. */
+void search_treasures(const char *target, int argc, char **terms)
+{
+    int all = strcmp(target, "all") == 0;
+    long limit = all ? FTS_ALL_LIMIT : LONG_MAX;
+    if (!fts_take_limit(&argc, terms, &limit) || argc == 0)
+    {
+        send_error("Error: Expected search terms and an optional limit=N with N > 0\n");
+        finish_response();
+        return;
+    }
+
+    long room = limit;
+    if (!all)
+    {
+        long count = search_hunt(target, argc, terms, &room);
+        send_format("%ld treasures matched.\n", count);
+        send_search_summary(count, limit - room, -1);
+        finish_response();
+        return;
+    }
+
+    char (*hunts)[MAX_PATH_LENGTH];
+    int hunt_count = catalog_list_hunts(&hunts);
+    long total = 0;
+    for (int i = 0; i < hunt_count; i++)
+    {
+        total += search_hunt(hunts[i], argc, terms, &room);
+    }
+    if (hunt_count >= 0)
+        free(hunts);
+    send_format("%ld treasures matched in %d hunts.\n", total, hunt_count < 0 ? 0 : hunt_count);
+    send_search_summary(total, limit - room, hunt_count < 0 ? 0 : hunt_count);
+    finish_response();
+}
+
+void reset_stats()
+{
+    pthread_mutex_lock(&stats_lock);
+    memset(command_stats, 0, sizeof(command_stats));
+    stats_since = time(NULL);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Reports request counts, latency percentiles and bytes per command; "reset" starts a new window afterwards. */
+void monitor_stats(int argc, char **args)
+{
+    int reset = argc == 1 && strcmp(args[0], "reset") == 0;
+    if (argc > 1 || (argc == 1 && !reset))
+    {
+        send_error("Usage: stats [reset]\n");
+        finish_response();
+        return;
+    }
+
+    /* Format from a copy so a slow hub does not hold up the other workers' bookkeeping. */
+    CommandStats *snapshot = malloc(sizeof(command_stats));
+    if (snapshot == NULL)
+    {
+        send_error("Error: Out of memory\n");
+        finish_response();
+        return;
+    }
+    pthread_mutex_lock(&stats_lock);
+    memcpy(snapshot, command_stats, sizeof(command_stats));
+    time_t since = stats_since;
+    pthread_mutex_unlock(&stats_lock);
+
+    send_format("Monitor statistics for the last %ld seconds:\n", (long)(time(NULL) - since));
+    send_format("%-18s %10s %10s %10s %10s %14s %14s\n", "Command", "Requests", "p50 us", "p99 us", "max us",
+                "Bytes out", "File bytes");
+    for (int type = 0; type < MONITOR_COMMAND_SLOTS; type++)
+    {
+        const CommandStats *stats = &snapshot[type];
+        if (stats->latency_ns.count == 0)
+            continue;
+        if (structured())
+        {
+            format_object(&response_writer, "command");
+            format_string(&response_writer, "name", command_names[type] != NULL ? command_names[type] : "unknown", 64);
+            format_int(&response_writer, "requests", (long long)stats->latency_ns.count);
+            format_double(&response_writer, "p50_us", histogram_percentile(&stats->latency_ns, 50.0) / 1000.0);
+            format_double(&response_writer, "p99_us", histogram_percentile(&stats->latency_ns, 99.0) / 1000.0);
+            format_double(&response_writer, "max_us", stats->latency_ns.max / 1000.0);
+            format_int(&response_writer, "bytes_out", (long long)stats->bytes_out);
+            format_int(&response_writer, "file_bytes", (long long)stats->file_bytes);
+            format_end_object(&response_writer);
+        }
+        send_format("%-18s %10llu %10.1f %10.1f %10.1f %14llu %14llu\n",
+                    command_names[type] != NULL ? command_names[type] : "unknown",
+                    (unsigned long long)stats->latency_ns.count,
+                    histogram_percentile(&stats->latency_ns, 50.0) / 1000.0,
+                    histogram_percentile(&stats->latency_ns, 99.0) / 1000.0,
+                    stats->latency_ns.max / 1000.0,
+                    (unsigned long long)stats->bytes_out, (unsigned long long)stats->file_bytes);
+    }
+    free(snapshot);
+
+    if (reset)
+    {
+        reset_stats();
+        send_format("Counters reset.\n");
+    }
+    if (structured())
+    {
+        format_object(&response_writer, "summary");
+        format_int(&response_writer, "seconds", (long long)(time(NULL) - since));
+        format_int(&response_writer, "reset", reset);
+        format_end_object(&response_writer);
+    }
+    finish_response();
+}
+
+void dispatch_request(const FrameHeader *header, char *payload)
+{
+    char *args[FRAME_MAX_ARGS];
+    int argc = frame_unpack_args(payload, header->length, args, FRAME_MAX_ARGS);
+
+    current_request_id = header->request_id;
+    response_format = (OutputFormat)(header->flags >> FRAME_FORMAT_SHIFT);
+    if (response_format > OUTPUT_BINARY || header->type == FRAME_LIST_RECORDS)
+    {
+        response_format = OUTPUT_TEXT;
+    }
+    if (structured())
+    {
+        format_begin(&response_writer, response_format, writer_sink, NULL);
+    }
+
+    if (header->type == FRAME_LIST_HUNTS)
     {
         list_hunts();
     }
-    else if (strcmp(command, "list_treasures") == 0)
+    else if (header->type == FRAME_LIST_TREASURES && argc == 1)
+    {
+        list_treasures(args[0]);
+    }
+    else if (header->type == FRAME_VIEW_TREASURE && argc == 2)
     {
-        list_treasures(args);
+        view_treasure(args[0], args[1]);
     }
-    else if (strcmp(command, "view_treasure") == 0)
+    else if (header->type == FRAME_NEAR_TREASURES && argc == 4)
     {
-        char *space = strchr(args, ' ');
-        if (space)
+        spatial_query(args[0], 1, &args[1]);
+    }
+    else if (header->type == FRAME_BBOX_TREASURES && argc == 5)
+    {
+        spatial_query(args[0], 0, &args[1]);
+    }
+    else if ((header->type == FRAME_FILTER_TREASURES || header->type == FRAME_TREASURE_STATS) && argc >= 1)
+    {
+        column_query(args[0], header->type == FRAME_TREASURE_STATS, argc - 1, &args[1]);
+    }
+    else if (header->type == FRAME_SEARCH_TREASURES && argc >= 2)
+    {
+        search_treasures(args[0], argc - 1, &args[1]);
+    }
+    else if (header->type == FRAME_MONITOR_STATS)
+    {
+        monitor_stats(argc, args);
+    }
+    else if (header->type == FRAME_LIST_RECORDS && argc >= 1 && argc <= 3)
+    {
+        list_records(args[0], argc - 1, &args[1]);
+    }
+    else
+    {
+        send_error("Unknown command or invalid arguments (type %u)\n", header->type);
+        finish_response();
+    }
+}
+
+/* Runs one request and charges its time, output and file reads to its command. */
+void process_request(const FrameHeader *header, char *payload)
+{
+    struct timespec start, end;
+    uint64_t sent_before = bytes_sent, read_before = file_bytes_read;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    dispatch_request(header, payload);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_mutex_lock(&stats_lock);
+    CommandStats *stats = &command_stats[header->type < MONITOR_COMMAND_SLOTS ? header->type : 0];
+    histogram_record(&stats->latency_ns,
+                     (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000u + (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec);
+    stats->bytes_out += bytes_sent - sent_before;
+    stats->file_bytes += file_bytes_read - read_before;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Called with queue_lock held. */
+void queue_client(MonitorClient *client)
+{
+    client->next_ready = NULL;
+    if (ready_tail != NULL)
+        ready_tail->next_ready = client;
+    else
+        ready_head = client;
+    ready_tail = client;
+    pthread_cond_signal(&queue_ready);
+}
+
+void *worker_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&queue_lock);
+    for (;;)
+    {
+        while (ready_head == NULL && !workers_stopping)
         {
-            *space = '\0';
-            view_treasure(args, space + 1);
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        }
+        if (workers_stopping)
+            break;
+
+        MonitorClient *client = ready_head;
+        ready_head = client->next_ready;
+        if (ready_head == NULL)
+            ready_tail = NULL;
+        PendingRequest *request = client->pending_head;
+        client->pending_head = request->next;
+        if (client->pending_head == NULL)
+            client->pending_tail = NULL;
+        int closed = client->closed;
+        pthread_mutex_unlock(&queue_lock);
+
+        if (!closed)
+        {
+            current_client = client;
+            process_request(&request->header, request->payload);
+            current_client = NULL;
+        }
+        free(request);
+
+        pthread_mutex_lock(&queue_lock);
+        if (client->pending_head != NULL && !client->closed)
+        {
+            /* Back of the queue, so one busy hub cannot starve the rest. */
+            queue_client(client);
         }
         else
         {
-            send_output("Error: Invalid arguments for view_treasure\n");
-            send_end_marker();
+            client->busy = 0;
+            if (client->closed)
+                free_client(client);
         }
     }
-    else if (strcmp(command, "stop_monitor") == 0)
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+int start_workers()
+{
+    while (worker_count < MONITOR_WORKERS)
     {
-        return;
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0)
+        {
+            perror("Failed to start monitor worker");
+            return worker_count > 0;
+        }
+        worker_count++;
     }
+    return 1;
+}
+
+/* Lets the workers finish the requests they are running and waits for them. */
+void stop_workers()
+{
+    pthread_mutex_lock(&queue_lock);
+    workers_stopping = 1;
+    pthread_cond_broadcast(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    worker_count = 0;
+
+    /* Hung-up clients still waiting for a worker are no longer in clients[]. */
+    while (ready_head != NULL)
+    {
+        MonitorClient *client = ready_head;
+        ready_head = client->next_ready;
+        if (client->closed)
+            free_client(client);
+    }
+    ready_tail = NULL;
+}
+
+int queue_request(MonitorClient *client, const FrameHeader *header, const char *payload)
+{
+    PendingRequest *request = malloc(sizeof(PendingRequest) + header->length);
+    if (request == NULL)
+    {
+        return 0;
+    }
+    request->next = NULL;
+    request->header = *header;
+    memcpy(request->payload, payload, header->length);
+
+    pthread_mutex_lock(&queue_lock);
+    if (client->pending_tail != NULL)
+        client->pending_tail->next = request;
     else
+        client->pending_head = request;
+    client->pending_tail = request;
+    if (!client->busy)
     {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "Unknown command: %s\n", command);
-        send_output(error_msg);
-        send_end_marker();
+        client->busy = 1;
+        queue_client(client);
     }
+    pthread_mutex_unlock(&queue_lock);
+    return 1;
 }
 
-int main(int argc, char *argv[])
+/* Queues every complete request frame read from a client; returns 0 once the client has hung up. */
+int process_requests(MonitorClient *client)
+{
+    FrameHeader header;
+    char *payload;
+    int status;
+
+    /* One read per wakeup: socket clients stay blocking for the workers' writes. */
+    ssize_t nbytes = frame_reader_fill(&client->reader, client->in_fd);
+    if (nbytes > 0)
+    {
+        while ((status = frame_reader_next(&client->reader, &header, &payload)) == 1)
+        {
+            if (!queue_request(client, &header, payload))
+            {
+                perror("Failed to queue request");
+            }
+        }
+        if (status == -1)
+        {
+            const char *message = "Error: Oversized request frame, dropping pending requests\n";
+            client_write(client, FRAME_NOTICE, 0, 0, message, strlen(message));
+            frame_reader_free(&client->reader);
+        }
+    }
+
+    return !(nbytes == 0 || (nbytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+}
+
+MonitorClient *find_client(int fd)
 {
-    if (argc != 2)
+    for (int i = 0; i < client_count; i++)
     {
-        fprintf(stderr, "Usage: %s <pipe_fd>\n", argv[0]);
-        exit(EXIT_FAILURE);
+        if (clients[i]->in_fd == fd)
+            return clients[i];
+    }
+    return NULL;
+}
+
+int add_client(MonitorClient *client)
+{
+    if (client_count == MONITOR_MAX_CLIENTS || !watch_fd(client->in_fd))
+    {
+        return 0;
+    }
+    clients[client_count++] = client;
+    return 1;
+}
+
+/* Forgets a client that hung up; a worker still answering it frees it when done. */
+void drop_client(MonitorClient *client)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->in_fd, NULL);
+    for (int i = 0; i < client_count; i++)
+    {
+        if (clients[i] == client)
+        {
+            clients[i] = clients[--client_count];
+            break;
+        }
     }
 
-    output_pipe_fd = atoi(argv[1]);
-    setup_signal_handlers();
+    pthread_mutex_lock(&queue_lock);
+    client->closed = 1;
+    if (!client->busy)
+        free_client(client);
+    pthread_mutex_unlock(&queue_lock);
+}
 
-    char start_msg[256];
-    snprintf(start_msg, sizeof(start_msg), "Monitor process started with PID: %d\n", getpid());
-    send_output(start_msg);
-    send_end_marker();
+/* Serves further hubs on path, unless a live monitor already answers there. */
+int open_listen_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        close(probe);
+        fprintf(stderr, "Another monitor is serving %s\n", path);
+        return 0;
+    }
+    if (probe != -1)
+        close(probe);
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, MONITOR_MAX_CLIENTS) == -1 || !watch_fd(listen_fd))
+    {
+        perror("Failed to open monitor socket");
+        if (listen_fd != -1)
+            close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+    socket_path = path;
+    return 1;
+}
+
+void accept_clients()
+{
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) != -1)
+    {
+        MonitorClient *client = new_client(fd, fd);
+        if (client == NULL || !add_client(client))
+        {
+            if (client != NULL)
+                free_client(client);
+            else
+                close(fd);
+            fprintf(stderr, "Monitor: refusing connection, too many clients\n");
+        }
+    }
+}
+
+void begin_stop()
+{
+    if (stop_timer_fd != -1)
+    {
+        return;
+    }
+
+    char stop_msg[256];
+    snprintf(stop_msg, sizeof(stop_msg),
+             "Monitor received stop signal, delaying exit for %d seconds...\n",
+             MONITOR_STOP_DELAY);
+    send_notice(stop_msg);
+
+    struct itimerspec delay;
+    memset(&delay, 0, sizeof(delay));
+    delay.it_value.tv_sec = MONITOR_STOP_DELAY;
+
+    stop_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (stop_timer_fd == -1 || timerfd_settime(stop_timer_fd, 0, &delay, NULL) == -1 || !watch_fd(stop_timer_fd))
+    {
+        perror("Failed to arm stop timer");
+        should_stop = 1;
+    }
+}
+
+void handle_signals()
+{
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo == SIGUSR2)
+        {
+            begin_stop();
+        }
+        else if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT)
+        {
+            should_stop = 1;
+        }
+        else if (info.ssi_signo == SIGUSR1)
+        {
+            /* Legacy doorbell: requests are picked up from the pipe anyway. */
+            process_requests(hub_client);
+        }
+    }
+}
+
+void run_event_loop()
+{
+    struct epoll_event events[MONITOR_MAX_EVENTS];
 
     while (!should_stop)
     {
-        if (command_received)
+        int ready = epoll_wait(epoll_fd, events, MONITOR_MAX_EVENTS, -1);
+        if (ready == -1)
         {
-            command_received = 0;
-            process_command();
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
         }
-        pause();
+
+        for (int i = 0; i < ready && !should_stop; i++)
+        {
+            int fd = events[i].data.fd;
+            MonitorClient *client;
+            if (fd == signal_fd)
+            {
+                handle_signals();
+            }
+            else if (fd == stop_timer_fd)
+            {
+                should_stop = 1;
+            }
+            else if (fd == listen_fd)
+            {
+                accept_clients();
+            }
+            else if ((client = find_client(fd)) != NULL && !process_requests(client))
+            {
+                if (client == hub_client)
+                {
+                    /* The hub that started us closed its end; nobody is left to stop us. */
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                    should_stop = 1;
+                }
+                else
+                {
+                    drop_client(client);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3 && argc != 4)
+    {
+        fprintf(stderr, "Usage: %s <request_fd> <response_fd> [socket_path]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    hub_client = new_client(atoi(argv[1]), atoi(argv[2]));
+    reset_stats();
+    if (hub_client == NULL)
+    {
+        perror("Failed to allocate monitor client");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(hub_client->in_fd, F_SETFL, fcntl(hub_client->in_fd, F_GETFL) | O_NONBLOCK);
+
+    /* Signals are blocked before the workers start so they inherit the mask. */
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1 || !setup_signal_fd() || !add_client(hub_client) || !start_workers())
+    {
+        perror("Failed to set up monitor event loop");
+        exit(EXIT_FAILURE);
+    }
+
+    char start_msg[256];
+    if (argc == 4 && open_listen_socket(argv[3]))
+        snprintf(start_msg, sizeof(start_msg), "Monitor process started with PID: %d, other hubs can connect on %s\n",
+                 getpid(), argv[3]);
+    else
+        snprintf(start_msg, sizeof(start_msg), "Monitor process started with PID: %d\n", getpid());
+    send_notice(start_msg);
+
+    run_event_loop();
+
+    if (listen_fd != -1)
+    {
+        close(listen_fd);
+        unlink(socket_path);
     }
+    stop_workers();
 
     char exit_msg[256];
     snprintf(exit_msg, sizeof(exit_msg), "Monitor process exiting after %d second delay.\n", MONITOR_STOP_DELAY);
-    send_output(exit_msg);
-    send_end_marker();
+    send_notice(exit_msg);
 
-    if (output_pipe_fd != -1)
+    while (client_count > 0)
     {
-        close(output_pipe_fd);
+        free_client(clients[--client_count]);
     }
+    if (stop_timer_fd != -1)
+        close(stop_timer_fd);
+    close(signal_fd);
+    close(epoll_fd);
 
     exit(0);
 }
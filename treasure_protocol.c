@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include "treasure_protocol.h"
+
+#define READER_MIN_CAPACITY 65536
+#define FRAME_MAX_IOV 64
+
+/* Writes every byte described by iov, resuming after short writes; iov is consumed in the process. */
+int frame_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    struct iovec *cur = iov;
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, cur, iovcnt > FRAME_MAX_IOV ? FRAME_MAX_IOV : iovcnt);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+
+        while (iovcnt > 0 && (size_t)n >= cur->iov_len)
+        {
+            n -= (ssize_t)cur->iov_len;
+            cur++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            cur->iov_base = (char *)cur->iov_base + n;
+            cur->iov_len -= (size_t)n;
+        }
+    }
+    return 1;
+}
+
+int frame_write(int fd, uint16_t type, uint16_t flags, uint32_t request_id, const void *payload, size_t length)
+{
+    FrameHeader header;
+    header.length = (uint32_t)length;
+    header.request_id = request_id;
+    header.type = type;
+    header.flags = flags;
+
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = length;
+    return frame_writev(fd, iov, length > 0 ? 2 : 1);
+}
+
+/*
+ * Sends length bytes of file_fd starting at offset as one frame. The
+ * payload goes from the page cache to fd with sendfile(); if the kernel
+ * will not do that for this pair of descriptors it is copied through a
+ * bounce buffer instead.
+ */
+int frame_send_file(int fd, uint16_t type, uint16_t flags, uint32_t request_id, int file_fd, off_t offset,
+                    size_t length)
+{
+    FrameHeader header;
+    header.length = (uint32_t)length;
+    header.request_id = request_id;
+    header.type = type;
+    header.flags = flags;
+
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    if (!frame_writev(fd, &iov, 1))
+        return 0;
+
+    while (length > 0)
+    {
+        ssize_t n = sendfile(fd, file_fd, &offset, length);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS))
+            break;
+        if (n <= 0)
+            return 0;
+        length -= (size_t)n;
+    }
+
+    char buffer[FRAME_CHUNK_SIZE];
+    while (length > 0)
+    {
+        ssize_t n = pread(file_fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        iov.iov_base = buffer;
+        iov.iov_len = (size_t)n;
+        if (!frame_writev(fd, &iov, 1))
+            return 0;
+        offset += n;
+        length -= (size_t)n;
+    }
+    return 1;
+}
+
+size_t frame_pack_args(char *out, size_t size, int argc, const char *const *argv)
+{
+    size_t used = 0;
+    for (int i = 0; i < argc; i++)
+    {
+        size_t len = strlen(argv[i]) + 1;
+        if (used + len > size)
+            break;
+        memcpy(out + used, argv[i], len);
+        used += len;
+    }
+    return used;
+}
+
+/* Splits a request payload into its NUL-terminated arguments; returns how many were found. */
+int frame_unpack_args(char *payload, size_t length, char **argv, int max_args)
+{
+    int argc = 0;
+    size_t pos = 0;
+    while (pos < length && argc < max_args)
+    {
+        char *end = memchr(payload + pos, '\0', length - pos);
+        if (end == NULL)
+            break;
+        argv[argc++] = payload + pos;
+        pos = (size_t)(end - payload) + 1;
+    }
+    return argc;
+}
+
+void frame_reader_init(FrameReader *reader)
+{
+    reader->data = NULL;
+    reader->used = 0;
+    reader->capacity = 0;
+    reader->consumed = 0;
+}
+
+void frame_reader_free(FrameReader *reader)
+{
+    free(reader->data);
+    frame_reader_init(reader);
+}
+
+/* Reads whatever is available on fd into the reader; returns bytes read, 0 on EOF or -1 on error. */
+ssize_t frame_reader_fill(FrameReader *reader, int fd)
+{
+    if (reader->consumed > 0)
+    {
+        memmove(reader->data, reader->data + reader->consumed, reader->used - reader->consumed);
+        reader->used -= reader->consumed;
+        reader->consumed = 0;
+    }
+
+    if (reader->capacity - reader->used < READER_MIN_CAPACITY / 2)
+    {
+        size_t capacity = reader->capacity ? reader->capacity * 2 : READER_MIN_CAPACITY;
+        char *data = realloc(reader->data, capacity);
+        if (data == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        reader->data = data;
+        reader->capacity = capacity;
+    }
+
+    ssize_t n;
+    do
+    {
+        n = read(fd, reader->data + reader->used, reader->capacity - reader->used);
+    } while (n == -1 && errno == EINTR);
+
+    if (n > 0)
+        reader->used += (size_t)n;
+    return n;
+}
+
+/*
+ * Returns 1 and points payload into the reader's buffer when a complete
+ * frame is buffered, 0 when more data is needed and -1 for a frame that
+ * exceeds FRAME_MAX_PAYLOAD. The payload stays valid until the next fill.
+ */
+int frame_reader_next(FrameReader *reader, FrameHeader *header, char **payload)
+{
+    size_t available = reader->used - reader->consumed;
+    if (available < sizeof(FrameHeader))
+        return 0;
+
+    memcpy(header, reader->data + reader->consumed, sizeof(FrameHeader));
+    if (header->length > FRAME_MAX_PAYLOAD)
+        return -1;
+    if (available < sizeof(FrameHeader) + header->length)
+        return 0;
+
+    *payload = reader->data + reader->consumed + sizeof(FrameHeader);
+    reader->consumed += sizeof(FrameHeader) + header->length;
+    return 1;
+}
@@ -0,0 +1,101 @@
+#ifndef TREASURE_PROTOCOL_H
+#define TREASURE_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Framing used between treasure_hub and treasure_monitor. Every message is
+ * a FrameHeader followed by length payload bytes. Requests carry their
+ * arguments as NUL-terminated strings and a hub-chosen request_id; the
+ * monitor answers with a FRAME_RESPONSE carrying the same id, so several
+ * requests can be in flight at once. Frames with request_id 0 are notices
+ * the monitor sends on its own (start-up and shutdown messages).
+ *
+ * Long responses are streamed as a run of FRAME_RESPONSE chunks of at most
+ * FRAME_CHUNK_SIZE bytes; every chunk but the last has FRAME_FLAG_MORE set.
+ *
+ * FRAME_LIST_RECORDS is for binary consumers: its response starts with a
+ * RecordRangeHeader chunk and continues with the raw TreasureRecord slots
+ * of the requested range, whole records per chunk, sent straight from
+ * treasures.hot. A record is removed when its deleted field is non-zero
+ * and no greater than the header's generation; user and clue fields refer
+ * to the hunt's treasures.users and treasures.clues. An error is reported
+ * as text, which the consumer tells apart by the missing magic.
+ *
+ * A request may ask for json, ndjson or binary output (see
+ * treasure_format.h) by putting the OutputFormat in the high byte of its
+ * flags; the response then carries only serialized objects, errors
+ * included. FRAME_LIST_RECORDS ignores it.
+ *
+ * The hub that starts the monitor talks to it over a pipe pair; further
+ * hubs in the same directory connect to MONITOR_SOCKET_PATH and use the
+ * same framing over the socket.
+ */
+
+#define FRAME_MAX_ARGS 8
+#define FRAME_MAX_PAYLOAD (256u * 1024u * 1024u)
+#define FRAME_CHUNK_SIZE (64u * 1024u)
+#define FRAME_FLAG_MORE 0x1
+#define FRAME_FORMAT_SHIFT 8
+#define MONITOR_SOCKET_PATH "treasure_monitor.sock"
+
+typedef enum
+{
+    FRAME_LIST_HUNTS = 1,
+    FRAME_LIST_TREASURES,
+    FRAME_VIEW_TREASURE,
+    FRAME_NEAR_TREASURES,
+    FRAME_BBOX_TREASURES,
+    FRAME_FILTER_TREASURES,
+    FRAME_TREASURE_STATS,
+    FRAME_SEARCH_TREASURES,
+    FRAME_MONITOR_STATS,
+    FRAME_LIST_RECORDS,
+    FRAME_RESPONSE = 64,
+    FRAME_NOTICE
+} FrameType;
+
+typedef struct
+{
+    uint32_t length;
+    uint32_t request_id;
+    uint16_t type;
+    uint16_t flags;
+} FrameHeader;
+
+#define RECORD_RANGE_MAGIC 0x52434552u
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t record_size;
+    uint64_t first_slot;
+    uint64_t record_count;
+    uint32_t generation;
+    uint32_t reserved;
+} RecordRangeHeader;
+
+typedef struct
+{
+    char *data;
+    size_t used;
+    size_t capacity;
+    size_t consumed;
+} FrameReader;
+
+int frame_writev(int fd, struct iovec *iov, int iovcnt);
+int frame_write(int fd, uint16_t type, uint16_t flags, uint32_t request_id, const void *payload, size_t length);
+int frame_send_file(int fd, uint16_t type, uint16_t flags, uint32_t request_id, int file_fd, off_t offset,
+                    size_t length);
+size_t frame_pack_args(char *out, size_t size, int argc, const char *const *argv);
+int frame_unpack_args(char *payload, size_t length, char **argv, int max_args);
+
+void frame_reader_init(FrameReader *reader);
+void frame_reader_free(FrameReader *reader);
+ssize_t frame_reader_fill(FrameReader *reader, int fd);
+int frame_reader_next(FrameReader *reader, FrameHeader *header, char **payload);
+
+#endif
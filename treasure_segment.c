@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "treasure_segment.h"
+#include "treasure_lz.h"
+
+#define SEGMENT_RAW_MAX (SEGMENT_BLOCK_RECORDS * MAX_CLUE_LENGTH)
+
+static const char *sidecar_files[] = {TREASURE_INDEX_FILE, TREASURE_AGG_FILE, TREASURE_GEO_FILE, TREASURE_FTS_FILE};
+
+/* Accumulates blocks for segment_archive(). */
+typedef struct
+{
+    int fd;
+    SegmentHeader header;
+    SegmentBlock *blocks;
+    off_t end;
+    char *raw;
+    char *packed;
+} SegmentWriter;
+
+static int read_all_at(int fd, void *buf, size_t len, off_t offset)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 1;
+}
+
+static int write_all_at(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 1;
+}
+
+int segment_exists(const char *hunt_id)
+{
+    char path[MAX_PATH_LENGTH];
+    struct stat st;
+    store_hunt_path(path, hunt_id, TREASURE_SEGMENT_FILE);
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static size_t block_records(const TreasureSegment *segment, long block)
+{
+    uint64_t first = (uint64_t)block * segment->header.block_records;
+    uint64_t left = segment->header.record_count - first;
+    return left < segment->header.block_records ? (size_t)left : segment->header.block_records;
+}
+
+/* Turns the decoded columns back into records; 0 if the clue lengths do not add up to the block's clue text. */
+static int decode_rows(TreasureSegment *segment, size_t count, const SegmentBlock *entry)
+{
+    TreasureRecord *rows = segment->rows;
+    const char *column = segment->ids.data;
+    for (size_t i = 0; i < count; i++, column += MAX_ID_LENGTH)
+        memcpy(rows[i].id, column, MAX_ID_LENGTH);
+    column = segment->raw;
+    for (size_t i = 0; i < count; i++, column += sizeof(double))
+        memcpy(&rows[i].latitude, column, sizeof(double));
+    for (size_t i = 0; i < count; i++, column += sizeof(double))
+        memcpy(&rows[i].longitude, column, sizeof(double));
+    for (size_t i = 0; i < count; i++, column += sizeof(uint32_t))
+        memcpy(&rows[i].clue_length, column, sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++, column += sizeof(uint32_t))
+        memcpy(&rows[i].user, column, sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++, column += sizeof(int32_t))
+        memcpy(&rows[i].value, column, sizeof(int32_t));
+
+    uint64_t clue_offset = entry->clue_base;
+    for (size_t i = 0; i < count; i++)
+    {
+        rows[i].clue_offset = clue_offset;
+        rows[i].deleted = 0;
+        clue_offset += rows[i].clue_length;
+    }
+    return clue_offset - entry->clue_base == entry->clue_length;
+}
+
+/* Reads one part of a block into out, decompressing it unless it was stored as is. */
+static int read_part(TreasureStore *store, uint64_t offset, uint32_t packed_length, uint32_t raw_length, char *out)
+{
+    TreasureSegment *segment = store->segment;
+    if (packed_length == raw_length)
+        return read_all_at(store->hot_fd, out, raw_length, (off_t)offset);
+    return read_all_at(store->hot_fd, segment->packed, packed_length, (off_t)offset) &&
+           lz_decompress(segment->packed, packed_length, out, raw_length);
+}
+
+/* Decodes the field columns of block into raw unless they are already there; NULL if they cannot be read. */
+static TreasureSegment *load_fields(TreasureStore *store, long block)
+{
+    TreasureSegment *segment = store->segment;
+    if (segment->fields_loaded == block)
+        return segment;
+    if (block < 0 || (uint64_t)block >= segment->header.block_count)
+        return NULL;
+
+    const SegmentBlock *entry = &segment->blocks[block];
+    segment->fields_loaded = -1;
+    if (!read_part(store, entry->offset + entry->id_packed_length, entry->packed_length,
+                   (uint32_t)(block_records(segment, block) * SEGMENT_FIELD_BYTES), segment->raw))
+        return NULL;
+    segment->fields_loaded = block;
+    segment->offset_row = 0;
+    segment->row_offset = entry->clue_base;
+    return segment;
+}
+
+/*
+ * Decodes the first want bytes of one part of block into part->data unless
+ * they are already there, carrying on from where the last call for the
+ * same block stopped; 0 if they cannot be read.
+ */
+static int load_part(TreasureStore *store, SegmentPart *part, long block, uint64_t offset, uint32_t packed_length,
+                     uint32_t raw_length, size_t want)
+{
+    if (part->block != block)
+    {
+        int stored = packed_length == raw_length;
+        part->block = -1;
+        if (!read_all_at(store->hot_fd, stored ? part->data : part->packed, packed_length, (off_t)offset))
+            return 0;
+        part->used = stored ? packed_length : 0;
+        part->decoded = stored ? raw_length : 0;
+        part->block = block;
+    }
+    if (part->decoded >= want)
+        return 1;
+    if (!lz_decompress_some(part->packed, packed_length, &part->used, part->data, &part->decoded, raw_length, want))
+    {
+        part->block = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Decodes the ids of block up to at least its first rows records; NULL if they cannot be read. */
+static TreasureSegment *load_ids(TreasureStore *store, long block, size_t rows)
+{
+    TreasureSegment *segment = store->segment;
+    if (block < 0 || (uint64_t)block >= segment->header.block_count)
+        return NULL;
+
+    const SegmentBlock *entry = &segment->blocks[block];
+    size_t count = block_records(segment, block);
+    if (!load_part(store, &segment->ids, block, entry->offset, entry->id_packed_length,
+                   (uint32_t)(count * MAX_ID_LENGTH), rows * MAX_ID_LENGTH))
+        return NULL;
+    return segment;
+}
+
+/* Decodes block into the store's segment unless it is already there; NULL if it cannot be read. */
+static TreasureSegment *load_block(TreasureStore *store, long block)
+{
+    TreasureSegment *segment = store->segment;
+    if (segment->loaded == block)
+        return segment;
+    if (load_fields(store, block) == NULL)
+        return NULL;
+
+    const SegmentBlock *entry = &segment->blocks[block];
+    size_t count = block_records(segment, block);
+    segment->loaded = -1;
+    if (load_ids(store, block, count) == NULL || !decode_rows(segment, count, entry))
+        return NULL;
+
+    segment->loaded = block;
+    segment->loaded_records = count;
+    return segment;
+}
+
+/* Decodes the clue text of block up to at least its first length bytes; NULL if it cannot be read. */
+static TreasureSegment *load_clues(TreasureStore *store, long block, size_t length)
+{
+    TreasureSegment *segment = store->segment;
+    if (block < 0 || (uint64_t)block >= segment->header.block_count)
+        return NULL;
+
+    const SegmentBlock *entry = &segment->blocks[block];
+    if (!load_part(store, &segment->clues, block, entry->offset + entry->id_packed_length + entry->packed_length,
+                   entry->clue_packed_length, entry->clue_length, length))
+        return NULL;
+    return segment;
+}
+
+/*
+ * Opens treasures.seg and treasures.users read-only in place of the hot
+ * layout. The segment file stands in for hot_fd, so sidecar stamps and
+ * file sizes refer to it; clue_fd stays closed.
+ */
+int segment_open(TreasureStore *store)
+{
+    char path[MAX_PATH_LENGTH];
+    store_hunt_path(path, store->hunt_id, TREASURE_SEGMENT_FILE);
+    store->hot_fd = open(path, O_RDONLY);
+    store_hunt_path(path, store->hunt_id, TREASURE_USER_FILE);
+    store->user_fd = open(path, O_RDONLY);
+    store->segment = calloc(1, sizeof(TreasureSegment));
+
+    TreasureSegment *segment = store->segment;
+    SegmentHeader *header = segment != NULL ? &segment->header : NULL;
+    int ok = store->hot_fd != -1 && store->user_fd != -1 && segment != NULL &&
+             read_all_at(store->hot_fd, header, sizeof(*header), 0);
+    if (ok && (header->magic != SEGMENT_MAGIC || header->version != SEGMENT_VERSION ||
+               header->record_size != sizeof(TreasureRecord) || header->block_records == 0 ||
+               header->block_records > SEGMENT_BLOCK_RECORDS || header->max_raw > SEGMENT_RAW_MAX ||
+               header->max_packed > LZ_BOUND(SEGMENT_RAW_MAX) ||
+               header->block_count != (header->record_count + header->block_records - 1) / header->block_records))
+    {
+        errno = EINVAL;
+        ok = 0;
+    }
+
+    if (ok)
+    {
+        segment->blocks = malloc((size_t)header->block_count * sizeof(SegmentBlock) + 1);
+        segment->packed = malloc((size_t)header->max_packed + 1);
+        segment->raw = malloc((size_t)header->max_raw + 1);
+        segment->ids.packed = malloc((size_t)header->max_packed + 1);
+        segment->ids.data = malloc((size_t)header->max_raw + 1);
+        segment->clues.packed = malloc((size_t)header->max_packed + 1);
+        segment->clues.data = malloc((size_t)header->max_raw + 1);
+        ok = segment->blocks != NULL && segment->packed != NULL && segment->raw != NULL &&
+             segment->ids.packed != NULL && segment->ids.data != NULL && segment->clues.packed != NULL &&
+             segment->clues.data != NULL &&
+             read_all_at(store->hot_fd, segment->blocks, (size_t)header->block_count * sizeof(SegmentBlock),
+                         (off_t)header->index_offset);
+    }
+    for (uint32_t b = 0; ok && b < header->block_count; b++)
+    {
+        const SegmentBlock *entry = &segment->blocks[b];
+        if (block_records(segment, (long)b) * MAX_ID_LENGTH > header->max_raw ||
+            entry->id_packed_length > header->max_packed || entry->packed_length > header->max_packed ||
+            entry->clue_length > header->max_raw || entry->clue_packed_length > header->max_packed)
+        {
+            errno = EINVAL;
+            ok = 0;
+        }
+    }
+
+    if (!ok)
+    {
+        int saved = errno;
+        segment_free(store);
+        if (store->hot_fd != -1)
+            close(store->hot_fd);
+        if (store->user_fd != -1)
+            close(store->user_fd);
+        store->hot_fd = -1;
+        store->user_fd = -1;
+        errno = saved;
+        return 0;
+    }
+
+    segment->loaded = -1;
+    segment->fields_loaded = -1;
+    segment->ids.block = -1;
+    segment->clues.block = -1;
+    store->record_count = header->record_count;
+    store->generation = header->generation;
+    store_stamp_now(store, &store->stamp);
+    return 1;
+}
+
+void segment_free(TreasureStore *store)
+{
+    if (store->segment == NULL)
+        return;
+    free(store->segment->blocks);
+    free(store->segment->packed);
+    free(store->segment->raw);
+    free(store->segment->ids.packed);
+    free(store->segment->ids.data);
+    free(store->segment->clues.packed);
+    free(store->segment->clues.data);
+    free(store->segment);
+    store->segment = NULL;
+}
+
+/*
+ * Builds the one record at slot from the block's columns, decoding its ids
+ * only up to that record. Clue offsets are summed from the last record
+ * built, so reading a block in slot order stays linear.
+ */
+int segment_read_record(TreasureStore *store, long slot, TreasureRecord *out)
+{
+    TreasureSegment *segment = store->segment;
+    long block = slot / (long)segment->header.block_records;
+    size_t row = (size_t)(slot - block * (long)segment->header.block_records);
+    if (segment->loaded == block)
+    {
+        *out = segment->rows[row];
+        return 1;
+    }
+    if (load_fields(store, block) == NULL || load_ids(store, block, row + 1) == NULL)
+        return 0;
+
+    size_t count = block_records(segment, block);
+    const char *column = segment->raw;
+    memcpy(out->id, segment->ids.data + row * MAX_ID_LENGTH, MAX_ID_LENGTH);
+    memcpy(&out->latitude, column + row * sizeof(double), sizeof(double));
+    column += count * sizeof(double);
+    memcpy(&out->longitude, column + row * sizeof(double), sizeof(double));
+    column += count * sizeof(double);
+    const char *lengths = column;
+    memcpy(&out->clue_length, column + row * sizeof(uint32_t), sizeof(uint32_t));
+    column += count * sizeof(uint32_t);
+    memcpy(&out->user, column + row * sizeof(uint32_t), sizeof(uint32_t));
+    column += count * sizeof(uint32_t);
+    memcpy(&out->value, column + row * sizeof(int32_t), sizeof(int32_t));
+
+    if (segment->offset_row > row)
+    {
+        segment->offset_row = 0;
+        segment->row_offset = segment->blocks[block].clue_base;
+    }
+    for (; segment->offset_row < row; segment->offset_row++)
+    {
+        uint32_t length;
+        memcpy(&length, lengths + segment->offset_row * sizeof(uint32_t), sizeof(uint32_t));
+        segment->row_offset += length;
+    }
+    out->clue_offset = segment->row_offset;
+    out->deleted = 0;
+    return 1;
+}
+
+/* Copies the records from slot to the end of its block into out; returns how many, 0 on error. */
+size_t segment_read_records(TreasureStore *store, long slot, TreasureRecord *out)
+{
+    long block = slot / (long)store->segment->header.block_records;
+    TreasureSegment *segment = load_block(store, block);
+    if (segment == NULL)
+        return 0;
+    size_t start = (size_t)(slot - block * (long)segment->header.block_records);
+    memcpy(out, &segment->rows[start], (segment->loaded_records - start) * sizeof(TreasureRecord));
+    return segment->loaded_records - start;
+}
+
+/* Copies the columns from slot to the end of its block into the arrays, decoding neither ids nor clues; returns how many, 0 on error. */
+size_t segment_read_columns(TreasureStore *store, long slot, double *latitude, double *longitude, int32_t *value)
+{
+    long block = slot / (long)store->segment->header.block_records;
+    TreasureSegment *segment = load_fields(store, block);
+    if (segment == NULL)
+        return 0;
+    size_t count = block_records(segment, block);
+    size_t start = (size_t)(slot - block * (long)segment->header.block_records);
+    const char *columns = segment->raw;
+    memcpy(latitude, columns + start * sizeof(double), (count - start) * sizeof(double));
+    columns += count * sizeof(double);
+    memcpy(longitude, columns + start * sizeof(double), (count - start) * sizeof(double));
+    columns += count * (sizeof(double) + 2 * sizeof(uint32_t));
+    memcpy(value, columns + start * sizeof(int32_t), (count - start) * sizeof(int32_t));
+    store->bytes_read += (count - start) * SEGMENT_FIELD_BYTES;
+    return count - start;
+}
+
+/* Clue offsets only grow from block to block, so the last block starting at or before one holds it. */
+static long find_clue_block(const TreasureSegment *segment, uint64_t offset)
+{
+    long low = 0, high = (long)segment->header.block_count - 1;
+    while (low < high)
+    {
+        long middle = (low + high + 1) / 2;
+        if (segment->blocks[middle].clue_base <= offset)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+int segment_read_clue(TreasureStore *store, const TreasureRecord *record, char *clue)
+{
+    size_t length = record->clue_length < MAX_CLUE_LENGTH ? record->clue_length : MAX_CLUE_LENGTH - 1;
+    TreasureSegment *segment = store->segment;
+    clue[0] = '\0';
+    store->bytes_read += length;
+    if (length == 0)
+        return 1;
+
+    /* Scans and lookups ask for the clues of the block whose ids they just decoded, which saves the search. */
+    long block = segment->ids.block != -1 ? segment->ids.block : segment->clues.block;
+    if (block == -1 || record->clue_offset < segment->blocks[block].clue_base ||
+        record->clue_offset + length > segment->blocks[block].clue_base + segment->blocks[block].clue_length)
+    {
+        block = find_clue_block(segment, record->clue_offset);
+    }
+    const SegmentBlock *entry = &segment->blocks[block];
+    if (record->clue_offset < entry->clue_base || record->clue_offset + length > entry->clue_base + entry->clue_length ||
+        load_clues(store, block, record->clue_offset + length - entry->clue_base) == NULL)
+        return 0;
+    memcpy(clue, segment->clues.data + (record->clue_offset - entry->clue_base), length);
+    clue[length] = '\0';
+    return 1;
+}
+
+/*
+ * Compresses one part of a block and appends it, or appends it as is if
+ * that saves less than an eighth, which is not worth decoding on every
+ * scan (mostly the latitude and longitude columns); returns its length.
+ */
+static uint32_t write_part(SegmentWriter *writer, const char *data, size_t length)
+{
+    size_t packed_length = lz_compress(data, length, writer->packed, LZ_BOUND(SEGMENT_RAW_MAX));
+    if (packed_length == 0 || packed_length > length - length / 8)
+        packed_length = length;
+    else
+        data = writer->packed;
+    if (!write_all_at(writer->fd, data, packed_length, writer->end))
+        return UINT32_MAX;
+
+    writer->end += (off_t)packed_length;
+    if (length > writer->header.max_raw)
+        writer->header.max_raw = (uint32_t)length;
+    if (packed_length > writer->header.max_packed)
+        writer->header.max_packed = (uint32_t)packed_length;
+    return (uint32_t)packed_length;
+}
+
+/* Lays count records out column by column and appends their ids, their other fields and their clues to the file. */
+static int write_block(SegmentWriter *writer, const TreasureRecord *rows, size_t count, const char *clues,
+                       size_t clue_bytes)
+{
+    SegmentBlock *entry = &writer->blocks[writer->header.block_count];
+    entry->offset = (uint64_t)writer->end;
+    entry->clue_base = writer->header.clue_bytes;
+    entry->clue_length = (uint32_t)clue_bytes;
+
+    char *column = writer->raw;
+    for (size_t i = 0; i < count; i++, column += MAX_ID_LENGTH)
+        memcpy(column, rows[i].id, MAX_ID_LENGTH);
+    entry->id_packed_length = write_part(writer, writer->raw, (size_t)(column - writer->raw));
+    if (entry->id_packed_length == UINT32_MAX)
+        return 0;
+
+    column = writer->raw;
+    for (size_t i = 0; i < count; i++, column += sizeof(double))
+        memcpy(column, &rows[i].latitude, sizeof(double));
+    for (size_t i = 0; i < count; i++, column += sizeof(double))
+        memcpy(column, &rows[i].longitude, sizeof(double));
+    for (size_t i = 0; i < count; i++, column += sizeof(uint32_t))
+        memcpy(column, &rows[i].clue_length, sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++, column += sizeof(uint32_t))
+        memcpy(column, &rows[i].user, sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++, column += sizeof(int32_t))
+        memcpy(column, &rows[i].value, sizeof(int32_t));
+
+    entry->packed_length = write_part(writer, writer->raw, (size_t)(column - writer->raw));
+    entry->clue_packed_length = entry->packed_length == UINT32_MAX ? UINT32_MAX : write_part(writer, clues, clue_bytes);
+    if (entry->clue_packed_length == UINT32_MAX)
+        return 0;
+
+    writer->header.block_count++;
+    writer->header.record_count += count;
+    writer->header.clue_bytes += clue_bytes;
+    return 1;
+}
+
+/*
+ * Writes the live records of a store opened for writing into treasures.seg
+ * and removes treasures.hot, treasures.clues and the sidecars, whose slots
+ * no longer match once removed records are dropped. Returns the size of the
+ * segment, or -1. The store still holds the old files and the hunt's lock;
+ * the caller rebuilds the sidecars through store_open_archived() before
+ * closing it.
+ */
+long segment_archive(TreasureStore *store)
+{
+    char temp_path[MAX_PATH_LENGTH], path[MAX_PATH_LENGTH];
+    store_temp_path(temp_path, store->hunt_id, TREASURE_SEGMENT_FILE);
+    store_hunt_path(path, store->hunt_id, TREASURE_SEGMENT_FILE);
+
+    SegmentWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.header.magic = SEGMENT_MAGIC;
+    writer.header.version = SEGMENT_VERSION;
+    writer.header.record_size = sizeof(TreasureRecord);
+    writer.header.block_records = SEGMENT_BLOCK_RECORDS;
+    writer.header.generation = store->generation;
+    writer.end = (off_t)sizeof(SegmentHeader);
+    writer.fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    writer.blocks = malloc((size_t)(store->record_count / SEGMENT_BLOCK_RECORDS + 1) * sizeof(SegmentBlock));
+    writer.raw = malloc(SEGMENT_RAW_MAX);
+    writer.packed = malloc(LZ_BOUND(SEGMENT_RAW_MAX));
+    TreasureRecord *rows = malloc(SEGMENT_BLOCK_RECORDS * sizeof(TreasureRecord));
+    char *clues = malloc(SEGMENT_BLOCK_RECORDS * MAX_CLUE_LENGTH);
+
+    int ok = writer.fd != -1 && writer.blocks != NULL && writer.raw != NULL && writer.packed != NULL &&
+             rows != NULL && clues != NULL;
+    size_t pending = 0, clue_used = 0;
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, store);
+    while (ok && (record = store_cursor_next(&cursor)) != NULL)
+    {
+        TreasureRecord *row = &rows[pending++];
+        *row = *record;
+        char clue[MAX_CLUE_LENGTH];
+        store_read_clue(store, row, clue);
+        row->clue_length = (uint32_t)strlen(clue);
+        memcpy(clues + clue_used, clue, row->clue_length);
+        clue_used += row->clue_length;
+
+        if (pending == SEGMENT_BLOCK_RECORDS)
+        {
+            ok = write_block(&writer, rows, pending, clues, clue_used);
+            pending = 0;
+            clue_used = 0;
+        }
+    }
+    if (ok && pending > 0)
+        ok = write_block(&writer, rows, pending, clues, clue_used);
+
+    writer.header.index_offset = (uint64_t)writer.end;
+    size_t index_size = writer.header.block_count * sizeof(SegmentBlock);
+    ok = ok && write_all_at(writer.fd, writer.blocks, index_size, writer.end) &&
+         write_all_at(writer.fd, &writer.header, sizeof(writer.header), 0);
+
+    if (writer.fd != -1)
+        close(writer.fd);
+    free(writer.blocks);
+    free(writer.raw);
+    free(writer.packed);
+    free(rows);
+    free(clues);
+    if (!ok || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        return -1;
+    }
+
+    /* Readers find the segment once treasures.hot is gone, so it is unlinked first. */
+    store_hunt_path(path, store->hunt_id, TREASURE_HOT_FILE);
+    unlink(path);
+    store_hunt_path(path, store->hunt_id, TREASURE_CLUE_FILE);
+    unlink(path);
+    for (size_t i = 0; i < sizeof(sidecar_files) / sizeof(sidecar_files[0]); i++)
+    {
+        store_hunt_path(path, store->hunt_id, sidecar_files[i]);
+        unlink(path);
+    }
+    return (long)(writer.end + (off_t)index_size);
+}
+
+/*
+ * Writes treasures.hot and treasures.clues back from the segment opened in
+ * store and removes treasures.seg. The caller holds the hunt's lock. The
+ * clue file is renamed into place before the hot file that names it.
+ */
+int segment_restore(TreasureStore *store)
+{
+    TreasureSegment *segment = store->segment;
+    char hot_temp[MAX_PATH_LENGTH], clue_temp[MAX_PATH_LENGTH], path[MAX_PATH_LENGTH];
+    store_temp_path(hot_temp, store->hunt_id, TREASURE_HOT_FILE);
+    store_temp_path(clue_temp, store->hunt_id, TREASURE_CLUE_FILE);
+    int hot_fd = open(hot_temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int clue_fd = open(clue_temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    int ok = hot_fd != -1 && clue_fd != -1;
+    for (uint32_t b = 0; ok && b < segment->header.block_count; b++)
+    {
+        if (load_block(store, (long)b) == NULL || load_clues(store, (long)b, segment->blocks[b].clue_length) == NULL)
+        {
+            errno = EIO;
+            ok = 0;
+            break;
+        }
+        const SegmentBlock *entry = &segment->blocks[b];
+        off_t hot_offset = (off_t)sizeof(TreasureHotHeader) +
+                           (off_t)b * segment->header.block_records * (off_t)sizeof(TreasureRecord);
+        ok = write_all_at(hot_fd, segment->rows, segment->loaded_records * sizeof(TreasureRecord), hot_offset) &&
+             write_all_at(clue_fd, segment->clues.data, entry->clue_length, (off_t)entry->clue_base);
+    }
+
+    TreasureHotHeader header;
+    struct stat clue_stat;
+    memset(&header, 0, sizeof(header));
+    header.magic = STORE_HOT_MAGIC;
+    header.version = STORE_HOT_VERSION;
+    header.record_size = sizeof(TreasureRecord);
+    header.flags = STORE_HOT_COMMITTED;
+    header.record_count = segment->header.record_count;
+    header.generation = segment->header.generation;
+    ok = ok && fstat(clue_fd, &clue_stat) == 0;
+    header.clue_ino = ok ? (uint64_t)clue_stat.st_ino : 0;
+    ok = ok && write_all_at(hot_fd, &header, sizeof(header), 0);
+
+    if (hot_fd != -1)
+        close(hot_fd);
+    if (clue_fd != -1)
+        close(clue_fd);
+
+    char hot_path[MAX_PATH_LENGTH], clue_path[MAX_PATH_LENGTH];
+    store_hunt_path(hot_path, store->hunt_id, TREASURE_HOT_FILE);
+    store_hunt_path(clue_path, store->hunt_id, TREASURE_CLUE_FILE);
+    if (!ok || rename(clue_temp, clue_path) != 0 || rename(hot_temp, hot_path) != 0)
+    {
+        unlink(hot_temp);
+        unlink(clue_temp);
+        return 0;
+    }
+    store_hunt_path(path, store->hunt_id, TREASURE_SEGMENT_FILE);
+    unlink(path);
+    return 1;
+}
@@ -0,0 +1,103 @@
+#ifndef TREASURE_SEGMENT_H
+#define TREASURE_SEGMENT_H
+
+#include <stdint.h>
+#include "treasure.h"
+#include "treasure_store.h"
+
+/*
+ * Archived hunts. --archive replaces treasures.hot and treasures.clues
+ * with one compressed treasures.seg; treasures.users stays as it is.
+ *
+ * The file is a SegmentHeader, the blocks, then the block index of
+ * block_count SegmentBlock entries at index_offset. Block b holds the
+ * live records from slot b * block_records on in three parts: their ids,
+ * their other fields column by column (latitudes, longitudes, clue
+ * lengths, users, values), and their clue text. Each part is compressed
+ * separately with treasure_lz (and kept as is when that does not make it
+ * smaller), so column scans decode only the middle part and scans that
+ * never look at clues never decode them. Clue offsets are not
+ * stored: each block's clues are the range of the hunt's clue stream
+ * starting at clue_base, in slot order, so they are rebuilt while
+ * decoding and restoring writes the same stream back.
+ *
+ * Readers open the segment instead of the hot file and decode one block
+ * at a time into the store, so a scan decompresses each block once. A
+ * lookup by slot decodes the block's fields but its ids and clues only up
+ * to the record asked for, carrying on from there for a later record of
+ * the same block, so printing a few matches from a block does not decode
+ * the rest of it. --archive rebuilds the sidecars against the segment's
+ * slots before it releases the lock. The first writer to open an archived
+ * hunt restores the hot layout under the hunt's lock, the way a legacy
+ * treasures.dat is migrated.
+ */
+
+#define SEGMENT_MAGIC 0x47455354u
+#define SEGMENT_VERSION 2
+#define SEGMENT_BLOCK_RECORDS STORE_SCAN_BATCH
+#define SEGMENT_FIELD_BYTES (2 * sizeof(double) + 3 * sizeof(uint32_t))
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t block_records;
+    uint64_t record_count;
+    uint64_t clue_bytes;
+    uint64_t index_offset;
+    uint32_t block_count;
+    uint32_t generation;
+    uint32_t max_raw;
+    uint32_t max_packed;
+    uint32_t reserved[2];
+} SegmentHeader;
+
+/* The parts follow each other from offset; ids and fields decode to a fixed size per record. */
+typedef struct
+{
+    uint64_t offset;
+    uint64_t clue_base;
+    uint32_t id_packed_length;
+    uint32_t packed_length;
+    uint32_t clue_packed_length;
+    uint32_t clue_length;
+} SegmentBlock;
+
+/* The ids or the clues of one block, decoded only as far as readers have asked for. */
+typedef struct
+{
+    long block;     /* block whose part is in data, -1 for none */
+    size_t used;    /* packed bytes decoded so far */
+    size_t decoded; /* bytes of data decoded so far */
+    char *packed;
+    char *data;
+} SegmentPart;
+
+typedef struct TreasureSegment
+{
+    SegmentHeader header;
+    SegmentBlock *blocks;
+    char *packed;
+    char *raw;
+    SegmentPart ids;
+    SegmentPart clues;
+    long loaded;        /* block decoded into rows, -1 for none */
+    long fields_loaded; /* block whose field columns are in raw, -1 for none */
+    size_t offset_row;  /* row of fields_loaded whose clue offset is in row_offset */
+    uint64_t row_offset;
+    size_t loaded_records;
+    TreasureRecord rows[SEGMENT_BLOCK_RECORDS];
+} TreasureSegment;
+
+int segment_exists(const char *hunt_id);
+int segment_open(TreasureStore *store);
+void segment_free(TreasureStore *store);
+int segment_read_record(TreasureStore *store, long slot, TreasureRecord *out);
+size_t segment_read_records(TreasureStore *store, long slot, TreasureRecord *out);
+size_t segment_read_columns(TreasureStore *store, long slot, double *latitude, double *longitude, int32_t *value);
+int segment_read_clue(TreasureStore *store, const TreasureRecord *record, char *clue);
+long segment_archive(TreasureStore *store);
+int segment_restore(TreasureStore *store);
+
+#endif
@@ -0,0 +1,1087 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include "treasure_store.h"
+#include "treasure_segment.h"
+
+#define HOT_HEADER_SIZE ((off_t)sizeof(TreasureHotHeader))
+#define MIGRATE_BATCH 256
+#define OPEN_ATTEMPTS 8
+
+/* Builds hunt_id/name in out (MAX_PATH_LENGTH bytes); returns 0 if it does not fit. */
+int store_hunt_path(char *out, const char *hunt_id, const char *name)
+{
+    size_t id_length = strlen(hunt_id), name_length = strlen(name);
+    if (id_length + 1 + name_length >= MAX_PATH_LENGTH)
+    {
+        out[0] = '\0';
+        return 0;
+    }
+    memcpy(out, hunt_id, id_length);
+    out[id_length] = '/';
+    memcpy(out + id_length + 1, name, name_length + 1);
+    return 1;
+}
+
+/* Temporary name for rebuilding a sidecar; the thread ID keeps monitor workers from sharing one. */
+void store_temp_path(char *out, const char *hunt_id, const char *name)
+{
+    snprintf(out, MAX_PATH_LENGTH, "%s/%s.%d.%ld.tmp", hunt_id, name, (int)getpid(), (long)syscall(SYS_gettid));
+}
+
+static int write_all_at(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 1;
+}
+
+static off_t file_size(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return -1;
+    return st.st_size;
+}
+
+static uint64_t hash_name(const char *name)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < MAX_USERNAME_LENGTH && name[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void init_store(TreasureStore *store, const char *hunt_id, int writable)
+{
+    memset(store, 0, sizeof(*store));
+    snprintf(store->hunt_id, sizeof(store->hunt_id), "%s", hunt_id);
+    store->writable = writable;
+    store->hot_fd = -1;
+    store->clue_fd = -1;
+    store->user_fd = -1;
+    store->lock_fd = -1;
+}
+
+int store_stamp_now(TreasureStore *store, StoreStamp *stamp)
+{
+    struct stat st;
+    if (fstat(store->hot_fd, &st) == -1)
+        return 0;
+    stamp->ino = (uint64_t)st.st_ino;
+    stamp->size = (int64_t)st.st_size;
+    stamp->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    stamp->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    return 1;
+}
+
+/*
+ * Takes the hunt's writer lock and returns its descriptor, or -1. The lock
+ * file is checked again after flock() returns: a waiter fails if the hunt
+ * was removed in the meantime and starts over if the file was replaced.
+ */
+int store_lock_hunt(const char *hunt_id)
+{
+    char path[MAX_PATH_LENGTH];
+    if (!store_hunt_path(path, hunt_id, TREASURE_LOCK_FILE))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    for (;;)
+    {
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+            return -1;
+
+        int status;
+        do
+        {
+            status = flock(fd, LOCK_EX);
+        } while (status == -1 && errno == EINTR);
+
+        struct stat held, current;
+        if (status == -1 || fstat(fd, &held) == -1 || stat(path, &current) == -1)
+        {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        if (held.st_ino == current.st_ino)
+            return fd;
+        close(fd);
+    }
+}
+
+static void unmap_files(TreasureStore *store)
+{
+    if (store->hot_map != NULL)
+        munmap((void *)store->hot_map, store->hot_map_size);
+    if (store->clue_map != NULL)
+        munmap((void *)store->clue_map, store->clue_map_size);
+    store->hot_map = NULL;
+    store->hot_map_size = 0;
+    store->clue_map = NULL;
+    store->clue_map_size = 0;
+}
+
+static void close_files(TreasureStore *store)
+{
+    unmap_files(store);
+    segment_free(store);
+    if (store->hot_fd != -1)
+        close(store->hot_fd);
+    if (store->clue_fd != -1)
+        close(store->clue_fd);
+    if (store->user_fd != -1)
+        close(store->user_fd);
+    store->hot_fd = -1;
+    store->clue_fd = -1;
+    store->user_fd = -1;
+}
+
+static int write_hot_header(int fd, uint64_t record_count, uint64_t clue_ino, uint32_t generation)
+{
+    TreasureHotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = STORE_HOT_MAGIC;
+    header.version = STORE_HOT_VERSION;
+    header.record_size = sizeof(TreasureRecord);
+    header.flags = STORE_HOT_COMMITTED;
+    header.record_count = record_count;
+    header.clue_ino = clue_ino;
+    header.generation = generation;
+    return write_all_at(fd, &header, sizeof(header), 0);
+}
+
+static int read_hot_header(int fd, TreasureHotHeader *header)
+{
+    if (pread(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header))
+        return 0;
+    return header->magic == STORE_HOT_MAGIC &&
+           header->version == STORE_HOT_VERSION &&
+           header->record_size == sizeof(TreasureRecord);
+}
+
+static uint64_t file_ino(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return 0;
+    return (uint64_t)st.st_ino;
+}
+
+/* Stores one header field in place; the 8- and 4-byte fields are aligned, so readers see old or new. */
+static int publish_field(TreasureStore *store, const void *value, size_t size, size_t offset)
+{
+    if (!write_all_at(store->hot_fd, value, size, (off_t)offset))
+        return 0;
+    store_stamp_now(store, &store->stamp);
+    return 1;
+}
+
+/* Creates an empty users/clues pair and a hot file named hot_name holding only the header. */
+static int create_files(TreasureStore *store, const char *hot_name)
+{
+    char path[MAX_PATH_LENGTH];
+
+    store_hunt_path(path, store->hunt_id, TREASURE_USER_FILE);
+    store->user_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    store_hunt_path(path, store->hunt_id, TREASURE_CLUE_FILE);
+    store->clue_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    store_hunt_path(path, store->hunt_id, hot_name);
+    store->hot_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (store->user_fd == -1 || store->clue_fd == -1 || store->hot_fd == -1 ||
+        !write_hot_header(store->hot_fd, 0, file_ino(store->clue_fd), 1))
+    {
+        close_files(store);
+        return 0;
+    }
+    store->record_count = 0;
+    store->generation = 1;
+    store_stamp_now(store, &store->stamp);
+    return 1;
+}
+
+/*
+ * Takes the store's snapshot from the hot header. Returns 0 when the clue
+ * file we opened is not the one the header names, which means compaction
+ * swapped the pair between our opens, and -1 for a bad header. A header
+ * from before the committed count existed is upgraded by the first writer.
+ */
+static int load_snapshot(TreasureStore *store)
+{
+    TreasureHotHeader header;
+    if (!store_stamp_now(store, &store->stamp) || !read_hot_header(store->hot_fd, &header))
+        return -1;
+
+    if (header.flags & STORE_HOT_COMMITTED)
+    {
+        if (header.clue_ino != file_ino(store->clue_fd))
+            return 0;
+        store->record_count = header.record_count;
+        store->generation = header.generation;
+        return 1;
+    }
+
+    off_t size = file_size(store->hot_fd);
+    store->record_count = size > HOT_HEADER_SIZE ? (uint64_t)(size - HOT_HEADER_SIZE) / sizeof(TreasureRecord) : 0;
+    store->generation = UINT32_MAX;
+    if (store->writable)
+    {
+        if (!write_hot_header(store->hot_fd, store->record_count, file_ino(store->clue_fd), 1))
+            return -1;
+        store->generation = 1;
+        store_stamp_now(store, &store->stamp);
+    }
+    return 1;
+}
+
+static int open_files(TreasureStore *store)
+{
+    char path[MAX_PATH_LENGTH];
+    int flags = store->writable ? O_RDWR | O_CREAT : O_RDONLY;
+
+    for (int attempt = 0; attempt < OPEN_ATTEMPTS; attempt++)
+    {
+        store_hunt_path(path, store->hunt_id, TREASURE_HOT_FILE);
+        store->hot_fd = open(path, store->writable ? O_RDWR : O_RDONLY);
+        store_hunt_path(path, store->hunt_id, TREASURE_CLUE_FILE);
+        store->clue_fd = open(path, flags, 0644);
+        store_hunt_path(path, store->hunt_id, TREASURE_USER_FILE);
+        store->user_fd = open(path, flags, 0644);
+
+        if (store->hot_fd == -1 || store->clue_fd == -1 || store->user_fd == -1)
+        {
+            close_files(store);
+            return 0;
+        }
+
+        int status = load_snapshot(store);
+        if (status == 1)
+            return 1;
+        close_files(store);
+        if (status == -1)
+        {
+            errno = EINVAL;
+            return 0;
+        }
+
+        /* The compacting writer is between its two renames; give it a moment. */
+        struct timespec pause = {0, 1000000L << attempt};
+        nanosleep(&pause, NULL);
+    }
+    errno = EAGAIN;
+    return 0;
+}
+
+int store_hunt_exists(const char *hunt_id)
+{
+    char path[MAX_PATH_LENGTH];
+    struct stat st;
+
+    if (strlen(hunt_id) > STORE_MAX_HUNT_ID)
+        return 0;
+    store_hunt_path(path, hunt_id, TREASURE_HOT_FILE);
+    if ((stat(path, &st) == 0 && S_ISREG(st.st_mode)) || segment_exists(hunt_id))
+        return 1;
+    store_hunt_path(path, hunt_id, TREASURE_FILE);
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static int compare_hunt_names(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+/* Fills *hunts with the hunt directories under the current directory, sorted by name; -1 on error. */
+int store_list_hunts(char (**hunts)[MAX_PATH_LENGTH])
+{
+    DIR *dir = opendir(".");
+    if (dir == NULL)
+    {
+        return -1;
+    }
+
+    char (*names)[MAX_PATH_LENGTH] = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            !store_hunt_exists(entry->d_name))
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            char (*grown)[MAX_PATH_LENGTH] = realloc(names, capacity * sizeof(*names));
+            if (grown == NULL)
+            {
+                break;
+            }
+            names = grown;
+        }
+        snprintf(names[count++], MAX_PATH_LENGTH, "%s", entry->d_name);
+    }
+    closedir(dir);
+
+    qsort(names, count, sizeof(*names), compare_hunt_names);
+    *hunts = names;
+    return count;
+}
+
+/* Appends the live records of a legacy treasures.dat to a store opened for writing. */
+static int copy_legacy(int legacy_fd, TreasureStore *store, uint64_t *live_count)
+{
+    Treasure batch[MIGRATE_BATCH];
+    ssize_t nbytes;
+    int ok = 1;
+    *live_count = 0;
+    while (ok && (nbytes = read(legacy_fd, batch, sizeof(batch))) >= (ssize_t)sizeof(Treasure))
+    {
+        size_t live = 0;
+        for (size_t i = 0; i < (size_t)nbytes / sizeof(Treasure); i++)
+        {
+            if (TREASURE_IS_DEAD(&batch[i]))
+                continue;
+            batch[i].id[MAX_ID_LENGTH - 1] = '\0';
+            batch[i].username[MAX_USERNAME_LENGTH - 1] = '\0';
+            batch[i].clue[MAX_CLUE_LENGTH - 1] = '\0';
+            batch[live++] = batch[i];
+        }
+        ok = live == 0 || store_append(store, batch, live, NULL);
+        *live_count += live;
+    }
+    return ok && nbytes >= 0;
+}
+
+/*
+ * Readers of a hunt still stored as treasures.dat get the split layout
+ * built in anonymous memory files, so they never write to the hunt. The
+ * conversion happens for real on the first writer open or --migrate.
+ */
+static int open_legacy(TreasureStore *store)
+{
+    char path[MAX_PATH_LENGTH];
+    store_hunt_path(path, store->hunt_id, TREASURE_FILE);
+    int legacy_fd = open(path, O_RDONLY);
+    if (legacy_fd == -1)
+        return 0;
+
+    TreasureStore scratch;
+    uint64_t live_count;
+    init_store(&scratch, store->hunt_id, 1);
+    scratch.user_fd = memfd_create(TREASURE_USER_FILE, MFD_CLOEXEC);
+    scratch.clue_fd = memfd_create(TREASURE_CLUE_FILE, MFD_CLOEXEC);
+    scratch.hot_fd = memfd_create(TREASURE_HOT_FILE, MFD_CLOEXEC);
+    int ok = scratch.user_fd != -1 && scratch.clue_fd != -1 && scratch.hot_fd != -1 &&
+             write_hot_header(scratch.hot_fd, 0, file_ino(scratch.clue_fd), 1);
+    scratch.generation = 1;
+    ok = ok && copy_legacy(legacy_fd, &scratch, &live_count);
+    int saved = errno;
+    close(legacy_fd);
+
+    /* The memory files move to the read-only store; the scratch store keeps only its dictionary. */
+    store->hot_fd = scratch.hot_fd;
+    store->clue_fd = scratch.clue_fd;
+    store->user_fd = scratch.user_fd;
+    scratch.hot_fd = scratch.clue_fd = scratch.user_fd = -1;
+    store_close(&scratch);
+    if (ok && load_snapshot(store) == 1)
+    {
+        store->legacy = 1;
+        return 1;
+    }
+    close_files(store);
+    errno = ok ? EINVAL : saved;
+    return 0;
+}
+
+/* Brings an archived hunt back to the hot layout for a writer holding the lock. */
+static int restore_segment(TreasureStore *store)
+{
+    int ok = segment_open(store) && segment_restore(store);
+    int saved = errno;
+    close_files(store);
+    errno = saved;
+    return ok;
+}
+
+int store_open(TreasureStore *store, const char *hunt_id, int writable)
+{
+    char hot_path[MAX_PATH_LENGTH];
+    char legacy_path[MAX_PATH_LENGTH];
+
+    init_store(store, hunt_id, writable);
+    if (strlen(hunt_id) > STORE_MAX_HUNT_ID)
+    {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    store_hunt_path(hot_path, hunt_id, TREASURE_HOT_FILE);
+    store_hunt_path(legacy_path, hunt_id, TREASURE_FILE);
+
+    /* Only writers convert a legacy hunt; readers keep reading treasures.dat until one does. */
+    if (writable && access(hot_path, F_OK) == -1 && access(legacy_path, F_OK) == 0 && !store_migrate(hunt_id))
+        return 0;
+    if (writable && (store->lock_fd = store_lock_hunt(hunt_id)) == -1)
+        return 0;
+
+    int ok;
+    if (access(hot_path, F_OK) == 0)
+    {
+        ok = open_files(store);
+    }
+    else if (segment_exists(hunt_id))
+    {
+        ok = writable ? restore_segment(store) && open_files(store) : segment_open(store);
+    }
+    else if (writable)
+    {
+        ok = create_files(store, TREASURE_HOT_FILE);
+    }
+    else if (access(legacy_path, F_OK) == 0)
+    {
+        ok = open_legacy(store);
+    }
+    else
+    {
+        errno = ENOENT;
+        ok = 0;
+    }
+
+    /* An archive or a restore may have swapped the layouts between the checks above. */
+    if (!ok && !writable && errno == ENOENT)
+    {
+        ok = open_files(store) || segment_open(store);
+    }
+
+    if (!ok && store->lock_fd != -1)
+    {
+        int saved = errno;
+        close(store->lock_fd);
+        store->lock_fd = -1;
+        errno = saved;
+    }
+    return ok;
+}
+
+/*
+ * Opens the segment of a hunt that was just archived through a writable
+ * store, which still holds the hunt's lock, so its sidecars can be built
+ * against the segment's slots before any reader needs them.
+ */
+int store_open_archived(TreasureStore *store, const char *hunt_id)
+{
+    init_store(store, hunt_id, 0);
+    return segment_open(store);
+}
+
+void store_close(TreasureStore *store)
+{
+    close_files(store);
+    if (store->lock_fd != -1)
+        close(store->lock_fd);
+    store->lock_fd = -1;
+    if (store->users_mapped)
+        munmap(store->users, (size_t)store->user_count * MAX_USERNAME_LENGTH);
+    else
+        free(store->users);
+    store->users_mapped = 0;
+    free(store->user_table);
+    store->users = NULL;
+    store->user_table = NULL;
+    store->user_count = 0;
+    store->user_capacity = 0;
+    store->users_flushed = 0;
+    store->user_table_capacity = 0;
+}
+
+long store_record_count(TreasureStore *store)
+{
+    return (long)store->record_count;
+}
+
+/* Byte offset of a slot in treasures.hot, for callers that read the file directly. */
+long store_record_offset(long slot)
+{
+    return (long)HOT_HEADER_SIZE + slot * (long)sizeof(TreasureRecord);
+}
+
+static off_t fd_bytes(int fd)
+{
+    off_t size = fd == -1 ? 0 : file_size(fd);
+    return size < 0 ? 0 : size;
+}
+
+/* Bytes the hunt's records, clues and usernames take on disk, whichever layout it uses. */
+long long store_disk_bytes(TreasureStore *store)
+{
+    struct stat st;
+    if (store->legacy)
+        return store_data_stat(store, &st) ? (long long)st.st_size : 0;
+    return (long long)(fd_bytes(store->hot_fd) + fd_bytes(store->clue_fd) + fd_bytes(store->user_fd));
+}
+
+/* Stats the file holding the hunt's records: treasures.dat for a legacy hunt, not its in-memory copy. */
+int store_data_stat(TreasureStore *store, struct stat *st)
+{
+    if (!store->legacy)
+        return fstat(store->hot_fd, st) == 0;
+
+    char path[MAX_PATH_LENGTH];
+    store_hunt_path(path, store->hunt_id, TREASURE_FILE);
+    return stat(path, st) == 0;
+}
+
+static void *map_file(int fd, size_t *size)
+{
+    off_t length = file_size(fd);
+    if (length <= 0)
+        return NULL;
+
+    void *map = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = (size_t)length;
+    return map;
+}
+
+/*
+ * Maps treasures.hot and treasures.clues read-only and applies advice
+ * (MADV_SEQUENTIAL for scans, MADV_RANDOM for lookups). Records appended
+ * after the mapping was made are still reachable through pread.
+ */
+int store_map(TreasureStore *store, int advice)
+{
+    if (store->segment != NULL)
+        return 0;
+    if (store->hot_map == NULL)
+    {
+        store->hot_map = map_file(store->hot_fd, &store->hot_map_size);
+        store->clue_map = map_file(store->clue_fd, &store->clue_map_size);
+    }
+    if (store->hot_map == NULL)
+        return 0;
+
+    madvise((void *)store->hot_map, store->hot_map_size, advice);
+    if (store->clue_map != NULL)
+        madvise((void *)store->clue_map, store->clue_map_size, advice);
+    return 1;
+}
+
+static long mapped_records(const TreasureStore *store)
+{
+    if (store->hot_map == NULL || store->hot_map_size < (size_t)HOT_HEADER_SIZE)
+        return 0;
+    uint64_t records = (store->hot_map_size - (size_t)HOT_HEADER_SIZE) / sizeof(TreasureRecord);
+    return (long)(records < store->record_count ? records : store->record_count);
+}
+
+/* Slots past the snapshot do not exist for this store; removals after it are not reported. */
+int store_read_record(TreasureStore *store, long slot, TreasureRecord *out)
+{
+    if (slot < 0 || (uint64_t)slot >= store->record_count)
+        return 0;
+    store->bytes_read += sizeof(*out);
+    if (store->segment != NULL)
+        return segment_read_record(store, slot, out);
+    if (slot < mapped_records(store))
+    {
+        memcpy(out, store->hot_map + HOT_HEADER_SIZE + (size_t)slot * sizeof(TreasureRecord), sizeof(*out));
+    }
+    else
+    {
+        off_t offset = HOT_HEADER_SIZE + (off_t)slot * (off_t)sizeof(TreasureRecord);
+        if (pread(store->hot_fd, out, sizeof(*out), offset) != (ssize_t)sizeof(*out))
+            return 0;
+    }
+    if (out->deleted > store->generation)
+        out->deleted = 0;
+    return 1;
+}
+
+int store_read_clue(TreasureStore *store, const TreasureRecord *record, char *clue)
+{
+    if (store->segment != NULL)
+        return segment_read_clue(store, record, clue);
+    size_t length = record->clue_length < MAX_CLUE_LENGTH ? record->clue_length : MAX_CLUE_LENGTH - 1;
+    store->bytes_read += length;
+    if (store->clue_map != NULL && record->clue_offset + length <= store->clue_map_size)
+    {
+        memcpy(clue, store->clue_map + record->clue_offset, length);
+        clue[length] = '\0';
+        return 1;
+    }
+
+    ssize_t n = length > 0 ? pread(store->clue_fd, clue, length, (off_t)record->clue_offset) : 0;
+    if (n != (ssize_t)length)
+    {
+        clue[0] = '\0';
+        return 0;
+    }
+    clue[length] = '\0';
+    return 1;
+}
+
+int store_read_treasure(TreasureStore *store, long slot, Treasure *out)
+{
+    TreasureRecord record;
+    if (!store_read_record(store, slot, &record))
+        return 0;
+
+    memset(out, 0, sizeof(*out));
+    memcpy(out->id, record.id, MAX_ID_LENGTH);
+    snprintf(out->username, MAX_USERNAME_LENGTH, "%s", store_username(store, record.user));
+    out->latitude = record.latitude;
+    out->longitude = record.longitude;
+    out->value = record.value;
+    store_read_clue(store, &record, out->clue);
+    return 1;
+}
+
+int store_load_users(TreasureStore *store)
+{
+    if (store->users != NULL)
+        return 1;
+
+    off_t size = file_size(store->user_fd);
+    if (size < 0)
+        return 0;
+
+    /* Readers share the page cache copy of the dictionary instead of reading it in. */
+    if (!store->writable && size >= MAX_USERNAME_LENGTH)
+    {
+        size_t mapped_size = (size_t)(size - size % MAX_USERNAME_LENGTH);
+        void *map = mmap(NULL, mapped_size, PROT_READ, MAP_SHARED, store->user_fd, 0);
+        if (map != MAP_FAILED)
+        {
+            store->users = map;
+            store->users_mapped = 1;
+            store->user_count = (uint32_t)(mapped_size / MAX_USERNAME_LENGTH);
+            store->user_capacity = store->user_count;
+            store->users_flushed = store->user_count;
+            store->bytes_read += mapped_size;
+            return 1;
+        }
+    }
+
+    uint32_t count = (uint32_t)(size / MAX_USERNAME_LENGTH);
+    uint32_t capacity = count > 16 ? count : 16;
+    store->users = malloc((size_t)capacity * MAX_USERNAME_LENGTH);
+    if (store->users == NULL)
+        return 0;
+
+    size_t want = (size_t)count * MAX_USERNAME_LENGTH;
+    size_t got = 0;
+    while (got < want)
+    {
+        ssize_t n = pread(store->user_fd, (char *)store->users + got, want - got, (off_t)got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+    }
+
+    store->user_count = (uint32_t)(got / MAX_USERNAME_LENGTH);
+    store->user_capacity = capacity;
+    store->bytes_read += got;
+    store->users_flushed = store->user_count;
+    return 1;
+}
+
+const char *store_username(TreasureStore *store, uint32_t user)
+{
+    if (store->users != NULL && user < store->user_count)
+    {
+        return store->users[user];
+    }
+
+    off_t offset = (off_t)user * MAX_USERNAME_LENGTH;
+    if (pread(store->user_fd, store->name_buf, MAX_USERNAME_LENGTH, offset) != MAX_USERNAME_LENGTH)
+        store->name_buf[0] = '\0';
+    store->name_buf[MAX_USERNAME_LENGTH - 1] = '\0';
+    return store->name_buf;
+}
+
+static void place_user(TreasureStore *store, uint32_t user)
+{
+    uint32_t mask = store->user_table_capacity - 1;
+    uint32_t i = (uint32_t)hash_name(store->users[user]) & mask;
+    while (store->user_table[i] != 0)
+        i = (i + 1) & mask;
+    store->user_table[i] = user + 1;
+}
+
+static int grow_user_table(TreasureStore *store)
+{
+    uint32_t capacity = store->user_table_capacity ? store->user_table_capacity * 2 : 64;
+    while (capacity < store->user_count * 2 + 2)
+        capacity *= 2;
+
+    uint32_t *table = calloc(capacity, sizeof(uint32_t));
+    if (table == NULL)
+        return 0;
+
+    free(store->user_table);
+    store->user_table = table;
+    store->user_table_capacity = capacity;
+    for (uint32_t u = 0; u < store->user_count; u++)
+        place_user(store, u);
+    return 1;
+}
+
+/* Returns the dictionary number for username, adding it if it is new. */
+int store_intern_user(TreasureStore *store, const char *username, uint32_t *user)
+{
+    if (!store_load_users(store))
+        return 0;
+    if ((store->user_count + 1) * 2 > store->user_table_capacity && !grow_user_table(store))
+        return 0;
+
+    uint32_t mask = store->user_table_capacity - 1;
+    uint32_t i = (uint32_t)hash_name(username) & mask;
+    while (store->user_table[i] != 0)
+    {
+        uint32_t candidate = store->user_table[i] - 1;
+        if (strncmp(store->users[candidate], username, MAX_USERNAME_LENGTH) == 0)
+        {
+            *user = candidate;
+            return 1;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (store->user_count == store->user_capacity)
+    {
+        uint32_t capacity = store->user_capacity * 2;
+        char (*users)[MAX_USERNAME_LENGTH] = realloc(store->users, (size_t)capacity * MAX_USERNAME_LENGTH);
+        if (users == NULL)
+            return 0;
+        store->users = users;
+        store->user_capacity = capacity;
+    }
+
+    *user = store->user_count++;
+    memset(store->users[*user], 0, MAX_USERNAME_LENGTH);
+    strncpy(store->users[*user], username, MAX_USERNAME_LENGTH - 1);
+    store->user_table[i] = *user + 1;
+    return 1;
+}
+
+static int flush_users(TreasureStore *store)
+{
+    if (store->users_flushed == store->user_count)
+        return 1;
+
+    size_t len = (size_t)(store->user_count - store->users_flushed) * MAX_USERNAME_LENGTH;
+    off_t offset = (off_t)store->users_flushed * MAX_USERNAME_LENGTH;
+    if (!write_all_at(store->user_fd, store->users[store->users_flushed], len, offset))
+        return 0;
+    store->users_flushed = store->user_count;
+    return 1;
+}
+
+int store_append(TreasureStore *store, const Treasure *treasures, size_t count, long *first_slot)
+{
+    off_t clue_end = file_size(store->clue_fd);
+    long slot = (long)store->record_count;
+    if (clue_end < 0)
+        return 0;
+
+    TreasureRecord *records = calloc(count, sizeof(TreasureRecord));
+    char *clues = malloc(count * MAX_CLUE_LENGTH);
+    if (records == NULL || clues == NULL)
+    {
+        free(records);
+        free(clues);
+        return 0;
+    }
+
+    size_t clue_used = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const Treasure *t = &treasures[i];
+        TreasureRecord *r = &records[i];
+        size_t clue_length = strnlen(t->clue, MAX_CLUE_LENGTH - 1);
+
+        if (!store_intern_user(store, t->username, &r->user))
+        {
+            free(records);
+            free(clues);
+            return 0;
+        }
+        strncpy(r->id, t->id, MAX_ID_LENGTH - 1);
+        r->latitude = t->latitude;
+        r->longitude = t->longitude;
+        r->value = t->value;
+        r->clue_offset = (uint64_t)clue_end + clue_used;
+        r->clue_length = (uint32_t)clue_length;
+        memcpy(clues + clue_used, t->clue, clue_length);
+        clue_used += clue_length;
+    }
+
+    /* Everything the new records point at is written before the count that makes them visible. */
+    off_t hot_offset = HOT_HEADER_SIZE + (off_t)slot * (off_t)sizeof(TreasureRecord);
+    uint64_t record_count = store->record_count + count;
+    int ok = flush_users(store) &&
+             write_all_at(store->clue_fd, clues, clue_used, clue_end) &&
+             write_all_at(store->hot_fd, records, count * sizeof(TreasureRecord), hot_offset) &&
+             publish_field(store, &record_count, sizeof(record_count), offsetof(TreasureHotHeader, record_count));
+
+    free(records);
+    free(clues);
+    if (ok)
+        store->record_count = record_count;
+    if (ok && first_slot != NULL)
+        *first_slot = slot;
+    return ok;
+}
+
+/* Stamps the record with the next generation, then publishes that generation. */
+int store_mark_dead(TreasureStore *store, long slot)
+{
+    uint32_t generation = store->generation + 1;
+    off_t offset = HOT_HEADER_SIZE + (off_t)slot * (off_t)sizeof(TreasureRecord) +
+                   (off_t)offsetof(TreasureRecord, deleted);
+    if (!write_all_at(store->hot_fd, &generation, sizeof(generation), offset) ||
+        !publish_field(store, &generation, sizeof(generation), offsetof(TreasureHotHeader, generation)))
+        return 0;
+    store->generation = generation;
+    return 1;
+}
+
+/* Rewrites treasures.hot and treasures.clues without dead records; returns the number reclaimed or -1. */
+long store_compact(TreasureStore *store)
+{
+    char hot_path[MAX_PATH_LENGTH], hot_temp[MAX_PATH_LENGTH];
+    char clue_path[MAX_PATH_LENGTH], clue_temp[MAX_PATH_LENGTH];
+    store_hunt_path(hot_path, store->hunt_id, TREASURE_HOT_FILE);
+    store_hunt_path(hot_temp, store->hunt_id, TREASURE_HOT_FILE ".tmp");
+    store_hunt_path(clue_path, store->hunt_id, TREASURE_CLUE_FILE);
+    store_hunt_path(clue_temp, store->hunt_id, TREASURE_CLUE_FILE ".tmp");
+
+    int hot_fd = open(hot_temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int clue_fd = open(clue_temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (hot_fd == -1 || clue_fd == -1 || !write_hot_header(hot_fd, 0, 0, store->generation))
+    {
+        if (hot_fd != -1)
+            close(hot_fd);
+        if (clue_fd != -1)
+            close(clue_fd);
+        unlink(hot_temp);
+        unlink(clue_temp);
+        return -1;
+    }
+
+    long total = store_record_count(store);
+    long kept = 0;
+    off_t clue_end = 0;
+    off_t hot_end = HOT_HEADER_SIZE;
+    int ok = 1;
+    TreasureRecord out[STORE_SCAN_BATCH];
+    char clues[STORE_SCAN_BATCH * MAX_CLUE_LENGTH];
+    size_t pending = 0, clue_used = 0;
+
+    StoreCursor cursor;
+    const TreasureRecord *record;
+    store_cursor_open(&cursor, store);
+    while (ok && (record = store_cursor_next(&cursor)) != NULL)
+    {
+        TreasureRecord *r = &out[pending++];
+        *r = *record;
+        char clue[MAX_CLUE_LENGTH];
+        store_read_clue(store, r, clue);
+        r->clue_length = (uint32_t)strlen(clue);
+        memcpy(clues + clue_used, clue, r->clue_length);
+        r->clue_offset = (uint64_t)(clue_end + (off_t)clue_used);
+        clue_used += r->clue_length;
+
+        if (pending == STORE_SCAN_BATCH)
+        {
+            ok = write_all_at(clue_fd, clues, clue_used, clue_end) &&
+                 write_all_at(hot_fd, out, pending * sizeof(TreasureRecord), hot_end);
+            clue_end += (off_t)clue_used;
+            hot_end += (off_t)(pending * sizeof(TreasureRecord));
+            kept += (long)pending;
+            pending = 0;
+            clue_used = 0;
+        }
+    }
+    if (ok && pending > 0)
+    {
+        ok = write_all_at(clue_fd, clues, clue_used, clue_end) &&
+             write_all_at(hot_fd, out, pending * sizeof(TreasureRecord), hot_end);
+        kept += (long)pending;
+    }
+    ok = ok && write_hot_header(hot_fd, (uint64_t)kept, file_ino(clue_fd), store->generation);
+
+    close(hot_fd);
+    close(clue_fd);
+
+    if (!ok || rename(clue_temp, clue_path) != 0 || rename(hot_temp, hot_path) != 0)
+    {
+        unlink(hot_temp);
+        unlink(clue_temp);
+        return -1;
+    }
+
+    close_files(store);
+    if (!open_files(store))
+        return -1;
+    return total - kept;
+}
+
+/*
+ * Converts a legacy treasures.dat into the split layout. treasures.hot is
+ * renamed into place last, and only once its header holds every live
+ * record; treasures.dat is then kept as treasures.dat.bak.
+ */
+int store_migrate(const char *hunt_id)
+{
+    char legacy_path[MAX_PATH_LENGTH], backup_path[MAX_PATH_LENGTH], index_path[MAX_PATH_LENGTH];
+    char hot_path[MAX_PATH_LENGTH], hot_temp[MAX_PATH_LENGTH];
+    store_hunt_path(legacy_path, hunt_id, TREASURE_FILE);
+    store_hunt_path(backup_path, hunt_id, TREASURE_BACKUP_FILE);
+    store_hunt_path(index_path, hunt_id, TREASURE_INDEX_FILE);
+    store_hunt_path(hot_path, hunt_id, TREASURE_HOT_FILE);
+    store_hunt_path(hot_temp, hunt_id, TREASURE_HOT_FILE ".tmp");
+
+    int lock_fd = store_lock_hunt(hunt_id);
+    if (lock_fd == -1)
+        return 0;
+    /* Someone else may have migrated the hunt while we waited for the lock. */
+    if (access(hot_path, F_OK) == 0)
+    {
+        close(lock_fd);
+        return 1;
+    }
+
+    int legacy_fd = open(legacy_path, O_RDONLY);
+    if (legacy_fd == -1)
+    {
+        close(lock_fd);
+        return 0;
+    }
+
+    TreasureStore store;
+    init_store(&store, hunt_id, 1);
+    if (!create_files(&store, TREASURE_HOT_FILE ".tmp"))
+    {
+        close(legacy_fd);
+        close(lock_fd);
+        return 0;
+    }
+
+    uint64_t live_count;
+    int ok = copy_legacy(legacy_fd, &store, &live_count);
+    close(legacy_fd);
+
+    TreasureHotHeader header;
+    ok = ok && read_hot_header(store.hot_fd, &header) && header.record_count == live_count &&
+         file_size(store.hot_fd) == HOT_HEADER_SIZE + (off_t)(live_count * sizeof(TreasureRecord)) &&
+         fsync(store.clue_fd) == 0 && fsync(store.user_fd) == 0 && fsync(store.hot_fd) == 0;
+    store_close(&store);
+
+    if (!ok || rename(hot_temp, hot_path) != 0)
+    {
+        unlink(hot_temp);
+        close(lock_fd);
+        return 0;
+    }
+
+    rename(legacy_path, backup_path);
+    unlink(index_path);
+    close(lock_fd);
+    return 1;
+}
+
+void store_cursor_open(StoreCursor *cursor, TreasureStore *store)
+{
+    cursor->store = store;
+    cursor->records = NULL;
+    cursor->count = 0;
+    cursor->pos = 0;
+    cursor->base_slot = 0;
+    cursor->slot = -1;
+
+    if (store_map(store, MADV_SEQUENTIAL))
+    {
+        cursor->records = (const TreasureRecord *)(store->hot_map + HOT_HEADER_SIZE);
+        cursor->count = (size_t)mapped_records(store);
+    }
+}
+
+/* Returns the next live record, or NULL once the hot file is exhausted. */
+const TreasureRecord *store_cursor_next(StoreCursor *cursor)
+{
+    for (;;)
+    {
+        while (cursor->pos < cursor->count)
+        {
+            const TreasureRecord *record = &cursor->records[cursor->pos];
+            cursor->slot = cursor->base_slot + (long)cursor->pos;
+            cursor->pos++;
+            cursor->store->bytes_read += sizeof(TreasureRecord);
+            if (!RECORD_IS_DEAD(record) || record->deleted > cursor->store->generation)
+                return record;
+        }
+
+        long next_slot = cursor->base_slot + (long)cursor->count;
+        if ((uint64_t)next_slot >= cursor->store->record_count)
+            return NULL;
+        if (cursor->store->segment != NULL)
+        {
+            /* Archived hunts are decoded a block at a time; the copy keeps the cursor's records stable. */
+            cursor->count = segment_read_records(cursor->store, next_slot, cursor->batch);
+            if (cursor->count == 0)
+                return NULL;
+            cursor->records = cursor->batch;
+            cursor->pos = 0;
+            cursor->base_slot = next_slot;
+            continue;
+        }
+        size_t want = sizeof(cursor->batch);
+        if ((uint64_t)next_slot + STORE_SCAN_BATCH > cursor->store->record_count)
+            want = (size_t)(cursor->store->record_count - (uint64_t)next_slot) * sizeof(TreasureRecord);
+        off_t offset = HOT_HEADER_SIZE + (off_t)next_slot * (off_t)sizeof(TreasureRecord);
+        ssize_t n = pread(cursor->store->hot_fd, cursor->batch, want, offset);
+        if (n < (ssize_t)sizeof(TreasureRecord))
+            return NULL;
+
+        cursor->records = cursor->batch;
+        cursor->count = (size_t)n / sizeof(TreasureRecord);
+        cursor->pos = 0;
+        cursor->base_slot = next_slot;
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef TREASURE_STORE_H
+#define TREASURE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "treasure.h"
+
+/*
+ * Split storage for one hunt: treasures.hot holds a small header followed by
+ * TreasureRecord slots, treasures.clues is an append-only blob of clue text
+ * and treasures.users is the username dictionary (one fixed-width name per
+ * user number). A hunt still stored as treasures.dat is migrated by the
+ * first writer to open it (or --migrate), which keeps the old file as
+ * treasures.dat.bak; until then readers convert it in memory.
+ *
+ * Readers never lock. The hot header is the manifest: a writer fills in
+ * clue text, usernames and records past the committed record_count and
+ * only then stores the new count, so a reader that takes the header once
+ * at open sees whole records and every clue they point at. Removals bump
+ * generation and stamp it into the record's deleted field; a reader keeps
+ * seeing records removed after its snapshot. Compaction publishes a new
+ * hot/clue pair by rename and the header names its clue file, so a reader
+ * that raced it reopens until the pair matches. Writers are serialised
+ * with flock() on treasures.lock, held from store_open() to store_close().
+ * An archived hunt keeps treasures.seg instead of the hot and clue files
+ * (see treasure_segment.h); readers go through the same calls.
+ */
+
+#define STORE_HOT_MAGIC 0x544f4854u
+#define STORE_HOT_VERSION 1
+#define STORE_HOT_COMMITTED 0x1
+#define STORE_SCAN_BATCH 512
+/* Longest hunt ID store_open() accepts; the rest of MAX_PATH_LENGTH holds a file name and temp suffix. */
+#define STORE_MAX_HUNT_ID (MAX_PATH_LENGTH - 64)
+
+/* Headers written before the flag existed count records from the file size. */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t flags;
+    uint64_t record_count;
+    uint64_t clue_ino;
+    uint32_t generation;
+    uint32_t reserved[7];
+} TreasureHotHeader;
+
+/*
+ * Sidecar files (.idx, .agg, .geo, .fts) follow the same rule as the hot
+ * file: a writer changes a live sidecar only by filling in entries readers
+ * cannot reach yet and then storing the word that reaches them, and it
+ * publishes anything else (growing, merging, rebuilding) as a new file
+ * renamed into place under the hunt lock. A reader that opens a sidecar
+ * whose stamp does not match treasures.hot (mid-write or stale) rebuilds
+ * a private copy from the records and never writes the file.
+ */
+#define SIDECAR_PUBLISH(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+#define SIDECAR_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+
+/* Identity of treasures.hot; sidecar files record it to tell whether they are current. */
+typedef struct
+{
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} StoreStamp;
+
+typedef struct
+{
+    char hunt_id[MAX_PATH_LENGTH];
+    int writable;
+    int hot_fd;
+    int clue_fd;
+    int user_fd;
+    int lock_fd;
+    uint64_t record_count; /* snapshot taken at open; writers advance it as they commit */
+    uint32_t generation;
+    StoreStamp stamp;      /* treasures.hot as of the snapshot */
+    const char *hot_map;
+    size_t hot_map_size;
+    const char *clue_map;
+    size_t clue_map_size;
+    char (*users)[MAX_USERNAME_LENGTH];
+    int users_mapped;
+    uint32_t user_count;
+    uint32_t user_capacity;
+    uint32_t users_flushed;
+    uint32_t *user_table;
+    uint32_t user_table_capacity;
+    char name_buf[MAX_USERNAME_LENGTH];
+    uint64_t bytes_read; /* record, clue and dictionary bytes read so far */
+    struct TreasureSegment *segment; /* set when the hunt is archived; hot_fd is then treasures.seg */
+    int legacy; /* read from treasures.dat through an in-memory conversion */
+} TreasureStore;
+
+/*
+ * Walks the live records of a store. When the hot file could be mapped the
+ * cursor hands out pointers straight into the mapping; otherwise it falls
+ * back to reading STORE_SCAN_BATCH records at a time into batch.
+ */
+typedef struct
+{
+    TreasureStore *store;
+    const TreasureRecord *records;
+    TreasureRecord batch[STORE_SCAN_BATCH];
+    size_t count;
+    size_t pos;
+    long base_slot;
+    long slot;
+} StoreCursor;
+
+int store_hunt_path(char *out, const char *hunt_id, const char *name);
+void store_temp_path(char *out, const char *hunt_id, const char *name);
+int store_stamp_now(TreasureStore *store, StoreStamp *stamp);
+int store_lock_hunt(const char *hunt_id);
+int store_hunt_exists(const char *hunt_id);
+int store_list_hunts(char (**hunts)[MAX_PATH_LENGTH]);
+int store_open(TreasureStore *store, const char *hunt_id, int writable);
+int store_open_archived(TreasureStore *store, const char *hunt_id);
+void store_close(TreasureStore *store);
+long store_record_count(TreasureStore *store);
+long store_record_offset(long slot);
+long long store_disk_bytes(TreasureStore *store);
+int store_data_stat(TreasureStore *store, struct stat *st);
+int store_read_record(TreasureStore *store, long slot, TreasureRecord *out);
+int store_read_treasure(TreasureStore *store, long slot, Treasure *out);
+int store_read_clue(TreasureStore *store, const TreasureRecord *record, char *clue);
+int store_map(TreasureStore *store, int advice);
+int store_load_users(TreasureStore *store);
+const char *store_username(TreasureStore *store, uint32_t user);
+int store_intern_user(TreasureStore *store, const char *username, uint32_t *user);
+int store_append(TreasureStore *store, const Treasure *treasures, size_t count, long *first_slot);
+int store_mark_dead(TreasureStore *store, long slot);
+long store_compact(TreasureStore *store);
+int store_migrate(const char *hunt_id);
+
+void store_cursor_open(StoreCursor *cursor, TreasureStore *store);
+const TreasureRecord *store_cursor_next(StoreCursor *cursor);
+
+#endif